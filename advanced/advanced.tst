@@ -4,4 +4,16 @@
 7 io_in_test.py
 7 io_out_test.py
 7 io_append_test.py
-11 exclusive_access_test.py
\ No newline at end of file
+11 exclusive_access_test.py
+5 hash_test.py
+5 batch_test.py
+5 parsecache_test.py
+5 jobs_verbose_test.py
+5 trace_test.py
+5 stats_test.py
+5 control_test.py
+5 snapshot_test.py
+5 history_test.py
+5 complete_test.py
+5 heredoc_test.py
+5 plugin_reload_test.py
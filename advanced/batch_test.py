@@ -0,0 +1,66 @@
+#!/usr/bin/python
+#
+# batch_test
+#
+# Test that the shell runs without a terminal: a command given
+# with -c, a script file, and commands piped into stdin.  No prompt
+# may be printed, and the exit status is that of the last command.
+#
+#       Requires the use of the following commands:
+#
+#       echo, tr, false
+#
+
+import sys, imp, subprocess, os
+sys.path.append("/home/courses/software/pexpect-dpty/");
+import shellio
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+
+def_module = imp.load_source('', definitions_scriptname)
+
+#run the shell without a controlling terminal, feeding 'stdin'
+def run(args, stdin=""):
+        p = subprocess.Popen(def_module.shell + " " + args, shell=True,
+                             stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                             preexec_fn=os.setsid, universal_newlines=True)
+        out = p.communicate(stdin)[0]
+        return out, p.returncode
+
+# -c runs every pipeline of the command line
+out, rc = run("-c 'echo hello | tr a-z A-Z; echo world'")
+assert out == "HELLO\nworld\n", "Shell did not run -c command: " + out
+assert rc == 0, "Shell did not exit with status 0"
+
+# the exit status is that of the last command
+out, rc = run("-c 'echo ignored; false'")
+assert rc == 1, "Shell did not return the status of the last command"
+
+# commands from a pipe, without a prompt
+out, rc = run("", "echo one\necho two\n")
+assert out == "one\ntwo\n", "Shell printed extraneous output: " + out
+
+# a script file, whose last line lacks a newline
+script = "/tmp/esh_batch_test.%d" % os.getpid()
+f = open(script, "w")
+f.write("echo first\necho last")
+f.close()
+out, rc = run(script)
+os.unlink(script)
+assert out == "first\nlast\n", "Shell did not run script: " + out
+
+# a syntax error fails, as does a script whose last line is one
+out, rc = run("-c 'echo |'")
+assert rc == 2, "Shell did not fail on a syntax error"
+out, rc = run("", "echo fine\necho |\n")
+assert out == "fine\n" and rc == 2, "Shell did not fail on a bad last line"
+
+# exit uses its argument, or else the status of the last command
+out, rc = run("-c 'exit 3'")
+assert rc == 3, "exit did not use its argument"
+out, rc = run("", "false\nexit\necho not reached\n")
+assert out == "" and rc == 1, "exit did not use the last status"
+
+
+shellio.success()
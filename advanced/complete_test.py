@@ -0,0 +1,104 @@
+#!/usr/bin/python
+#
+# complete_test
+#
+# Test that Tab completes command names from $PATH and the builtins,
+# and that commands added to or removed from a $PATH directory, or made
+# executable, are completed (or not) right away.
+#
+#       Requires the use of the following commands:
+#
+#       echo
+#
+
+import sys, imp, atexit
+sys.path.append("/home/courses/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check
+import tempfile
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+        c.close(force=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+#a $PATH directory with a few commands
+bindir = tempfile.mkdtemp()
+def make_command(name, mode=0o755):
+    path = os.path.join(bindir, name)
+    with open(path, "w") as f:
+        f.write("#!/bin/sh\necho ran %s\n" % name)
+    os.chmod(path, mode)
+make_command("eshtest-alpha")
+make_command("eshtest-beta")
+make_command("eshtest-data", 0o644)
+
+#which is also in $PATH through a link, as /bin is on many systems
+linkdir = bindir + "-link"
+os.symlink(bindir, linkdir)
+atexit.register(os.unlink, linkdir)
+
+env = dict(os.environ, ESH_HISTFILE="",
+           PATH=linkdir + ":" + bindir + ":" + os.environ["PATH"])
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile, env=env)
+atexit.register(force_shell_termination, shell_process=c)
+
+# set timeout for all following 'expect*' calls to 2 seconds
+c.timeout = 2
+
+# ensure that shell prints expected prompt
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# a unique prefix is completed, and the command can be run
+c.send("eshtest-a\t\r")
+assert c.expect_exact("ran eshtest-alpha") == 0, \
+    "Shell did not complete the command name"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# so are builtins, and commands after a |
+c.send("snapsh\t\r")
+assert c.expect("snapshot off\r\n") == 0, "Shell did not complete a builtin"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.send("echo x | eshtest-b\t\r")
+assert c.expect_exact("ran eshtest-beta") == 0, \
+    "Shell did not complete the command name after a |"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# files that are not executable are not commands
+c.sendline("complete eshtest-")
+assert c.expect_exact("\reshtest-alpha\r\neshtest-beta\r\n") == 0, \
+    "Shell listed the wrong commands"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# changes to the directory are seen without reading it again, even
+# though it is in $PATH twice
+make_command("eshtest-gamma")
+os.chmod(os.path.join(bindir, "eshtest-data"), 0o755)
+os.unlink(os.path.join(bindir, "eshtest-beta"))
+time.sleep(0.2)
+c.sendline("complete eshtest-")
+assert c.expect_exact("\reshtest-alpha\r\neshtest-data\r\neshtest-gamma\r\n") == 0, \
+    "Shell did not notice the changed commands"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.send("eshtest-g\t\r")
+assert c.expect_exact("ran eshtest-gamma") == 0, \
+    "Shell did not complete a new command"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("complete")
+assert c.expect("1 full reads, ") == 0, \
+    "Shell read the directories again"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+#exit
+c.sendline("exit")
+assert c.expect_exact("exit\r\n") == 0, "Shell output extraneous characters"
+c.expect(pexpect.EOF)
+
+
+shellio.success()
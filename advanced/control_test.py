@@ -0,0 +1,121 @@
+#!/usr/bin/python
+#
+# control_test
+#
+# Test that a shell started with -C serves requests on its control
+# socket: submitting a background job, listing jobs as JSON, and
+# stopping, continuing and killing jobs, while the line the user is
+# typing is kept.
+#
+#       Requires the use of the following commands:
+#
+#       sleep, echo
+#
+
+import sys, imp, atexit
+sys.path.append("/home/courses/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check
+import socket, json
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+        c.close(force=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+#spawn an instance of the shell with a control socket
+path = "/tmp/esh-control-test.%d" % os.getpid()
+c = pexpect.spawn(def_module.shell + " -C " + path, drainpty=True, logfile=logfile)
+atexit.register(force_shell_termination, shell_process=c)
+
+# set timeout for all following 'expect*' calls to 2 seconds
+c.timeout = 2
+
+# ensure that shell prints expected prompt
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+s.connect(path)
+s.settimeout(2)
+replies = s.makefile("r")
+
+def request(line):
+    s.sendall((line + "\n").encode())
+    return json.loads(replies.readline())
+
+# wait until job 1 is in the given state
+def expect_status(status):
+    for i in range(200):
+        jobs = request("jobs")["jobs"]
+        if jobs and jobs[0]["status"] == status:
+            return jobs[0]
+        time.sleep(0.01)
+    assert False, "Job did not become " + status
+
+# a job submitted while the user is typing runs in the background
+c.send("echo par")
+reply = request("run sleep 100")
+assert reply["ok"] and len(reply["jobs"]) == 1, "Shell did not start the job"
+job = reply["jobs"][0]
+assert job["jid"] == 1 and job["commands"][0]["argv"] == ["sleep", "100"], \
+    "Shell reported the wrong job"
+(jobid, pid) = shellio.parse_regular_expression(c, def_module.bgjob_regex)
+assert int(pid) == job["pgrp"], "Shell reported the wrong process group"
+os.kill(job["pgrp"], 0)
+
+# stop, continue and kill it
+assert request("stop 1")["ok"], "Shell did not stop the job"
+assert expect_status("stopped")["commands"][0]["state"] == "stopped", \
+    "Shell did not report the process stopped"
+assert request("bg %1")["ok"], "Shell did not continue the job"
+expect_status("running")
+assert request("kill 1 15")["ok"], "Shell did not kill the job"
+assert c.expect("Done") == 0, "Shell did not report the job done"
+
+# builtins would run in the shell itself, so they are refused, and
+# so is a line that starts a job before one
+for line in ["exit", "fg 1", "time exit", "sleep 100 & jobs"]:
+    reply = request("run " + line)
+    assert not reply["ok"] and "builtin" in reply["error"], \
+        "Shell ran a builtin for a client: " + line
+assert request("jobs")["jobs"] == [], "Shell ran part of a refused line"
+
+# so is a line that does not parse
+assert request("run sleep 100 | ") == {"ok": False, "error": "syntax error"}, \
+    "Shell did not report a syntax error"
+assert request("jobs")["jobs"] == [], "Shell ran part of a bad line"
+assert request("run true")["ok"], "Shell did not survive a refused line"
+for i in range(200):
+    if request("jobs")["jobs"] == []:
+        break
+    time.sleep(0.01)
+
+assert request("fg 7") == {"ok": False, "error": "no such job"}, \
+    "Shell did not report a missing job"
+assert not request("frob")["ok"], "Shell accepted an unknown request"
+
+# many requests in a row are all answered, in order
+s.sendall(("jobs\n" * 500).encode())
+for i in range(500):
+    assert json.loads(replies.readline()) == {"ok": True, "jobs": []}, \
+        "Shell did not answer every request"
+s.close()
+
+# what the user typed was kept
+c.sendline("tial")
+assert c.expect_exact("partial") == 0, "Shell lost the line being typed"
+
+#exit
+c.sendline("exit")
+assert c.expect_exact("exit\r\n") == 0, "Shell output extraneous characters"
+c.expect(pexpect.EOF)
+assert not os.path.exists(path), "Shell did not remove its control socket"
+
+
+shellio.success()
@@ -0,0 +1,70 @@
+#!/usr/bin/python
+#
+# hash_test
+#
+# Test that the shell remembers where commands were found,
+# that 'hash' lists, pre-warms and clears those locations,
+# and that an unknown command is reported without running it.
+#
+#       Requires the use of the following commands:
+#
+#       echo, ls
+#
+
+import sys, imp, atexit
+sys.path.append("/home/courses/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+        c.close(force=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+#spawn an instance of the shell
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile)
+atexit.register(force_shell_termination, shell_process=c)
+
+# set timeout for all following 'expect*' calls to 2 seconds
+c.timeout = 2
+
+# ensure that shell prints expected prompt
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# nothing has been looked up yet
+c.sendline("hash")
+assert c.expect_exact("hash table empty") == 0, "Shell did not report an empty table"
+
+# run a command, which should then be remembered
+c.sendline("echo remembered")
+assert c.expect_exact("remembered") == 0, "Shell did not run echo"
+c.sendline("hash")
+assert c.expect("\d+\s+\S*/echo") == 0, "Shell did not remember echo"
+
+# pre-warm a command without running it
+c.sendline("hash ls")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("hash")
+assert c.expect("\d+\s+\S*/ls") == 0, "Shell did not pre-warm ls"
+
+# an unknown command is reported as such
+c.sendline("no_such_command_xyz")
+assert c.expect_exact("command not found") == 0, "Shell did not report unknown command"
+
+# forget everything
+c.sendline("hash -r")
+c.sendline("hash")
+assert c.expect_exact("hash table empty") == 0, "Shell did not clear the table"
+
+#exit
+c.sendline("exit")
+assert c.expect_exact("exit\r\n") == 0, "Shell output extraneous characters"
+
+
+shellio.success()
@@ -0,0 +1,100 @@
+#!/usr/bin/python
+#
+# heredoc_test
+#
+# Test that here-documents (<<word) read the lines after the command
+# line up to 'word', that here-strings (<<<word) supply 'word' and a
+# newline, and that either reaches the command as a memfd on stdin.
+#
+#       Requires the use of the following commands:
+#
+#       cat, tr, wc, readlink
+#
+
+import sys, imp, atexit
+sys.path.append("/home/courses/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check
+import subprocess
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+        c.close(force=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+env = dict(os.environ, ESH_HISTFILE="")
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile, env=env)
+atexit.register(force_shell_termination, shell_process=c)
+
+# set timeout for all following 'expect*' calls to 2 seconds
+c.timeout = 2
+
+# ensure that shell prints expected prompt
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# the lines of a here-document are prompted for with '> '
+c.sendline("cat <<END | tr a-z A-Z")
+assert c.expect_exact("> ") == 0, "Shell did not ask for the here-document"
+c.sendline("first line")
+assert c.expect_exact("> ") == 0, "Shell did not ask for the here-document"
+c.sendline("  second END")
+assert c.expect_exact("> ") == 0, "Shell did not ask for the here-document"
+c.sendline("END")
+assert c.expect_exact("FIRST LINE\r\n  SECOND END\r\n") == 0, \
+    "Shell did not pass the here-document"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# several here-documents are read in order
+c.sendline("cat <<A; wc -l <<B")
+c.sendline("from a")
+c.sendline("A")
+c.sendline("1")
+c.sendline("2")
+c.sendline("B")
+assert c.expect_exact("from a\r\n2\r\n") == 0, \
+    "Shell did not pass the here-documents in order"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# a here-string is the word and a newline
+c.sendline("wc -c <<<hello")
+assert c.expect_exact("6\r\n") == 0, "Shell did not pass the here-string"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# stdin is a memfd, not a file on disk or a pipe
+c.sendline("readlink /proc/self/fd/0 <<<x")
+assert c.expect("memfd:esh-heredoc") == 0, "Shell did not use a memfd"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# only the first command of a pipeline may read one
+c.sendline("cat <x <<<y")
+assert c.expect_exact("Ambiguous input redirect.") == 0, \
+    "Shell did not reject two input redirections"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("cat | cat <<<y")
+assert c.expect_exact("Ambiguous input redirect.") == 0, \
+    "Shell did not reject a here-string in the middle of a pipeline"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# a -c command may hold nothing after its here-documents but their
+# bodies; anything else is an error, and nothing runs
+for command in ["echo a\necho b", "cat <<E\nx\nE\necho after"]:
+    p = subprocess.Popen(def_module.shell.split() + ["-c", command],
+                         stdin=subprocess.DEVNULL, stdout=subprocess.PIPE,
+                         stderr=subprocess.PIPE, universal_newlines=True)
+    out, err = p.communicate()
+    assert out == "" and "Unexpected text after here-documents." in err \
+        and p.returncode == 2, "Shell ignored text after here-documents"
+
+#exit
+c.sendline("exit")
+assert c.expect_exact("exit\r\n") == 0, "Shell output extraneous characters"
+c.expect(pexpect.EOF)
+
+
+shellio.success()
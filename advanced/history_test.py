@@ -0,0 +1,131 @@
+#!/usr/bin/python
+#
+# history_test
+#
+# Test that command lines are appended to $ESH_HISTFILE, that earlier
+# lines and those other shells append can be searched with 'history -s'
+# and Ctrl-R, and that 'history -c' removes repeated lines.
+#
+#       Requires the use of the following commands:
+#
+#       echo
+#
+
+import sys, imp, atexit
+sys.path.append("/home/courses/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check
+import tempfile
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+        c.close(force=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+#a history file that already holds many lines, one of them unique
+histdir = tempfile.mkdtemp()
+histfile = os.path.join(histdir, "history")
+with open(histfile, "w") as f:
+    for i in range(5000):
+        f.write("echo line %d\n" % (i % 100))
+        if i == 1234:
+            f.write("echo needle-1234\n")
+
+env = dict(os.environ, ESH_HISTFILE=histfile)
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile, env=env)
+atexit.register(force_shell_termination, shell_process=c)
+
+# set timeout for all following 'expect*' calls to 2 seconds
+c.timeout = 2
+
+# ensure that shell prints expected prompt
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+def history_lines():
+    return open(histfile).read().splitlines()
+
+# lines are appended, but not repeated ones nor those starting with a space
+c.sendline("echo first")
+assert c.expect_exact("first") == 0, "Shell did not run the command"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("echo first")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline(" echo secret")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+assert history_lines()[-1] == "echo first" \
+    and history_lines()[-2] == "echo line 99", \
+    "Shell did not append its command lines correctly"
+
+# the last lines are listed with their numbers
+c.sendline("history 2")
+assert c.expect("5002  echo first\r\n *5003  history 2\r\n") == 0, \
+    "Shell did not list the last lines"
+
+# a search looks at the whole file, and lists each line once
+c.sendline("history -s needle")
+assert c.expect_exact("history -s needle\r\necho needle-1234\r\n") == 0, \
+    "Shell did not find the line"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("history -p echo line 7")
+assert c.expect_exact("echo line 79\r\necho line 78\r\n") == 0, \
+    "Shell did not list matching lines newest first"
+for i in range(77, 69, -1):
+    assert c.expect_exact("echo line %d\r\n" % i) == 0, \
+        "Shell did not list matching lines once"
+assert c.expect_exact("echo line 7\r\n") == 0, "Shell missed a line"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# lines another shell appends can be searched at once
+c2 = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile, env=env)
+assert c2.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c2.sendline("echo from-the-other-shell")
+assert c2.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c2.sendline("exit")
+c2.expect(pexpect.EOF)
+c.sendline("history -s other-shell")
+assert c.expect_exact("\r\necho from-the-other-shell\r\n") == 0, \
+    "Shell did not find the line another shell added"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# Ctrl-R replaces what was typed with the newest line containing it
+c.send("needle-\x12")
+c.send("\r")
+assert c.expect_exact("\rneedle-1234\r\n") == 0, \
+    "Ctrl-R did not find the line"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# and with older ones when pressed again
+c.send("line 5\x12\x12\r")
+assert c.expect_exact("\rline 58\r\n") == 0, \
+    "Ctrl-R did not go back to an older line"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# compacting keeps the newest copy of each line, in order
+c.sendline("history -c")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+lines = history_lines()
+assert len(lines) == len(set(lines)) and lines[-1] == "history -c" \
+    and lines[-2] == "echo line 58" and "echo needle-1234" in lines, \
+    "Shell did not compact its history"
+assert os.stat(histfile).st_mode & 0o777 == 0o600, \
+    "Compacted history can be read by others"
+
+# and later lines go to the new file
+c.sendline("echo after")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+assert history_lines()[-1] == "echo after", \
+    "Shell did not append to the compacted history"
+
+#exit
+c.sendline("exit")
+assert c.expect_exact("exit\r\n") == 0, "Shell output extraneous characters"
+c.expect(pexpect.EOF)
+
+
+shellio.success()
@@ -0,0 +1,75 @@
+#!/usr/bin/python
+#
+# jobs_verbose_test
+#
+# Test that 'time' reports how long a pipeline took, and that
+# 'jobs -v' shows the resources used by each stage of a running
+# job and lists completed jobs with their exit status.
+#
+#       Requires the use of the following commands:
+#
+#       sleep, true, false
+#
+
+import sys, imp, atexit
+sys.path.append("/home/courses/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+        c.close(force=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+#spawn an instance of the shell
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile)
+atexit.register(force_shell_termination, shell_process=c)
+
+# set timeout for all following 'expect*' calls to 2 seconds
+c.timeout = 2
+
+# ensure that shell prints expected prompt
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# 'time' reports real, user and sys time once the pipeline is done
+c.sendline("time sleep 1 | true")
+assert c.expect("real (\d+\.\d+)s\s+user \d+\.\d+s\s+sys \d+\.\d+s") == 0, \
+    "Shell did not report the time of the pipeline"
+assert float(c.match.group(1)) >= 1.0, "Shell reported a wrong real time"
+
+# a running job lists each of its processes with their state
+c.sendline("sleep 30 | sleep 31 &")
+assert c.expect(def_module.bgjob_regex) == 0, "Shell did not start the job"
+c.sendline("jobs -v")
+assert c.expect("real \d+\.\d+s user") == 0, "Shell did not print job usage"
+assert c.expect("\d+\s+running\s+user \d+\.\d+s.*\(sleep 30\)") == 0, \
+    "Shell did not print the first stage"
+assert c.expect("\d+\s+running\s+user \d+\.\d+s.*\(sleep 31\)") == 0, \
+    "Shell did not print the second stage"
+
+# completed jobs are listed with their exit status
+assert c.expect_exact("Completed:") == 0, "Shell did not list completed jobs"
+assert c.expect("Done, exit 0 \(sleep 1 \| true \| \)") == 0, \
+    "Shell did not list the timed job"
+assert c.expect("exit 0\s+user.*\(sleep 1\)") == 0, \
+    "Shell did not list the first stage of the timed job"
+
+c.sendline("kill")
+c.sendline("false")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("jobs -v")
+assert c.expect("Done, exit 1 \(false \)") == 0, \
+    "Shell did not report the exit status of false"
+
+#exit
+c.sendline("exit")
+assert c.expect_exact("exit\r\n") == 0, "Shell output extraneous characters"
+
+
+shellio.success()
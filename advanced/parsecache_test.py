@@ -0,0 +1,47 @@
+#!/usr/bin/python
+#
+# parsecache_test
+#
+# Test that repeated command lines are served from the parse cache,
+# that cached lines still run correctly, including redirections, and
+# that 'parsecache' reports, resizes and clears the cache.
+#
+#       Requires the use of the following commands:
+#
+#       echo, tr, cat
+#
+
+import sys, imp, subprocess, os, re
+sys.path.append("/home/courses/software/pexpect-dpty/");
+import shellio
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+
+def_module = imp.load_source('', definitions_scriptname)
+
+#run the shell without a controlling terminal, feeding 'stdin'
+def run(stdin):
+        p = subprocess.Popen(def_module.shell, shell=True,
+                             stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                             preexec_fn=os.setsid, universal_newlines=True)
+        return p.communicate(stdin)[0]
+
+outfile = "/tmp/esh_parsecache_test.%d" % os.getpid()
+
+# the same line three times: one miss, then two hits
+line = "echo cached | tr a-z A-Z >> " + outfile + "\n"
+out = run(line * 3 + "parsecache\ncat " + outfile + "\n")
+os.unlink(outfile)
+
+assert re.search("hits 2, misses 2", out), "Cache did not count hits: " + out
+assert out.endswith("CACHED\nCACHED\nCACHED\n"), "Cached lines did not run: " + out
+
+# a cache of size 1 evicts, and -r empties it
+out = run("parsecache -s 1\necho one\necho two\nparsecache\n"
+          "parsecache -r\nparsecache\n")
+assert re.search("entries 1/1, .*evictions [1-9]", out), "Cache did not evict: " + out
+assert out.count("entries 1/1") == 2, "Cache was not cleared: " + out
+
+
+shellio.success()
@@ -0,0 +1,146 @@
+#!/usr/bin/python
+#
+# plugin_reload_test
+#
+# Test that 'plugin load', 'unload' and 'reload' work while the shell
+# runs: a plugin's builtin is gone once it is unloaded and back once
+# it is loaded again, the shell function its init() replaced is put
+# back, its fini() is called, and the builtin can be run right after
+# a reload.  The plugin is built with cc, against the esh.h found
+# next to the shell.
+#
+#       Requires the use of the following commands:
+#
+#       cc
+#
+
+import sys, imp, atexit
+sys.path.append("/home/courses/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check
+import tempfile, shutil, subprocess
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+        c.close(force=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+#a plugin with a builtin, a prompt of its own, and a fini()
+plugin_source = r"""
+#include <stdio.h>
+#include <string.h>
+#include "esh.h"
+
+ESH_PLUGIN_ABI;
+
+static int greet(struct esh_command *cmd)
+{
+    printf("hello from plugin\n");
+    return 0;
+}
+
+static char *prompt(void)
+{
+    return strdup("plugged> ");
+}
+
+static void fini(void)
+{
+    printf("plugin fini\n");
+    fflush(stdout);
+}
+
+static bool init(struct esh_shell *shell)
+{
+    shell->build_prompt = prompt;
+    return shell->register_builtin("greet", greet);
+}
+
+struct esh_plugin esh_module = {
+    .init = init,
+    .fini = fini,
+};
+"""
+
+tmpdir = tempfile.mkdtemp()
+atexit.register(shutil.rmtree, tmpdir)
+source = os.path.join(tmpdir, "greet.c")
+plugin = os.path.join(tmpdir, "greet.so")
+with open(source, "w") as f:
+    f.write(plugin_source)
+include = os.path.dirname(os.path.abspath(def_module.shell))
+assert subprocess.call(["cc", "-shared", "-fPIC", "-I" + include,
+                        "-o", plugin, source]) == 0, \
+    "Could not build the test plugin"
+
+env = dict(os.environ, ESH_HISTFILE="", ESH_PLUGIN_MANIFEST="")
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile, env=env)
+atexit.register(force_shell_termination, shell_process=c)
+
+# set timeout for all following 'expect*' calls to 2 seconds
+c.timeout = 2
+
+# ensure that shell prints expected prompt
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# the builtin does not exist before the plugin is loaded
+c.sendline("greet")
+assert c.expect_exact("greet: command not found") == 0, \
+    "Shell ran a builtin of a plugin that is not loaded"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# once loaded, its builtin runs and its prompt is used
+c.sendline("plugin load " + plugin)
+assert c.expect_exact("plugged> ") == 0, "Plugin's prompt was not used"
+c.sendline("greet")
+assert c.expect_exact("hello from plugin") == 0, "Plugin's builtin did not run"
+assert c.expect_exact("plugged> ") == 0, "Plugin's prompt was not used"
+
+# a plugin cannot be loaded twice
+c.sendline("plugin load " + plugin)
+assert c.expect_exact("already loaded") == 0, "Plugin was loaded twice"
+assert c.expect_exact("plugged> ") == 0, "Plugin's prompt was not used"
+
+# unloading calls fini(), and takes back the builtin and the prompt
+c.sendline("plugin unload greet")
+assert c.expect_exact("plugin fini") == 0, "Plugin's fini() was not called"
+assert c.expect(def_module.prompt) == 0, "Shell's own prompt was not restored"
+c.sendline("greet")
+assert c.expect_exact("greet: command not found") == 0, \
+    "Plugin's builtin was still there after unload"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("plugin unload greet")
+assert c.expect_exact("not loaded") == 0, "Plugin was unloaded twice"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# load it again, then reload it and run its builtin on the same line,
+# and again on the next one
+c.sendline("plugin load " + plugin)
+assert c.expect_exact("plugged> ") == 0, "Plugin's prompt was not used"
+c.sendline("plugin reload greet; greet")
+assert c.expect_exact("plugin fini") == 0, "Plugin's fini() was not called"
+assert c.expect_exact("hello from plugin") == 0, \
+    "Plugin's builtin did not run after reload"
+assert c.expect_exact("plugged> ") == 0, "Plugin's prompt was not used"
+c.sendline("greet")
+assert c.expect_exact("hello from plugin") == 0, \
+    "Plugin's builtin did not run after reload"
+assert c.expect_exact("plugged> ") == 0, "Plugin's prompt was not used"
+
+# the plugin is listed once
+c.sendline("plugin")
+assert c.expect_exact("loaded   " + os.path.realpath(plugin)) == 0, \
+    "Plugin was not listed"
+assert c.expect_exact("plugged> ") == 0, "Plugin's prompt was not used"
+
+c.sendline("exit")
+assert c.expect(pexpect.EOF) == 0, "Shell did not exit"
+
+
+shellio.success()
@@ -0,0 +1,99 @@
+#!/usr/bin/python
+#
+# snapshot_test
+#
+# Test that a shell started with ESH_SNAPSHOT=1 publishes its job table
+# in shared memory, in the layout of esh-snapshot.h, keeps it up to
+# date as jobs change state, and removes it when it exits.
+#
+#       Requires the use of the following commands:
+#
+#       sleep
+#
+
+import sys, imp, atexit
+sys.path.append("/home/courses/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check
+import struct
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+        c.close(force=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+#spawn an instance of the shell that publishes its job table
+env = dict(os.environ, ESH_SNAPSHOT="1")
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile, env=env)
+atexit.register(force_shell_termination, shell_process=c)
+
+# set timeout for all following 'expect*' calls to 2 seconds
+c.timeout = 2
+
+# ensure that shell prints expected prompt
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+path = "/dev/shm/esh-snapshot.%d" % c.pid
+HEADER = "<IIIiQQQiiii"
+JOB = "<iiiiiiQQQQqqqqq128s"
+
+# read the snapshot, retrying while it is being updated
+def snapshot():
+    while True:
+        data = open(path, "rb").read()
+        (magic, version, size, pid, seq, updates, updated, alive, njobs,
+         nlisted, reserved) = struct.unpack_from(HEADER, data)
+        if seq % 2 == 1:
+            continue
+        jobs = []
+        for i in range(nlisted):
+            f = struct.unpack_from(JOB, data, struct.calcsize(HEADER)
+                                   + i * struct.calcsize(JOB))
+            jobs.append({"jid": f[0], "pgrp": f[1], "status": f[2],
+                         "nprocs": f[3], "command": f[-1].split(b"\0")[0]})
+        assert magic == 0x45534853 and size == len(data) and pid == c.pid, \
+            "Shell published a snapshot with the wrong header"
+        return jobs
+
+def expect_status(status):
+    for i in range(200):
+        jobs = snapshot()
+        if jobs and jobs[0]["status"] == status:
+            return
+        time.sleep(0.01)
+    assert False, "Snapshot did not show the job's new status"
+
+assert snapshot() == [], "Shell published jobs that do not exist"
+
+c.sendline("sleep 100 &")
+(jobid, pid) = shellio.parse_regular_expression(c, def_module.bgjob_regex)
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+jobs = snapshot()
+assert len(jobs) == 1 and jobs[0]["jid"] == int(jobid) \
+    and jobs[0]["pgrp"] == int(pid) and jobs[0]["nprocs"] == 1 \
+    and jobs[0]["command"] == b"sleep 100", "Snapshot did not show the job"
+
+# stopped (2) and running in the background (1) again
+c.sendline("stop " + jobid)
+expect_status(2)
+c.sendline("bg " + jobid)
+expect_status(1)
+
+c.sendline("kill " + jobid)
+assert c.expect("Done") == 0, "Shell did not report the job done"
+assert snapshot() == [], "Snapshot still showed the job"
+
+#exit
+c.sendline("exit")
+assert c.expect_exact("exit\r\n") == 0, "Shell output extraneous characters"
+c.expect(pexpect.EOF)
+assert not os.path.exists(path), "Shell did not remove its snapshot"
+
+
+shellio.success()
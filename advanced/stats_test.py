@@ -0,0 +1,81 @@
+#!/usr/bin/python
+#
+# stats_test
+#
+# Test that 'stats' reports latency histograms of spawning, exec and
+# parsing, that 'stats -r' resets them, and that 'stats export' writes
+# them in the Prometheus text format.
+#
+#       Requires the use of the following commands:
+#
+#       true, cat, rm
+#
+
+import sys, imp, atexit
+sys.path.append("/home/courses/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+        c.close(force=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+#spawn an instance of the shell
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile)
+atexit.register(force_shell_termination, shell_process=c)
+
+# set timeout for all following 'expect*' calls to 2 seconds
+c.timeout = 2
+
+# ensure that shell prints expected prompt
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# forget what was recorded at startup, then run two commands
+c.sendline("stats -r")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("true")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("true")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("stats")
+assert c.expect("\(us\) +count +min +mean +p50 +p90 +p99 +max") == 0, \
+    "Shell did not print the stats header"
+assert c.expect("spawn +2 ") == 0, "Shell did not count spawns"
+assert c.expect("exec +2 ") == 0, "Shell did not count execs"
+assert c.expect("parse +[3-9] ") == 0, "Shell did not count parses"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# the export file has a histogram with cumulative buckets per path
+path = "/tmp/esh-stats-test.%d.prom" % os.getpid()
+c.sendline("stats export " + path)
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("cat " + path)
+assert c.expect_exact("# TYPE esh_spawn_seconds histogram") == 0, \
+    "Shell did not export the spawn histogram"
+assert c.expect('esh_spawn_seconds_bucket\{pid="\d+",le="\+Inf"\} 2') == 0, \
+    "Shell did not export the spawn buckets"
+assert c.expect('esh_spawn_seconds_count\{pid="\d+"\} 2') == 0, \
+    "Shell did not export the spawn count"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("stats")
+assert c.expect_exact("exported to " + path + " every 15 s") == 0, \
+    "Shell did not report the export"
+c.sendline("stats export off")
+c.sendline("rm " + path)
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+#exit
+c.sendline("exit")
+assert c.expect_exact("exit\r\n") == 0, "Shell output extraneous characters"
+
+
+shellio.success()
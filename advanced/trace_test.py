@@ -0,0 +1,74 @@
+#!/usr/bin/python
+#
+# trace_test
+#
+# Test that 'trace' records what the shell does once turned on,
+# and that 'trace dump' writes it as Chrome trace event JSON.
+#
+#       Requires the use of the following commands:
+#
+#       true
+#
+
+import sys, imp, atexit
+sys.path.append("/home/courses/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+        c.close(force=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+#spawn an instance of the shell
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile)
+atexit.register(force_shell_termination, shell_process=c)
+
+# set timeout for all following 'expect*' calls to 2 seconds
+c.timeout = 2
+
+# ensure that shell prints expected prompt
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# nothing is recorded until tracing is turned on
+c.sendline("trace")
+assert c.expect("tracing off, 0 events recorded") == 0, \
+    "Shell did not report tracing off"
+
+c.sendline("trace on")
+c.sendline("true")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("trace")
+assert c.expect("tracing on, [1-9]\d* events recorded") == 0, \
+    "Shell did not record events"
+
+# the line, its parse, the spawn and the wait are in the dump
+c.sendline("trace dump")
+assert c.expect_exact('{"displayTimeUnit":"ns","traceEvents":[') == 0, \
+    "Shell did not dump the trace"
+assert c.expect('"name":"line"[^\n]*"detail":"true"') == 0, \
+    "Shell did not record the line"
+assert c.expect('"name":"parse"') == 0, "Shell did not record parsing"
+assert c.expect('"name":"spawn"[^\n]*"ph":"B"') == 0, "Shell did not record spawn"
+assert c.expect('"name":"wait"[^\n]*"ph":"E"') == 0, "Shell did not record wait"
+assert c.expect_exact("]}") == 0, "Shell did not finish the dump"
+
+# cleared events are not dumped again
+c.sendline("trace clear")
+c.sendline("trace off")
+c.sendline("trace")
+assert c.expect("tracing off, [1-9] events recorded") == 0, \
+    "Shell did not clear the trace"
+
+#exit
+c.sendline("exit")
+assert c.expect_exact("exit\r\n") == 0, "Shell output extraneous characters"
+
+
+shellio.success()
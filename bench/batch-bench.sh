@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# batch-bench - time esh running a script of simple commands headlessly.
+#
+# Usage: bench/batch-bench.sh [-n lines] [command]
+#
+# Writes a script of 'lines' copies of 'command' (100000 copies of
+# 'true' by default), then runs it through esh as a script argument,
+# as '-c' is not suited to 100k lines, and from a pipe on stdin.
+# Run from the top-level directory after 'make'.
+
+n=100000
+while getopts n: opt; do
+    case $opt in
+    n) n=$OPTARG ;;
+    *) echo "Usage: $0 [-n lines] [command]"; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+cmd=${1:-true}
+
+esh=${ESH:-./esh}
+script=$(mktemp /tmp/batch-bench.XXXXXX)
+trap 'rm -f "$script"' EXIT
+
+awk -v n="$n" -v cmd="$cmd" 'BEGIN { for (i = 0; i < n; i++) print cmd }' \
+    > "$script"
+
+now() {
+    date +%s.%N
+}
+
+report() {
+    awk -v what="$1" -v t0="$2" -v t1="$3" -v n="$n" 'BEGIN {
+        t = t1 - t0
+        printf "%-8s %8d lines %8.2f s %10.0f lines/s\n", what, n, t, n / t
+    }'
+}
+
+t0=$(now)
+"$esh" "$script" > /dev/null
+t1=$(now)
+report script "$t0" "$t1"
+
+t0=$(now)
+"$esh" < "$script" > /dev/null
+t1=$(now)
+report stdin "$t0" "$t1"
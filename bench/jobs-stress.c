@@ -0,0 +1,147 @@
+/*
+ * jobs-stress - stress test for the job table.
+ *
+ * Fills the job table with many concurrent jobs of 1 to 3 processes
+ * each (10000 by default), checks that every job and process can be
+ * found by jid, pgrp and pid, and then reaps all processes in random
+ * order through esh_job_change_status(), as the SIGCHLD handler would.
+ * No processes are actually started; pids are made up.
+ *
+ * Exits with a non-zero status if the table is inconsistent.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "esh.h"
+
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
+
+#define FIRST_PID   100000
+#define MAX_STAGES  3
+
+static void
+usage(char *progname)
+{
+    printf("Usage: %s [-n jobs]\n", progname);
+    exit(EXIT_SUCCESS);
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+check(bool cond, const char *what, int i)
+{
+    if (!cond) {
+        fprintf(stderr, "jobs-stress: %s failed for job %d\n", what, i);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Make a command in the arena of 'line', as the parser would */
+static struct esh_command *
+make_command(struct esh_command_line *line, pid_t pid)
+{
+    char **argv = obstack_alloc(&line->arena, 2 * sizeof *argv);
+    argv[0] = obstack_copy0(&line->arena, "true", 4);
+    argv[1] = NULL;
+
+    struct esh_command *cmd = esh_command_create(&line->arena, argv,
+                                                 NULL, NULL, false);
+    cmd->pid = pid;
+    return cmd;
+}
+
+int
+main(int ac, char *av[])
+{
+    int opt, n = 10000, i, npids = 0;
+
+    while ((opt = getopt(ac, av, "hn:")) > 0) {
+        switch (opt) {
+        case 'n':
+            n = atoi(optarg);
+            break;
+        default:
+            usage(av[0]);
+        }
+    }
+
+    esh_jobs_init();
+    pid_t *pids = malloc(n * MAX_STAGES * sizeof *pids);
+    srand(42);
+
+    double start = now();
+    for (i = 0; i < n; i++) {
+        pid_t pgrp = FIRST_PID + i * MAX_STAGES;
+        int stage, stages = 1 + i % MAX_STAGES;
+
+        struct esh_command_line *line = esh_command_line_create_empty();
+        struct esh_pipeline *pipe = esh_pipeline_create(&line->arena,
+                                                make_command(line, pgrp));
+        for (stage = 1; stage < stages; stage++) {
+            struct esh_command *cmd = make_command(line, pgrp + stage);
+            cmd->pipeline = pipe;
+            list_push_back(&pipe->commands, &cmd->elem);
+        }
+        esh_pipeline_finish(pipe);
+
+        /* the job outlives its command line, as in the shell */
+        struct esh_pipeline *job = esh_pipeline_copy(pipe);
+        esh_command_line_free(line);
+        job->pgrp = pgrp;
+        job->status = BACKGROUND;
+        esh_job_add(job);
+        check(job->jid == i + 1, "jid assignment", i);
+
+        for (stage = 0; stage < stages; stage++)
+            pids[npids++] = pgrp + stage;
+    }
+    double added = now();
+
+    for (i = 0; i < n; i++) {
+        int j = rand() % n;
+        pid_t pgrp = FIRST_PID + j * MAX_STAGES;
+        struct esh_pipeline *job = esh_get_job_from_jid(j + 1);
+
+        check(job != NULL && job->pgrp == pgrp, "lookup by jid", j);
+        check(esh_get_job_from_pgrp(pgrp) == job, "lookup by pgrp", j);
+        check(esh_get_cmd_from_pid(pgrp)->pipeline == job, "lookup by pid", j);
+    }
+    double looked_up = now();
+
+    /* Reap every process, in random order. */
+    for (i = npids - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        pid_t t = pids[i];
+        pids[i] = pids[j];
+        pids[j] = t;
+    }
+    for (i = 0; i < npids; i++) {
+        check(esh_get_cmd_from_pid(pids[i]) != NULL, "live process", i);
+        struct esh_pipeline *done = esh_job_change_status(pids[i], 0, NULL);
+        if (done)
+            esh_pipeline_free(done);
+        check(esh_get_cmd_from_pid(pids[i]) == NULL, "reaped process", i);
+    }
+    double reaped = now();
+
+    check(list_empty(&current_jobs), "empty job list", 0);
+    check(esh_get_job_from_jid(1) == NULL, "empty jid index", 0);
+
+    printf("%d jobs, %d processes\n", n, npids);
+    printf("  add     %8.1f ns/job\n", (added - start) * 1e9 / n);
+    printf("  lookup  %8.1f ns/job (jid + pgrp + pid)\n",
+           (looked_up - added) * 1e9 / n);
+    printf("  reap    %8.1f ns/process\n", (reaped - looked_up) * 1e9 / npids);
+    free(pids);
+    return 0;
+}
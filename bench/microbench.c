@@ -0,0 +1,558 @@
+/*
+ * microbench - measure the shell's hot paths and report them as JSON.
+ *
+ * Each benchmark runs a calibrated number of operations, so that one
+ * run takes about 0.2 seconds, and is repeated several times.  For each
+ * benchmark the median and minimum time per operation are reported, and
+ * bytes/sec for those that move data.  The output is a single JSON
+ * object on stdout, suitable for tracking results over time:
+ *
+ *   { "version": 1, "time": ..., "host": ..., "cpus": ...,
+ *     "results": [ { "name": ..., "unit": ..., "runs": ...,
+ *                    "ops": ..., "ns_per_op": ..., "min_ns_per_op": ...,
+ *                    "ops_per_sec": ..., "bytes_per_sec": ... }, ... ] }
+ *
+ * The job table benchmarks use made-up pids; the spawn and pipe
+ * benchmarks start real processes.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "esh-sys-utils.h"
+#include "esh.h"
+#include "esh-snapshot.h"
+
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
+
+#define LIST_SIZE   1024        /* elements in the list benchmarks */
+#define JOBS        1000        /* jobs in the job table benchmarks */
+#define JOB_STAGES  3           /* processes per job */
+#define FIRST_PID   100000
+#define PIPE_BYTES  (64 << 20)  /* bytes sent through each pipeline */
+
+static void
+usage(char *progname)
+{
+    printf("Usage: %s [-t seconds] [-r runs] [-f filter] [-l]\n"
+           "  -t  target time of one run (default 0.2)\n"
+           "  -r  runs per benchmark (default 5)\n"
+           "  -f  only run benchmarks whose name contains filter\n"
+           "  -l  list benchmarks\n", progname);
+    exit(EXIT_SUCCESS);
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Defeat dead code elimination of benchmark results */
+static volatile unsigned long sink;
+
+/* Parsing */
+
+static char *short_line = "ls -l /tmp | grep esh > out &";
+static char *long_line;
+
+/* Make a line like those produced by tooling: long argument lists */
+static char *
+make_long_line(int words)
+{
+    char *line = malloc(32 * words + 64), *p = line;
+    int i;
+
+    p += sprintf(p, "tool");
+    for (i = 1; i < words; i++)
+        p += sprintf(p, i % 25 ? " --option-%d=value%d" : " | filter%d", i, i);
+    sprintf(p, " >> out &");
+    return line;
+}
+
+static size_t
+parse(long n, char *line)
+{
+    long i;
+
+    for (i = 0; i < n; i++) {
+        struct esh_command_line *cline = esh_parse_command_line(line);
+        sink += cline != NULL;
+        esh_command_line_free(cline);
+    }
+    return n * strlen(line);
+}
+
+static size_t
+parse_short(long n)
+{
+    return parse(n, short_line);
+}
+
+static size_t
+parse_long(long n)
+{
+    if (long_line == NULL)
+        long_line = make_long_line(200);
+    return parse(n, long_line);
+}
+
+/* Lists */
+
+struct item {
+    struct list_elem elem;
+    int value;
+};
+
+static struct item items[LIST_SIZE];
+
+static bool
+item_less(const struct list_elem *a, const struct list_elem *b, void *aux)
+{
+    return list_entry(a, struct item, elem)->value
+           < list_entry(b, struct item, elem)->value;
+}
+
+/* Fill 'list' with all items, in random order of value */
+static void
+fill_list(struct list *list)
+{
+    int i;
+
+    list_init(list);
+    for (i = 0; i < LIST_SIZE; i++) {
+        items[i].value = rand();
+        list_push_back(list, &items[i].elem);
+    }
+}
+
+/* One operation is a push_back followed by a pop_front */
+static size_t
+list_push_pop(long n)
+{
+    struct list list;
+    long i;
+
+    fill_list(&list);
+    for (i = 0; i < n; i++)
+        list_push_back(&list, list_pop_front(&list));
+    return 0;
+}
+
+/* One operation is visiting one element */
+static size_t
+list_iterate(long n)
+{
+    struct list list;
+    struct list_elem *e;
+    long i;
+
+    fill_list(&list);
+    for (i = 0; i < n; i += LIST_SIZE)
+        for (e = list_begin(&list); e != list_end(&list); e = list_next(e))
+            sink += list_entry(e, struct item, elem)->value;
+    return 0;
+}
+
+/* One operation is sorting a list of LIST_SIZE elements */
+static size_t
+list_sorting(long n)
+{
+    struct list list;
+    long i;
+
+    for (i = 0; i < n; i++) {
+        fill_list(&list);
+        list_sort(&list, item_less, NULL);
+    }
+    return 0;
+}
+
+/* Job table */
+
+static bool jobs_filled;
+
+/* Make a command in the arena of 'line', as the parser would */
+static struct esh_command *
+make_command(struct esh_command_line *line, pid_t pid)
+{
+    char **argv = obstack_alloc(&line->arena, 2 * sizeof *argv);
+    argv[0] = obstack_copy0(&line->arena, "true", 4);
+    argv[1] = NULL;
+
+    struct esh_command *cmd = esh_command_create(&line->arena, argv,
+                                                 NULL, NULL, false);
+    cmd->pid = pid;
+    return cmd;
+}
+
+/* Make a background job of JOB_STAGES made-up processes */
+static struct esh_pipeline *
+make_job(pid_t pgrp)
+{
+    struct esh_command_line *line = esh_command_line_create_empty();
+    struct esh_pipeline *pipe = esh_pipeline_create(&line->arena,
+                                            make_command(line, pgrp));
+    int stage;
+
+    for (stage = 1; stage < JOB_STAGES; stage++) {
+        struct esh_command *cmd = make_command(line, pgrp + stage);
+        cmd->pipeline = pipe;
+        list_push_back(&pipe->commands, &cmd->elem);
+    }
+    esh_pipeline_finish(pipe);
+
+    struct esh_pipeline *job = esh_pipeline_copy(pipe);
+    esh_command_line_free(line);
+    job->pgrp = pgrp;
+    job->status = BACKGROUND;
+    return job;
+}
+
+/* Fill the job table with JOBS jobs, once */
+static void
+fill_jobs(void)
+{
+    int i;
+
+    if (jobs_filled)
+        return;
+
+    esh_jobs_init();
+    for (i = 0; i < JOBS; i++)
+        esh_job_add(make_job(FIRST_PID + i * JOB_STAGES));
+    jobs_filled = true;
+}
+
+static size_t
+jobs_by_jid(long n)
+{
+    long i;
+
+    fill_jobs();
+    for (i = 0; i < n; i++)
+        sink += esh_get_job_from_jid(1 + i % JOBS) != NULL;
+    return 0;
+}
+
+static size_t
+jobs_by_pgrp(long n)
+{
+    long i;
+
+    fill_jobs();
+    for (i = 0; i < n; i++)
+        sink += esh_get_job_from_pgrp(FIRST_PID + i % JOBS * JOB_STAGES)
+                != NULL;
+    return 0;
+}
+
+static size_t
+jobs_by_pid(long n)
+{
+    long i;
+
+    fill_jobs();
+    for (i = 0; i < n; i++)
+        sink += esh_get_cmd_from_pid(FIRST_PID + i % (JOBS * JOB_STAGES))
+                != NULL;
+    return 0;
+}
+
+/* One operation is adding a job to the full table and removing it */
+static size_t
+jobs_add_remove(long n)
+{
+    struct esh_pipeline *job = make_job(FIRST_PID + JOBS * JOB_STAGES);
+    long i;
+
+    fill_jobs();
+    for (i = 0; i < n; i++) {
+        esh_job_add(job);
+        esh_job_remove(job);
+    }
+    esh_pipeline_free(job);
+    return 0;
+}
+
+/* One operation is publishing the full job table, of which the first
+ * ESH_SNAPSHOT_JOBS jobs are listed */
+static size_t
+snapshot_update(long n)
+{
+    long i;
+
+    fill_jobs();
+    if (!esh_snapshot_start())
+        return 0;
+    for (i = 0; i < n; i++)
+        esh_snapshot_update();
+    esh_snapshot_stop();
+    return 0;
+}
+
+/* One operation is a consistent copy of that snapshot by a reader */
+static size_t
+snapshot_read(long n)
+{
+    static struct esh_snapshot copy;
+    long i;
+
+    fill_jobs();
+    if (!esh_snapshot_start())
+        return 0;
+    const struct esh_snapshot *shared = esh_snapshot_map(getpid());
+    for (i = 0; shared != NULL && i < n; i++)
+        sink += esh_snapshot_read(shared, &copy);
+    if (shared != NULL)
+        esh_snapshot_unmap(shared);
+    esh_snapshot_stop();
+    return 0;
+}
+
+/* Spawning and pipes */
+
+/* Build a pipeline: 'first' followed by stages - 1 copies of 'rest',
+ * with input from 'in' and output to 'out' */
+static struct esh_pipeline *
+make_pipeline(char **first, char **rest, int stages, char *in, char *out)
+{
+    struct obstack *arena = &esh_command_line_create_empty()->arena;
+    struct esh_pipeline *pipe = esh_pipeline_create(arena,
+                esh_command_create(arena, first, in,
+                                   stages == 1 ? out : NULL, false));
+
+    while (--stages > 0) {
+        struct esh_command *cmd = esh_command_create(arena, rest,
+                                    NULL, stages == 1 ? out : NULL, false);
+        cmd->pipeline = pipe;
+        list_push_back(&pipe->commands, &cmd->elem);
+    }
+    return pipe;
+}
+
+/* Launch 'pipe' and wait for all its processes */
+static void
+run_pipeline(struct esh_pipeline *pipe)
+{
+    if (esh_spawn_pipeline(pipe, -1) == 0) {
+        fprintf(stderr, "microbench: cannot launch pipeline\n");
+        exit(EXIT_FAILURE);
+    }
+    while (waitpid(-pipe->pgrp, NULL, 0) > 0)
+        continue;
+}
+
+/* One operation is launching and reaping a pipeline of /bin/true */
+static size_t
+spawn(long n, int stages)
+{
+    static char *argv[] = { "/bin/true", NULL };
+    struct esh_pipeline *pipe = make_pipeline(argv, argv, stages, NULL, NULL);
+    long i;
+
+    for (i = 0; i < n; i++)
+        run_pipeline(pipe);
+    return 0;
+}
+
+static size_t
+spawn_1(long n)
+{
+    return spawn(n, 1);
+}
+
+static size_t
+spawn_2(long n)
+{
+    return spawn(n, 2);
+}
+
+static size_t
+spawn_8(long n)
+{
+    return spawn(n, 8);
+}
+
+/* One operation is sending PIPE_BYTES from /dev/zero through 'head'
+ * and stages - 1 'cat' processes to /dev/null */
+static size_t
+pipe_throughput(long n, int stages)
+{
+    static char count[32];
+    static char *head[] = { "head", "-c", count, NULL };
+    static char *cat[] = { "cat", NULL };
+    snprintf(count, sizeof count, "%d", PIPE_BYTES);
+
+    struct esh_pipeline *pipe = make_pipeline(head, cat, stages,
+                                              "/dev/zero", "/dev/null");
+    long i;
+
+    for (i = 0; i < n; i++)
+        run_pipeline(pipe);
+    return (size_t) n * PIPE_BYTES;
+}
+
+static size_t
+pipe_2(long n)
+{
+    return pipe_throughput(n, 2);
+}
+
+static size_t
+pipe_4(long n)
+{
+    return pipe_throughput(n, 4);
+}
+
+static size_t
+pipe_8(long n)
+{
+    return pipe_throughput(n, 8);
+}
+
+/* Harness */
+
+struct benchmark {
+    const char *name;
+    const char *unit;           /* what one operation is */
+    size_t (*run)(long n);      /* run n operations, return bytes moved */
+};
+
+static struct benchmark benchmarks[] = {
+    { "parse/short", "line", parse_short },
+    { "parse/long", "line", parse_long },
+    { "list/push-pop", "push_back+pop_front", list_push_pop },
+    { "list/iterate", "element", list_iterate },
+    { "list/sort-1024", "sort", list_sorting },
+    { "jobs/lookup-jid", "lookup", jobs_by_jid },
+    { "jobs/lookup-pgrp", "lookup", jobs_by_pgrp },
+    { "jobs/lookup-pid", "lookup", jobs_by_pid },
+    { "jobs/add-remove", "add+remove", jobs_add_remove },
+    { "snapshot/update", "update", snapshot_update },
+    { "snapshot/read", "read", snapshot_read },
+    { "spawn/1-stage", "pipeline", spawn_1 },
+    { "spawn/2-stage", "pipeline", spawn_2 },
+    { "spawn/8-stage", "pipeline", spawn_8 },
+    { "pipe/2-stage", "pipeline", pipe_2 },
+    { "pipe/4-stage", "pipeline", pipe_4 },
+    { "pipe/8-stage", "pipeline", pipe_8 },
+};
+#define NBENCHMARKS (sizeof benchmarks / sizeof benchmarks[0])
+
+static int
+compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Find how many operations take about 'target' seconds */
+static long
+calibrate(struct benchmark *b, double target)
+{
+    long n = 1;
+
+    for (;;) {
+        double start = now();
+        b->run(n);
+        double elapsed = now() - start;
+
+        if (elapsed >= target / 4 || n >= (1L << 40)) {
+            double scaled = n * target / (elapsed > 0 ? elapsed : 1e-9);
+            return scaled < 1 ? 1 : (long) scaled;
+        }
+        n *= 8;
+    }
+}
+
+/* Run benchmark 'b' and print its result as a JSON object */
+static void
+measure(struct benchmark *b, double target, int runs)
+{
+    double ns[runs];
+    size_t bytes = 0;
+    long n = calibrate(b, target);
+    int r;
+
+    for (r = 0; r < runs; r++) {
+        double start = now();
+        bytes = b->run(n);
+        ns[r] = (now() - start) * 1e9 / n;
+    }
+    qsort(ns, runs, sizeof *ns, compare_doubles);
+    double median = runs % 2 ? ns[runs / 2]
+                             : (ns[runs / 2 - 1] + ns[runs / 2]) / 2;
+
+    printf("    { \"name\": \"%s\", \"unit\": \"%s\", \"runs\": %d, "
+           "\"ops\": %ld,\n"
+           "      \"ns_per_op\": %.3f, \"min_ns_per_op\": %.3f, "
+           "\"ops_per_sec\": %.1f", b->name, b->unit, runs, n,
+           median, ns[0], 1e9 / median);
+    if (bytes > 0)
+        printf(", \"bytes_per_sec\": %.0f", (double) bytes / n * 1e9 / median);
+    printf(" }");
+}
+
+int
+main(int ac, char *av[])
+{
+    int opt, runs = 5;
+    double target = 0.2;
+    char *filter = "";
+    unsigned i;
+
+    while ((opt = getopt(ac, av, "ht:r:f:l")) > 0) {
+        switch (opt) {
+        case 't':
+            target = atof(optarg);
+            break;
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        case 'l':
+            for (i = 0; i < NBENCHMARKS; i++)
+                printf("%s\n", benchmarks[i].name);
+            return 0;
+        default:
+            usage(av[0]);
+        }
+    }
+    if (runs < 1 || target <= 0)
+        usage(av[0]);
+
+    /* As in the shell: children are reaped explicitly */
+    esh_signal_block(SIGCHLD);
+    srand(42);
+
+    char host[256] = "";
+    gethostname(host, sizeof host - 1);
+    char stamp[32];
+    time_t t = time(NULL);
+    strftime(stamp, sizeof stamp, "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+
+    printf("{\n  \"version\": 1, \"time\": \"%s\", \"host\": \"%s\", "
+           "\"cpus\": %ld,\n  \"results\": [\n", stamp, host,
+           sysconf(_SC_NPROCESSORS_ONLN));
+
+    bool first = true;
+    for (i = 0; i < NBENCHMARKS; i++) {
+        if (!strstr(benchmarks[i].name, filter))
+            continue;
+        if (!first)
+            printf(",\n");
+        first = false;
+        measure(&benchmarks[i], target, runs);
+        fflush(stdout);
+    }
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * parse-bench - measure parser throughput with each lexer.
+ *
+ * Generates command lines like those produced by tooling (a few
+ * pipelines with long argument lists), parses them repeatedly with
+ * each available lexer, and reports lines/sec and MB/sec.  The last
+ * row shows lines served from the parse cache.  Before timing, every
+ * line is parsed with each lexer and from the cache, and the results
+ * are compared against the flex lexer.
+ *
+ * Exits with a non-zero status if the lexers disagree.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "esh.h"
+
+static const char *lexers[] = { "flex", "scalar", "sse2", "avx2" };
+#define NLEXERS (sizeof lexers / sizeof lexers[0])
+
+static void
+usage(char *progname)
+{
+    printf("Usage: %s [-n lines] [-w words] [-r repetitions]\n", progname);
+    exit(EXIT_SUCCESS);
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Generate a command line of about 'words' words */
+static char *
+make_line(int words)
+{
+    static const char *fill = "abcdefghijklmnopqrstuvwxyz0123456789_-=./,";
+    size_t size = 64 * (words + 4), len = 0;
+    char *line = malloc(size);
+    int i, j;
+
+    len += sprintf(line, "tool%d", rand() % 100);
+    for (i = 1; i < words; i++) {
+        switch (rand() % 16) {
+        case 0:
+            len += sprintf(line + len, " | filter%d", i);
+            break;
+        case 1:
+            len += sprintf(line + len, "\t; next%d", i);
+            break;
+        default:
+            line[len++] = ' ';
+            for (j = 2 + rand() % 40; j > 0; j--)
+                line[len++] = fill[rand() % strlen(fill)];
+            break;
+        }
+    }
+    len += sprintf(line + len, " >>out%d &", words);
+    line[len] = '\0';
+    return line;
+}
+
+/* Compare two parsed command lines; returns true if equal */
+static bool
+same_command_line(struct esh_command_line *a, struct esh_command_line *b)
+{
+    struct list_elem *pa = list_begin(&a->pipes), *pb = list_begin(&b->pipes);
+
+    for (; pa != list_end(&a->pipes) && pb != list_end(&b->pipes);
+         pa = list_next(pa), pb = list_next(pb)) {
+        struct esh_pipeline *x = list_entry(pa, struct esh_pipeline, elem);
+        struct esh_pipeline *y = list_entry(pb, struct esh_pipeline, elem);
+        if (x->bg_job != y->bg_job || x->append_to_output != y->append_to_output
+            || list_size(&x->commands) != list_size(&y->commands))
+            return false;
+
+        struct list_elem *ca = list_begin(&x->commands);
+        struct list_elem *cb = list_begin(&y->commands);
+        for (; ca != list_end(&x->commands); ca = list_next(ca), cb = list_next(cb)) {
+            char **u = list_entry(ca, struct esh_command, elem)->argv;
+            char **v = list_entry(cb, struct esh_command, elem)->argv;
+            for (; *u && *v; u++, v++)
+                if (strcmp(*u, *v))
+                    return false;
+            if (*u || *v)
+                return false;
+        }
+
+        if ((x->iored_output == NULL) != (y->iored_output == NULL)
+            || (x->iored_output && strcmp(x->iored_output, y->iored_output)))
+            return false;
+    }
+    return pa == list_end(&a->pipes) && pb == list_end(&b->pipes);
+}
+
+int
+main(int ac, char *av[])
+{
+    int opt, n = 2000, words = 200, reps = 10, i, r;
+    unsigned l;
+
+    while ((opt = getopt(ac, av, "hn:w:r:")) > 0) {
+        switch (opt) {
+        case 'n':
+            n = atoi(optarg);
+            break;
+        case 'w':
+            words = atoi(optarg);
+            break;
+        case 'r':
+            reps = atoi(optarg);
+            break;
+        default:
+            usage(av[0]);
+        }
+    }
+
+    srand(42);
+    char **lines = malloc(n * sizeof *lines);
+    size_t bytes = 0;
+    for (i = 0; i < n; i++) {
+        lines[i] = make_line(words);
+        bytes += strlen(lines[i]);
+    }
+
+    for (i = 0; i < n; i++) {
+        esh_lex_set_mode("flex");
+        struct esh_command_line *expected = esh_parse_command_line(lines[i]);
+        for (l = 1; l < NLEXERS; l++) {
+            if (!esh_lex_set_mode(lexers[l]))
+                continue;
+            struct esh_command_line *cline = esh_parse_command_line(lines[i]);
+            if (expected == NULL || cline == NULL
+                || !same_command_line(expected, cline)) {
+                fprintf(stderr, "parse-bench: %s and flex disagree on line %d\n",
+                        lexers[l], i);
+                return EXIT_FAILURE;
+            }
+            esh_command_line_free(cline);
+        }
+
+        /* a miss, then a hit */
+        esh_lex_set_mode("auto");
+        for (r = 0; r < 2; r++) {
+            struct esh_command_line *cline;
+            cline = esh_parse_cached(lines[i], esh_parse_command_line);
+            if (!same_command_line(expected, cline)) {
+                fprintf(stderr, "parse-bench: cache and flex disagree on "
+                        "line %d\n", i);
+                return EXIT_FAILURE;
+            }
+            esh_command_line_free(cline);
+        }
+        esh_command_line_free(expected);
+    }
+
+    printf("%d lines of %d words, %.1f KB/line\n", n, words,
+           bytes / 1024.0 / n);
+    for (l = 0; l < NLEXERS; l++) {
+        if (!esh_lex_set_mode(lexers[l])) {
+            printf("  %-7s not supported\n", lexers[l]);
+            continue;
+        }
+
+        double start = now();
+        for (r = 0; r < reps; r++)
+            for (i = 0; i < n; i++)
+                esh_command_line_free(esh_parse_command_line(lines[i]));
+        double elapsed = now() - start;
+
+        printf("  %-7s %10.0f lines/s %8.1f MB/s\n", lexers[l],
+               n * reps / elapsed, bytes * reps / elapsed / 1e6);
+    }
+
+    esh_lex_set_mode("auto");
+    esh_parse_cache_set_limit(n);
+    double start = now();
+    for (r = 0; r < reps; r++)
+        for (i = 0; i < n; i++)
+            esh_command_line_free(esh_parse_cached(lines[i],
+                                                   esh_parse_command_line));
+    double elapsed = now() - start;
+    printf("  %-7s %10.0f lines/s %8.1f MB/s\n", "cached",
+           n * reps / elapsed, bytes * reps / elapsed / 1e6);
+
+    for (i = 0; i < n; i++)
+        free(lines[i]);
+    free(lines);
+    return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * parse-threads - measure how parsing scales across threads.
+ *
+ * Each thread parses the same set of generated command lines with its
+ * own esh_parser.  The run is repeated for 1, 2, 4, ... threads up to
+ * the number of online CPUs (or -t), reporting aggregate lines/sec and
+ * the speedup and efficiency relative to one thread.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "esh.h"
+
+static char **lines;
+static int nlines, reps;
+
+static void
+usage(char *progname)
+{
+    printf("Usage: %s [-n lines] [-r repetitions] [-t max-threads] "
+           "[-l lexer]\n", progname);
+    exit(EXIT_SUCCESS);
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Generate a command line with a couple of pipelines and redirections */
+static char *
+make_line(int i)
+{
+    char *line = malloc(256);
+    snprintf(line, 256, "grep -e pattern%d --color=never file%d.log | "
+             "sort -k %d -n | uniq -c > out%d.txt ; echo done %d &",
+             i, i, i % 7, i, i);
+    return line;
+}
+
+static void *
+parse_lines(void *arg)
+{
+    struct esh_parser *parser = esh_parser_create();
+    long parsed = 0;
+    int r, i;
+
+    for (r = 0; r < reps; r++) {
+        for (i = 0; i < nlines; i++) {
+            struct esh_command_line *cline;
+            cline = esh_parse_command_line_r(parser, lines[i]);
+            if (cline == NULL) {
+                fprintf(stderr, "parse-threads: cannot parse '%s'\n", lines[i]);
+                exit(EXIT_FAILURE);
+            }
+            parsed += list_size(&cline->pipes);
+            esh_command_line_free(cline);
+        }
+    }
+
+    esh_parser_destroy(parser);
+    return (void *) parsed;
+}
+
+/* Parse all lines in 'nthreads' threads; return aggregate lines/sec */
+static double
+run(int nthreads)
+{
+    pthread_t threads[nthreads];
+    int t;
+
+    double start = now();
+    for (t = 0; t < nthreads; t++)
+        pthread_create(&threads[t], NULL, parse_lines, NULL);
+
+    for (t = 0; t < nthreads; t++) {
+        void *parsed;
+        pthread_join(threads[t], &parsed);
+        if ((long) parsed != 2L * nlines * reps) {
+            fprintf(stderr, "parse-threads: wrong number of pipelines\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return (double) nlines * reps * nthreads / (now() - start);
+}
+
+int
+main(int ac, char *av[])
+{
+    int opt, maxthreads = sysconf(_SC_NPROCESSORS_ONLN), i, t;
+
+    nlines = 10000;
+    reps = 20;
+    while ((opt = getopt(ac, av, "hn:r:t:l:")) > 0) {
+        switch (opt) {
+        case 'n':
+            nlines = atoi(optarg);
+            break;
+        case 'r':
+            reps = atoi(optarg);
+            break;
+        case 't':
+            maxthreads = atoi(optarg);
+            break;
+        case 'l':
+            if (!esh_lex_set_mode(optarg))
+                usage(av[0]);
+            break;
+        default:
+            usage(av[0]);
+        }
+    }
+
+    lines = malloc(nlines * sizeof *lines);
+    for (i = 0; i < nlines; i++)
+        lines[i] = make_line(i);
+
+    printf("%d lines x %d repetitions per thread, %d CPUs online\n",
+           nlines, reps, (int) sysconf(_SC_NPROCESSORS_ONLN));
+    printf("threads      lines/s  speedup  efficiency\n");
+
+    double single = 0;
+    for (t = 1; t <= maxthreads; t = t < maxthreads && t * 2 > maxthreads
+                                      ? maxthreads : t * 2) {
+        double rate = run(t);
+        if (t == 1)
+            single = rate;
+        printf("%7d %12.0f %8.2f %10.0f%%\n", t, rate, rate / single,
+               100 * rate / single / t);
+        if (t == maxthreads)
+            break;
+    }
+
+    for (i = 0; i < nlines; i++)
+        free(lines[i]);
+    free(lines);
+    return 0;
+}
@@ -0,0 +1,90 @@
+#!/bin/sh
+#
+# plugin-bench - measure the per-command cost of loaded plugins.
+#
+# Usage: bench/plugin-bench.sh [-n lines] [-p plugins] [command]
+#
+# Builds 'plugins' (50 by default) trivial plugins twice: once as
+# version 1 plugins, which are notified of every event they have a
+# hook for, and once declaring ABI version 2 without subscribing to
+# any event.  A script of 'lines' copies of 'command' ('jobs' by
+# default, a builtin, so that no process creation hides the cost) is
+# then run without plugins and with each set, and the time per command
+# is reported.  Run from the top-level directory after 'make'.
+
+n=100000
+nplugins=50
+while getopts n:p: opt; do
+    case $opt in
+    n) n=$OPTARG ;;
+    p) nplugins=$OPTARG ;;
+    *) echo "Usage: $0 [-n lines] [-p plugins] [command]"; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+cmd=${1:-jobs}
+
+esh=${ESH:-./esh}
+CC=${CC:-cc}
+tmp=$(mktemp -d /tmp/plugin-bench.XXXXXX)
+trap 'rm -rf "$tmp"' EXIT
+
+cat > "$tmp/plugin.c" <<'EOF'
+#include "esh.h"
+
+#ifdef SUBSCRIBE_NONE
+ESH_PLUGIN_ABI;
+#endif
+
+static bool raw_cmdline(char **line) { return false; }
+static bool pipeline(struct esh_pipeline *pipe) { return false; }
+static bool builtin(struct esh_command *cmd) { return false; }
+static void forked(struct esh_pipeline *pipe) { }
+static bool status_change(struct esh_command *cmd, int status) { return false; }
+
+struct esh_plugin esh_module = {
+    .rank = RANK,
+    .process_raw_cmdline = raw_cmdline,
+    .process_pipeline = pipeline,
+    .process_builtin = builtin,
+    .pipeline_forked = forked,
+    .command_status_change = status_change,
+#ifdef SUBSCRIBE_NONE
+    .events = 0,
+#endif
+};
+EOF
+
+mkdir "$tmp/none" "$tmp/v1" "$tmp/v2"
+i=0
+while [ $i -lt "$nplugins" ]; do
+    $CC -shared -fPIC -I. -DRANK=$i -o "$tmp/v1/p$i.so" "$tmp/plugin.c" || exit 1
+    $CC -shared -fPIC -I. -DRANK=$i -DSUBSCRIBE_NONE \
+        -o "$tmp/v2/p$i.so" "$tmp/plugin.c" || exit 1
+    i=$((i + 1))
+done
+
+awk -v n="$n" -v cmd="$cmd" 'BEGIN { for (i = 0; i < n; i++) print cmd }' \
+    > "$tmp/script"
+
+now() {
+    date +%s.%N
+}
+
+# run description plugindir: print the time per command, and the
+# difference to the first run
+base=
+run() {
+    t0=$(now)
+    "$esh" -p "$2" "$tmp/script" > /dev/null 2>&1
+    t1=$(now)
+    us=$(awk -v t0="$t0" -v t1="$t1" -v n="$n" 'BEGIN { print (t1 - t0) * 1e6 / n }')
+    base=${base:-$us}
+    awk -v what="$1" -v us="$us" -v base="$base" 'BEGIN {
+        printf "%-28s %8.3f us/command %+8.3f us\n", what, us, us - base
+    }'
+}
+
+run "no plugins" "$tmp/none"
+run "$nplugins v1 plugins" "$tmp/v1"
+run "$nplugins unsubscribed plugins" "$tmp/v2"
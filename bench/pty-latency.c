@@ -0,0 +1,385 @@
+/*
+ * pty-latency - measure end-to-end latency of esh on a terminal.
+ *
+ * Starts esh on a pseudo terminal, as its controlling terminal, and
+ * plays the part of a user typing at it.  Each iteration measures:
+ *
+ *   enter      newline typed at the prompt until the next prompt
+ *   command    '/bin/true' typed until the next prompt
+ *   launch     'sleep' typed until the job owns the terminal
+ *   stop       ^Z typed until the prompt is back
+ *   fg         'fg' typed until the job owns the terminal again
+ *   bg         'bg' typed until the prompt is back
+ *   interrupt  ^C typed until the prompt is back
+ *   notify     a background job killed until 'Done' is printed
+ *
+ * The terminal changing hands (give_terminal_to) is observed with
+ * tcgetpgrp() on the master side, everything else by reading esh's
+ * output.  Reports the median, 99th percentile and maximum of each in
+ * microseconds.  esh runs in an empty directory, without a plugin
+ * manifest, so the prompt is "esh> " unless plugins are given with
+ * -p; -P sets the prompt to wait for.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <pty.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#define TIMEOUT 5.0             /* seconds to wait for any one step */
+
+enum metric { ENTER, COMMAND, LAUNCH, STOP, FG, BG, INTERRUPT, NOTIFY,
+              NMETRICS };
+
+static const char *metric_names[NMETRICS] = {
+    "enter", "command", "launch", "stop", "fg", "bg", "interrupt", "notify"
+};
+
+static double *samples[NMETRICS];
+static int nsamples[NMETRICS];
+
+static int master = -1;
+static pid_t shell_pid;
+static const char *prompt = "esh> ";
+static const char *step;        /* what is being waited for */
+
+/* Output of the shell not matched yet */
+static char buf[1 << 16];
+static size_t buflen;
+
+static void
+usage(char *progname)
+{
+    printf("Usage: %s [-n iterations] [-e esh] [-p plugindir] [-P prompt]\n",
+           progname);
+    exit(EXIT_SUCCESS);
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+fail(const char *what)
+{
+    fprintf(stderr, "pty-latency: %s while waiting for %s\n", what, step);
+    if (buflen > 0)
+        fprintf(stderr, "pty-latency: last output: %.*s\n", (int) buflen, buf);
+    kill(shell_pid, SIGKILL);
+    exit(EXIT_FAILURE);
+}
+
+static void
+type(const char *keys)
+{
+    if (write(master, keys, strlen(keys)) != (ssize_t) strlen(keys))
+        fail("write error");
+}
+
+/* Read what the shell printed, waiting until 'deadline' at most.
+ * Returns false on timeout. */
+static bool
+read_output(double deadline)
+{
+    double left = deadline - now();
+    struct pollfd pfd = { .fd = master, .events = POLLIN };
+
+    if (left <= 0 || poll(&pfd, 1, left * 1000 + 1) <= 0)
+        return false;
+
+    if (buflen == sizeof buf) {     /* keep the newer half */
+        memmove(buf, buf + sizeof buf / 2, sizeof buf / 2);
+        buflen = sizeof buf / 2;
+    }
+    ssize_t n = read(master, buf + buflen, sizeof buf - buflen);
+    if (n <= 0)
+        fail(n == 0 || errno == EIO ? "shell exited" : "read error");
+    buflen += n;
+    return true;
+}
+
+/* Wait until the shell prints 's'; output up to it is consumed */
+static void
+expect(const char *s)
+{
+    double deadline = now() + TIMEOUT;
+
+    step = s;
+    for (;;) {
+        char *match = memmem(buf, buflen, s, strlen(s));
+        if (match) {
+            size_t end = match - buf + strlen(s);
+            memmove(buf, buf + end, buflen - end);
+            buflen -= end;
+            return;
+        }
+        if (!read_output(deadline))
+            fail("timeout");
+    }
+}
+
+/* Wait until the foreground process group of the terminal is, or is
+ * not, 'pgrp'.  Returns the new foreground process group. */
+static pid_t
+expect_foreground(pid_t pgrp, bool is)
+{
+    double deadline = now() + TIMEOUT;
+
+    step = "the terminal to change hands";
+    for (;;) {
+        pid_t fg = tcgetpgrp(master);
+        if ((fg == pgrp) == is)
+            return fg;
+        if (now() > deadline)
+            fail("timeout");
+        sched_yield();
+    }
+}
+
+/* Wait until process 'pid' is no longer stopped.  The shell hands the
+ * terminal to a job before continuing it, and a ^Z typed in between
+ * would be discarded by the SIGCONT. */
+static void
+expect_running(pid_t pid)
+{
+    double deadline = now() + TIMEOUT;
+    char path[64], stat[256];
+
+    step = "the job to continue";
+    snprintf(path, sizeof path, "/proc/%d/stat", (int) pid);
+    for (;;) {
+        FILE *f = fopen(path, "r");
+        if (f == NULL)
+            fail("no such process");
+        char *state = fgets(stat, sizeof stat, f) ? strrchr(stat, ')') : NULL;
+        fclose(f);
+        if (state && state[1] == ' ' && state[2] != 'T')
+            return;
+        if (now() > deadline)
+            fail("timeout");
+        sched_yield();
+    }
+}
+
+/* Wait for the '[jid] pgrp' line printed for a background job and
+ * return the pgrp */
+static pid_t
+expect_job(void)
+{
+    double deadline = now() + TIMEOUT;
+    char *eol;
+
+    expect("] ");
+    while ((eol = memchr(buf, '\n', buflen)) == NULL)
+        if (!read_output(deadline))
+            fail("timeout");
+
+    pid_t pgrp = atoi(buf);
+    buflen -= eol + 1 - buf;
+    memmove(buf, eol + 1, buflen);
+    return pgrp;
+}
+
+static void
+record(enum metric m, double start)
+{
+    samples[m][nsamples[m]++] = (now() - start) * 1e6;
+}
+
+/* Start esh on a new pty, in directory 'dir' */
+static void
+start_shell(const char *esh, const char *plugindir, const char *dir)
+{
+    struct winsize ws = { .ws_row = 24, .ws_col = 80 };
+    int slave;
+
+    if (openpty(&master, &slave, NULL, NULL, &ws) == -1) {
+        perror("openpty");
+        exit(EXIT_FAILURE);
+    }
+
+    shell_pid = fork();
+    if (shell_pid == -1) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (shell_pid == 0) {
+        setsid();
+        ioctl(slave, TIOCSCTTY, 0);
+        dup2(slave, 0);
+        dup2(slave, 1);
+        dup2(slave, 2);
+        close(slave);
+        close(master);
+        if (chdir(dir) == -1)
+            _exit(127);
+        setenv("TERM", "dumb", 1);
+        setenv("INPUTRC", "/dev/null", 1);
+        setenv("ESH_PLUGIN_MANIFEST", "", 1);
+        if (plugindir)
+            execl(esh, esh, "-p", plugindir, (char *) NULL);
+        else
+            execl(esh, esh, (char *) NULL);
+        _exit(127);
+    }
+    close(slave);
+}
+
+/* One round of every measurement */
+static void
+iterate(void)
+{
+    double t;
+
+    t = now();
+    type("\n");
+    expect(prompt);
+    record(ENTER, t);
+
+    t = now();
+    type("/bin/true\n");
+    expect(prompt);
+    record(COMMAND, t);
+
+    t = now();
+    type("sleep 100000\n");
+    pid_t job = expect_foreground(shell_pid, false);
+    record(LAUNCH, t);
+
+    t = now();
+    type("\032");
+    expect(prompt);
+    record(STOP, t);
+
+    t = now();
+    type("fg\n");
+    expect_foreground(job, true);
+    record(FG, t);
+    expect_running(job);
+
+    type("\032");
+    expect(prompt);
+
+    t = now();
+    type("bg\n");
+    expect(prompt);
+    record(BG, t);
+
+    type("fg\n");
+    expect_foreground(job, true);
+    expect_running(job);
+
+    t = now();
+    type("\003");
+    expect(prompt);
+    record(INTERRUPT, t);
+
+    type("sleep 100000 &\n");
+    pid_t background = expect_job();
+    expect(prompt);
+
+    t = now();
+    if (kill(background, SIGTERM) == -1)
+        fail("kill error");
+    expect("Done");
+    record(NOTIFY, t);
+    expect(prompt);
+}
+
+static int
+compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Return the given percentile of sorted samples, by nearest rank */
+static double
+percentile(double *v, int n, int p)
+{
+    int rank = (p * n + 99) / 100;
+    return v[rank > 0 ? rank - 1 : 0];
+}
+
+int
+main(int ac, char *av[])
+{
+    int opt, n = 1000, i;
+    const char *esh = "./esh", *plugindir = NULL;
+    char eshpath[PATH_MAX], pluginpath[PATH_MAX];
+
+    while ((opt = getopt(ac, av, "hn:e:p:P:")) > 0) {
+        switch (opt) {
+        case 'n':
+            n = atoi(optarg);
+            break;
+        case 'e':
+            esh = optarg;
+            break;
+        case 'p':
+            plugindir = optarg;
+            break;
+        case 'P':
+            prompt = optarg;
+            break;
+        default:
+            usage(av[0]);
+        }
+    }
+    if (n < 1)
+        usage(av[0]);
+
+    /* esh runs elsewhere, so that it loads no plugins by default */
+    if (realpath(esh, eshpath) == NULL) {
+        perror(esh);
+        exit(EXIT_FAILURE);
+    }
+    if (plugindir && realpath(plugindir, pluginpath) == NULL) {
+        perror(plugindir);
+        exit(EXIT_FAILURE);
+    }
+    char dir[] = "/tmp/pty-latency.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < NMETRICS; i++)
+        samples[i] = malloc(n * sizeof *samples[i]);
+
+    start_shell(eshpath, plugindir ? pluginpath : NULL, dir);
+    expect(prompt);
+    expect_foreground(shell_pid, true);
+
+    for (i = 0; i < n; i++)
+        iterate();
+
+    type("exit\n");
+    waitpid(shell_pid, NULL, 0);
+    rmdir(dir);
+
+    printf("%d iterations, microseconds\n", n);
+    printf("  %-10s %10s %10s %10s\n", "", "p50", "p99", "max");
+    for (i = 0; i < NMETRICS; i++) {
+        qsort(samples[i], nsamples[i], sizeof *samples[i], compare_doubles);
+        printf("  %-10s %10.1f %10.1f %10.1f\n", metric_names[i],
+               percentile(samples[i], nsamples[i], 50),
+               percentile(samples[i], nsamples[i], 99),
+               samples[i][nsamples[i] - 1]);
+    }
+    return 0;
+}
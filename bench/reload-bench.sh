@@ -0,0 +1,77 @@
+#!/bin/sh
+#
+# reload-bench - measure how long 'plugin reload' takes.
+#
+# Usage: bench/reload-bench.sh [-n reloads]
+#
+# Builds a plugin that registers a builtin and subscribes to an event,
+# then runs a script that reloads it 'reloads' times (1000 by default)
+# and runs its builtin after each reload, and a script that only runs
+# the builtin, and reports the difference per reload.  Run from the
+# top-level directory after 'make'.
+
+n=1000
+while getopts n: opt; do
+    case $opt in
+    n) n=$OPTARG ;;
+    *) echo "Usage: $0 [-n reloads]"; exit 1 ;;
+    esac
+done
+
+esh=${ESH:-./esh}
+CC=${CC:-cc}
+tmp=$(mktemp -d /tmp/reload-bench.XXXXXX)
+trap 'rm -rf "$tmp"' EXIT
+
+cat > "$tmp/plugin.c" <<'EOF'
+#include "esh.h"
+
+ESH_PLUGIN_ABI;
+
+static int builtin(struct esh_command *cmd) { return 0; }
+static void forked(struct esh_pipeline *pipe) { }
+static void fini(void) { }
+
+static bool init(struct esh_shell *shell)
+{
+    return shell->register_builtin("reloaded", builtin);
+}
+
+struct esh_plugin esh_module = {
+    .init = init,
+    .pipeline_forked = forked,
+    .events = ESH_PLUGIN_SUBSCRIBE(ESH_PLUGIN_FORKED),
+    .fini = fini,
+};
+EOF
+
+mkdir "$tmp/plugins"
+$CC -shared -fPIC -I. -o "$tmp/plugins/reloaded.so" "$tmp/plugin.c" || exit 1
+
+awk -v n="$n" 'BEGIN { for (i = 0; i < n; i++) print "reloaded" }' \
+    > "$tmp/base"
+awk -v n="$n" 'BEGIN {
+    for (i = 0; i < n; i++) {
+        print "plugin reload reloaded"
+        print "reloaded"
+    }
+}' > "$tmp/reload"
+
+now() {
+    date +%s.%N
+}
+
+# time script: print the time it takes to run script in seconds
+time_script() {
+    t0=$(now)
+    ESH_PLUGIN_MANIFEST= "$esh" -p "$tmp/plugins" "$1" > /dev/null 2>&1
+    t1=$(now)
+    awk -v t0="$t0" -v t1="$t1" 'BEGIN { print t1 - t0 }'
+}
+
+base=$(time_script "$tmp/base")
+reload=$(time_script "$tmp/reload")
+awk -v n="$n" -v base="$base" -v reload="$reload" 'BEGIN {
+    printf "%d reloads %8.2f s %10.1f us/reload\n", n, reload - base,
+           (reload - base) * 1e6 / n
+}'
@@ -0,0 +1,105 @@
+/*
+ * spawn-bench - measure pipeline launch rate of the spawn engines.
+ *
+ * Launches a pipeline of 'true' commands repeatedly with each engine
+ * and reports spawns (processes started) per second.  Use -m to grow
+ * the heap first; fork() pays for it on every launch, posix_spawn()
+ * does not.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "esh-sys-utils.h"
+#include "esh.h"
+
+static void
+usage(char *progname)
+{
+    printf("Usage: %s [-n iterations] [-s stages] [-m megabytes]\n",
+           progname);
+    exit(EXIT_SUCCESS);
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Build a pipeline of 'stages' commands running /bin/true */
+static struct esh_pipeline *
+make_pipeline(int stages)
+{
+    static char *argv[] = { "/bin/true", NULL };
+    struct obstack *arena = &esh_command_line_create_empty()->arena;
+    struct esh_pipeline *pipe = esh_pipeline_create(arena,
+                esh_command_create(arena, argv, NULL, NULL, false));
+
+    while (--stages > 0) {
+        struct esh_command *cmd = esh_command_create(arena, argv,
+                                                     NULL, NULL, false);
+        cmd->pipeline = pipe;
+        list_push_back(&pipe->commands, &cmd->elem);
+    }
+    return pipe;
+}
+
+/* Launch 'pipe' n times with the current engine; return spawns/sec */
+static double
+run(struct esh_pipeline *pipe, int n)
+{
+    int spawned = 0, i;
+    double start = now();
+
+    for (i = 0; i < n; i++) {
+        spawned += esh_spawn_pipeline(pipe, -1);
+        while (waitpid(-pipe->pgrp, NULL, 0) > 0)
+            continue;
+    }
+    return spawned / (now() - start);
+}
+
+int
+main(int ac, char *av[])
+{
+    int opt, n = 2000, stages = 1;
+    size_t megabytes = 0;
+
+    while ((opt = getopt(ac, av, "hn:s:m:")) > 0) {
+        switch (opt) {
+        case 'n':
+            n = atoi(optarg);
+            break;
+        case 's':
+            stages = atoi(optarg);
+            break;
+        case 'm':
+            megabytes = atoi(optarg);
+            break;
+        default:
+            usage(av[0]);
+        }
+    }
+
+    /* Simulate a grown shell: touch the memory so it is really mapped. */
+    if (megabytes > 0)
+        memset(malloc(megabytes << 20), 1, megabytes << 20);
+
+    esh_signal_block(SIGCHLD);
+    struct esh_pipeline *pipe = make_pipeline(stages);
+
+    esh_spawn_engine = ESH_SPAWN_FORK;
+    double fork_rate = run(pipe, n);
+    esh_spawn_engine = ESH_SPAWN_POSIX;
+    double spawn_rate = run(pipe, n);
+
+    printf("stages %d, heap %zu MB, %d iterations\n", stages, megabytes, n);
+    printf("  fork   %10.0f spawns/sec\n", fork_rate);
+    printf("  spawn  %10.0f spawns/sec\n", spawn_rate);
+    return 0;
+}
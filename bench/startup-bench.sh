@@ -0,0 +1,84 @@
+#!/bin/sh
+#
+# startup-bench - measure how plugins affect the startup time of esh.
+#
+# Usage: bench/startup-bench.sh [-n runs] [-p plugins]
+#
+# Builds 'plugins' (50 by default) plugins that each register a builtin
+# from init(), then starts 'esh -c exit' 'runs' (100 by default) times:
+# without plugins, with the plugins but without a manifest, so that
+# every plugin is opened and initialized, and with an up to date
+# manifest, so that no plugin is opened until it is needed.  Run from
+# the top-level directory after 'make'.  esh is started in an empty
+# directory, so that it does not also load the plugins in ./plugins.
+
+runs=100
+nplugins=50
+while getopts n:p: opt; do
+    case $opt in
+    n) runs=$OPTARG ;;
+    p) nplugins=$OPTARG ;;
+    *) echo "Usage: $0 [-n runs] [-p plugins]"; exit 1 ;;
+    esac
+done
+
+esh=${ESH:-./esh}
+case $esh in
+*/*) esh=$(cd "$(dirname "$esh")" && pwd)/$(basename "$esh") ;;
+esac
+CC=${CC:-cc}
+tmp=$(mktemp -d /tmp/startup-bench.XXXXXX)
+trap 'rm -rf "$tmp"' EXIT
+
+cat > "$tmp/plugin.c" <<'EOF'
+#include <stdio.h>
+#include "esh.h"
+
+static int builtin(struct esh_command *cmd) { return 0; }
+
+static bool init(struct esh_shell *shell)
+{
+    char name[32];
+    snprintf(name, sizeof name, "builtin%d", RANK);
+    return shell->register_builtin(name, builtin);
+}
+
+struct esh_plugin esh_module = {
+    .rank = RANK,
+    .init = init,
+};
+EOF
+
+mkdir "$tmp/none" "$tmp/plugins" "$tmp/cwd"
+i=0
+while [ $i -lt "$nplugins" ]; do
+    $CC -shared -fPIC -I. -DRANK=$i -o "$tmp/plugins/p$i.so" "$tmp/plugin.c" \
+        || exit 1
+    i=$((i + 1))
+done
+
+now() {
+    date +%s.%N
+}
+
+# run description plugindir manifest: print the time per startup
+run() {
+    cd "$tmp/cwd" || exit 1
+    t0=$(now)
+    i=0
+    while [ $i -lt "$runs" ]; do
+        ESH_PLUGIN_MANIFEST=$3 "$esh" -p "$2" -c exit > /dev/null 2>&1
+        i=$((i + 1))
+    done
+    t1=$(now)
+    cd "$OLDPWD" || exit 1
+    awk -v what="$1" -v t0="$t0" -v t1="$t1" -v n="$runs" 'BEGIN {
+        printf "%-32s %8.3f ms/startup\n", what, (t1 - t0) * 1e3 / n
+    }'
+}
+
+run "no plugins" "$tmp/none" ""
+run "$nplugins plugins, no manifest" "$tmp/plugins" ""
+(cd "$tmp/cwd" && ESH_PLUGIN_MANIFEST="$tmp/manifest" \
+    "$esh" -p "$tmp/plugins" -c exit > /dev/null 2>&1)
+run "$nplugins plugins, manifest" "$tmp/plugins" "$tmp/manifest"
@@ -0,0 +1,113 @@
+/*
+ * esh-builtins.c
+ * The registry of builtin commands.
+ *
+ * The shell and plugins register each builtin by name once, at
+ * startup.  Deciding whether a command is a builtin, and which, is
+ * then a single hash lookup, no matter how many builtins there are
+ * or how many plugins provide them.
+ */
+#include <string.h>
+
+#include "hash.h"
+#include "esh.h"
+
+struct builtin {
+    struct hash_elem elem;      /* Link element for builtins */
+    char *name;
+    esh_builtin_t handler;
+};
+
+static struct hash builtins;
+static bool builtins_initialized;
+static unsigned long changes;       /* registrations and removals */
+
+static unsigned
+builtin_hash(const struct hash_elem *e, void *aux)
+{
+    return hash_string(hash_entry(e, struct builtin, elem)->name);
+}
+
+static bool
+builtin_less(const struct hash_elem *a, const struct hash_elem *b, void *aux)
+{
+    return strcmp(hash_entry(a, struct builtin, elem)->name,
+                  hash_entry(b, struct builtin, elem)->name) < 0;
+}
+
+/*
+ * Register 'handler' as the builtin command 'name'.  Returns false,
+ * and leaves the registry unchanged, if 'name' is already taken.
+ */
+bool
+esh_builtin_register(const char *name, esh_builtin_t handler)
+{
+    if (!builtins_initialized) {
+        hash_init(&builtins, builtin_hash, builtin_less, NULL);
+        builtins_initialized = true;
+    }
+
+    struct builtin *b = malloc(sizeof *b);
+    b->name = strdup(name);
+    b->handler = handler;
+
+    if (hash_insert(&builtins, &b->elem) != NULL) {
+        free(b->name);
+        free(b);
+        return false;
+    }
+    changes++;
+    return true;
+}
+
+/* Return the handler of builtin 'name', or NULL if there is none */
+esh_builtin_t
+esh_builtin_lookup(const char *name)
+{
+    if (!builtins_initialized)
+        return NULL;
+
+    struct builtin key = { .name = (char *) name };
+    struct hash_elem *e = hash_find(&builtins, &key.elem);
+    return e ? hash_entry(e, struct builtin, elem)->handler : NULL;
+}
+
+/* Remove builtin 'name'.  Returns false if there is no such builtin. */
+bool
+esh_builtin_unregister(const char *name)
+{
+    if (!builtins_initialized)
+        return false;
+
+    struct builtin key = { .name = (char *) name };
+    struct hash_elem *e = hash_delete(&builtins, &key.elem);
+    if (e == NULL)
+        return false;
+
+    struct builtin *b = hash_entry(e, struct builtin, elem);
+    free(b->name);
+    free(b);
+    changes++;
+    return true;
+}
+
+/* Return how often builtins were registered or removed so far, so that
+ * callers can tell whether the set of builtins changed */
+unsigned long
+esh_builtin_changes(void)
+{
+    return changes;
+}
+
+/* Call 'fn' with the name of every builtin, in no particular order */
+void
+esh_builtin_foreach(void (*fn)(const char *name, void *aux), void *aux)
+{
+    struct hash_iterator i;
+
+    if (!builtins_initialized)
+        return;
+    hash_first(&i, &builtins);
+    while (hash_next(&i))
+        fn(hash_entry(hash_cur(&i), struct builtin, elem)->name, aux);
+}
@@ -0,0 +1,516 @@
+/*
+ * esh-complete.c
+ * Complete command names from an index of $PATH and the builtins.
+ *
+ * The index is a sorted array of the names of all executables in the
+ * $PATH directories and of all builtins, so that the commands starting
+ * with a prefix are found with a binary search.  Each name counts the
+ * directories it is in, and each directory keeps its own sorted array
+ * of names, so that one directory can be read again and merged into
+ * the index without reading the others.
+ *
+ * The directories are read the first time a command is completed, and
+ * are then watched with inotify: files that are created, removed,
+ * renamed or made (not) executable are added to or removed from the
+ * index one at a time, without reading a directory again, which can be
+ * slow on network file systems.  Only if events were lost is every
+ * directory read again, and when $PATH changes.  Relative directories
+ * in $PATH, whose contents change with the current directory, are left
+ * out.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <readline/readline.h>
+
+#include "esh-sys-utils.h"
+#include "esh.h"
+
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+                      | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+/* A command name, shared by the index and the directories */
+struct name {
+    int count;                  /* directories (and builtins) it is in */
+    char text[];
+};
+
+/* A sorted array of names */
+struct names {
+    struct name **v;
+    size_t n, cap;
+};
+
+/* A directory of $PATH, or the builtins if 'path' is NULL */
+struct directory {
+    char *path;
+    int wd;                     /* inotify watch, or -1 */
+    struct names names;
+    dev_t dev;                  /* identity of the directory when read */
+    ino_t ino;
+};
+
+static struct names commands;   /* all names, each once */
+static bool built;
+
+static char *path_value;        /* value of $PATH the index is for */
+static struct directory *dirs;  /* dirs[0] holds the builtins */
+static int ndirs;
+static unsigned long builtin_changes;
+
+static int ifd = -1;            /* inotify */
+static unsigned long rescans, events;
+
+static int
+name_compare(const void *a, const void *b)
+{
+    return strcmp((*(struct name * const *) a)->text,
+                  (*(struct name * const *) b)->text);
+}
+
+/* Return the position of the first name in 'names' not less than 's' */
+static size_t
+names_find(struct names *names, const char *s)
+{
+    size_t lo = 0, hi = names->n;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(names->v[mid]->text, s) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static bool
+names_has(struct names *names, size_t i, const char *s)
+{
+    return i < names->n && !strcmp(names->v[i]->text, s);
+}
+
+static void
+names_reserve(struct names *names, size_t n)
+{
+    if (n > names->cap) {
+        names->cap = n > 2 * names->cap ? n : 2 * names->cap;
+        names->v = realloc(names->v, names->cap * sizeof *names->v);
+    }
+}
+
+static void
+names_insert(struct names *names, size_t i, struct name *name)
+{
+    names_reserve(names, names->n + 1);
+    memmove(names->v + i + 1, names->v + i,
+            (names->n - i) * sizeof *names->v);
+    names->v[i] = name;
+    names->n++;
+}
+
+static void
+names_remove(struct names *names, size_t i)
+{
+    memmove(names->v + i, names->v + i + 1,
+            (names->n - i - 1) * sizeof *names->v);
+    names->n--;
+}
+
+/* Add 's' to directory 'dir' and, if it is new, to the index */
+static void
+dir_add(struct directory *dir, const char *s)
+{
+    size_t i = names_find(&dir->names, s);
+    if (names_has(&dir->names, i, s))
+        return;
+
+    size_t j = names_find(&commands, s);
+    struct name *name;
+    if (names_has(&commands, j, s)) {
+        name = commands.v[j];
+    } else {
+        name = malloc(sizeof *name + strlen(s) + 1);
+        name->count = 0;
+        strcpy(name->text, s);
+        names_insert(&commands, j, name);
+    }
+    name->count++;
+    names_insert(&dir->names, i, name);
+}
+
+/* Remove 's' from directory 'dir', and from the index if no other
+ * directory has it */
+static void
+dir_remove(struct directory *dir, const char *s)
+{
+    size_t i = names_find(&dir->names, s);
+    if (!names_has(&dir->names, i, s))
+        return;
+
+    struct name *name = dir->names.v[i];
+    names_remove(&dir->names, i);
+    if (--name->count == 0) {
+        names_remove(&commands, names_find(&commands, s));
+        free(name);
+    }
+}
+
+/*
+ * Make the 'n' sorted strings 'names' the contents of directory 'dir',
+ * copying those that are new.  Takes time linear in the size of the
+ * index, however many names changed.
+ */
+static void
+dir_replace(struct directory *dir, char **names, size_t n)
+{
+    struct names new = { NULL, 0, 0 }, born = { NULL, 0, 0 };
+    size_t i = 0, j = 0;
+
+    names_reserve(&new, n);
+    names_reserve(&born, n);
+    while (i < dir->names.n || j < n) {
+        int c = i == dir->names.n ? 1 : j == n ? -1
+              : strcmp(dir->names.v[i]->text, names[j]);
+        if (c < 0) {
+            /* Gone; swept from the index below if no longer used */
+            dir->names.v[i++]->count--;
+        } else if (c > 0) {
+            size_t k = names_find(&commands, names[j]);
+            struct name *name;
+            if (names_has(&commands, k, names[j])) {
+                name = commands.v[k];
+            } else {
+                name = malloc(sizeof *name + strlen(names[j]) + 1);
+                name->count = 0;
+                strcpy(name->text, names[j]);
+                born.v[born.n++] = name;
+            }
+            name->count++;
+            new.v[new.n++] = name;
+            j++;
+        } else {
+            new.v[new.n++] = dir->names.v[i++];
+            j++;
+        }
+    }
+    free(dir->names.v);
+    dir->names = new;
+
+    /* Merge the new names into the index, dropping unused ones */
+    struct names merged = { NULL, 0, 0 };
+    names_reserve(&merged, commands.n + born.n);
+    for (i = j = 0; i < commands.n || j < born.n; ) {
+        if (i < commands.n && commands.v[i]->count == 0) {
+            free(commands.v[i++]);
+        } else if (j == born.n
+                   || (i < commands.n && name_compare(&commands.v[i],
+                                                   &born.v[j]) < 0)) {
+            merged.v[merged.n++] = commands.v[i++];
+        } else {
+            merged.v[merged.n++] = born.v[j++];
+        }
+    }
+    free(commands.v);
+    free(born.v);
+    commands = merged;
+}
+
+static int
+string_compare(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/* Return true if 'name' in directory 'dfd' is an executable file */
+static bool
+is_executable(int dfd, const char *name)
+{
+    struct stat st;
+    return fstatat(dfd, name, &st, 0) == 0 && S_ISREG(st.st_mode)
+        && (st.st_mode & 0111);
+}
+
+/* Add 'name' to a list of names */
+static void
+collect_name(const char *name, void *aux)
+{
+    struct { char **v; size_t n, cap; } *list = aux;
+
+    if (list->n == list->cap) {
+        list->cap = list->cap ? 2 * list->cap : 64;
+        list->v = realloc(list->v, list->cap * sizeof *list->v);
+    }
+    list->v[list->n++] = strdup(name);
+}
+
+/* Read directory 'dir' (or the builtins) again, and watch it if it is
+ * not watched yet.  It is watched first, so that no change is missed. */
+static void
+dir_read(struct directory *dir)
+{
+    struct { char **v; size_t n, cap; } list = { NULL, 0, 0 };
+    DIR *d = NULL;
+    struct dirent *ent;
+    size_t i;
+
+    if (dir->path == NULL) {
+        esh_builtin_foreach(collect_name, &list);
+    } else {
+        if (dir->wd == -1)
+            dir->wd = inotify_add_watch(esh_complete_fd(), dir->path,
+                                        WATCH_EVENTS);
+        d = opendir(dir->path);
+    }
+
+    while (d != NULL && (ent = readdir(d)) != NULL) {
+        if (ent->d_type == DT_DIR || !strcmp(ent->d_name, ".")
+            || !strcmp(ent->d_name, "..")
+            || !is_executable(dirfd(d), ent->d_name))
+            continue;
+        collect_name(ent->d_name, &list);
+    }
+    if (d != NULL)
+        closedir(d);
+
+    qsort(list.v, list.n, sizeof *list.v, string_compare);
+    dir_replace(dir, list.v, list.n);
+    for (i = 0; i < list.n; i++)
+        free(list.v[i]);
+    free(list.v);
+}
+
+/* Return the first of dirs[1..n) with watch 'wd', or NULL */
+static struct directory *
+dir_by_watch(int wd, int n)
+{
+    int i;
+    for (i = 1; i < n; i++)
+        if (dirs[i].wd == wd)
+            return &dirs[i];
+    return NULL;
+}
+
+/* Forget every directory, and index those in $PATH 'value' */
+static void
+read_path(const char *value)
+{
+    int i;
+
+    for (i = 0; i < ndirs; i++) {
+        if (dirs[i].wd != -1 && dir_by_watch(dirs[i].wd, i) == NULL)
+            inotify_rm_watch(ifd, dirs[i].wd);
+        dir_replace(&dirs[i], NULL, 0);
+        free(dirs[i].names.v);
+        free(dirs[i].path);
+    }
+    char *copy = strdup(value);     /* 'value' may be path_value */
+    free(path_value);
+    path_value = copy;
+    value = copy;
+
+    /* At most one directory per element, and the builtins */
+    ndirs = 2;
+    for (i = 0; value[i]; i++)
+        if (value[i] == ':')
+            ndirs++;
+    dirs = realloc(dirs, ndirs * sizeof *dirs);
+    dirs[0] = (struct directory) { NULL, -1, { NULL, 0, 0 } };
+    builtin_changes = esh_builtin_changes();
+    dir_read(&dirs[0]);
+
+    for (ndirs = 1; *value; ) {
+        size_t len = strcspn(value, ":");
+        char *path = strndup(value, len);
+        value += len + (value[len] == ':');
+
+        /* Elements that name the same directory, such as /bin and
+         * /usr/bin where /bin is a link, are read once: inotify gives
+         * both the same watch */
+        struct stat st;
+        bool seen = false;
+        if (stat(path, &st) == -1)
+            st.st_dev = st.st_ino = 0;
+        for (i = 1; i < ndirs; i++)
+            seen |= !strcmp(dirs[i].path, path)
+                    || (st.st_ino != 0 && dirs[i].dev == st.st_dev
+                        && dirs[i].ino == st.st_ino);
+        if (path[0] != '/' || seen) {
+            free(path);
+            continue;
+        }
+        dirs[ndirs] = (struct directory) { path, -1, { NULL, 0, 0 },
+                                           st.st_dev, st.st_ino };
+        dir_read(&dirs[ndirs++]);
+    }
+    rescans++;
+}
+
+/* Apply one inotify event to the index of directory 'dir' */
+static void
+dir_event(struct directory *dir, struct inotify_event *ev)
+{
+    if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+        /* Gone or moved; it is watched again if $PATH changes */
+        if (!(ev->mask & IN_IGNORED))
+            inotify_rm_watch(ifd, dir->wd);
+        dir->wd = -1;
+        dir_replace(dir, NULL, 0);
+    } else if (ev->len == 0) {
+        return;
+    } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        dir_remove(dir, ev->name);
+    } else {
+        /* Created, moved here or changed its mode */
+        int dfd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dfd != -1 && is_executable(dfd, ev->name))
+            dir_add(dir, ev->name);
+        else
+            dir_remove(dir, ev->name);
+        if (dfd != -1)
+            close(dfd);
+    }
+}
+
+/* Apply one inotify event to every directory it is for; there is more
+ * than one if $PATH named a directory in two ways that 'read_path'
+ * could not tell apart.  Returns false if events were lost. */
+static bool
+handle_event(struct inotify_event *ev)
+{
+    int i;
+
+    if (ev->mask & IN_Q_OVERFLOW)
+        return false;
+
+    for (i = 1; i < ndirs; i++) {
+        if (dirs[i].wd == ev->wd) {
+            dir_event(&dirs[i], ev);
+            events++;
+        }
+    }
+    return true;
+}
+
+/* Read the pending inotify events */
+void
+esh_complete_ready(void)
+{
+    char buf[16384] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    bool lost = false;
+    ssize_t len;
+
+    while ((len = read(esh_complete_fd(), buf, sizeof buf)) > 0) {
+        char *p;
+        for (p = buf; p < buf + len; ) {
+            struct inotify_event *ev = (struct inotify_event *) p;
+            if (built && !handle_event(ev))
+                lost = true;
+            p += sizeof *ev + ev->len;
+        }
+    }
+    if (lost)
+        read_path(path_value);
+}
+
+/* Bring the index up to date */
+static void
+update(void)
+{
+    const char *value = getenv("PATH");
+    if (value == NULL)
+        value = "/bin:/usr/bin";
+
+    esh_complete_ready();
+    if (!built || strcmp(value, path_value)) {
+        read_path(value);
+        built = true;
+    } else if (esh_builtin_changes() != builtin_changes) {
+        builtin_changes = esh_builtin_changes();
+        dir_read(&dirs[0]);
+    }
+}
+
+/* An inotify descriptor that is readable when a directory in $PATH
+ * changed, after which esh_complete_ready() must be called */
+int
+esh_complete_fd(void)
+{
+    if (ifd == -1) {
+        ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (ifd == -1)
+            esh_sys_fatal_error("inotify_init1: ");
+    }
+    return ifd;
+}
+
+/* Readline generator: the commands that start with 'text' */
+static char *
+generate(const char *text, int state)
+{
+    static size_t next, len;
+
+    if (state == 0) {
+        next = names_find(&commands, text);
+        len = strlen(text);
+    }
+    if (next < commands.n && !strncmp(commands.v[next]->text, text, len))
+        return strdup(commands.v[next++]->text);
+    return NULL;
+}
+
+/*
+ * Readline's attempted completion function: complete words in command
+ * position, at the start of the line or after |, ;, & or (, from the
+ * index.  Other words, and words with a /, are completed as file names.
+ */
+static char **
+attempt_completion(const char *text, int start, int end)
+{
+    while (start > 0 && (rl_line_buffer[start - 1] == ' '
+                         || rl_line_buffer[start - 1] == '\t'))
+        start--;
+    if ((start > 0 && !strchr("|;&(", rl_line_buffer[start - 1]))
+        || strchr(text, '/') != NULL)
+        return NULL;
+
+    rl_attempted_completion_over = 1;
+    update();
+    return rl_completion_matches(text, generate);
+}
+
+/* Complete command names from the index */
+void
+esh_complete_init(void)
+{
+    rl_attempted_completion_function = attempt_completion;
+}
+
+/* Print the commands that start with 'prefix', or if it is NULL, the
+ * size of the index */
+void
+esh_complete_print(const char *prefix)
+{
+    size_t i, n = 0;
+    int d;
+
+    update();
+    if (prefix != NULL) {
+        for (i = names_find(&commands, prefix);
+             i < commands.n && !strncmp(commands.v[i]->text, prefix,
+                                     strlen(prefix)); i++)
+            printf("%s\n", commands.v[i]->text);
+        return;
+    }
+
+    for (d = 1; d < ndirs; d++)
+        n += dirs[d].wd != -1;
+    printf("%zu commands, %zu builtins, %d directories (%zu watched)\n",
+           commands.n, dirs[0].names.n, ndirs - 1, n);
+    printf("%lu full reads, %lu changes\n", rescans, events);
+}
@@ -0,0 +1,520 @@
+/*
+ * esh-control.c
+ * A Unix-domain control socket, for programs that drive a running shell.
+ *
+ * Clients send one request per line and get one line of JSON back per
+ * request, in order:
+ *
+ *   run cmdline        run cmdline, all of its pipelines in the background;
+ *                      replies with its status and the jobs it started.
+ *                      Lines that run a builtin or do not parse are
+ *                      refused.
+ *   jobs               replies with the current jobs
+ *   fg|bg|stop jid     like the builtins of the same name; 'fg' replies
+ *                      once the job has stopped or finished, and until
+ *                      then the shell serves neither the user nor any
+ *                      other client
+ *   kill jid [signo]   send signal signo (SIGKILL by default) to a job
+ *
+ * Replies are {"ok":true,...} or {"ok":false,"error":"..."}.
+ *
+ * Every socket is non-blocking and served from the shell's event loop,
+ * through one epoll descriptor of our own, so that a slow client never
+ * holds up the user.  The socket is created with mode 0600, and only
+ * connections from the shell's own user (or root) are accepted.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "esh-sys-utils.h"
+#include "esh.h"
+
+#define CONTROL_MAX_CLIENTS 64
+#define CONTROL_MAX_LINE 4096
+#define CONTROL_EVENTS 16
+
+/* One connection */
+struct client {
+    int fd;
+    char in[CONTROL_MAX_LINE];  /* received, not yet a complete line */
+    size_t inlen;
+    char *out;                  /* replies not written yet */
+    size_t outlen;
+    bool closing;               /* close once 'out' is written */
+    struct list_elem elem;
+};
+
+static struct list clients;
+static int nclients;
+
+static int epfd = -1;
+static int listen_fd = -1;
+static char *socket_path;
+static esh_control_run_t run_line;
+static unsigned long requests;
+static bool serving;            /* in esh_control_ready() */
+
+/* Write s as a JSON string */
+static void
+json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            fprintf(out, "\\u%04x", *s);
+        else
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+/* Write a job as a JSON object */
+static void
+json_job(FILE *out, struct esh_pipeline *job)
+{
+    static const char *status_names[] = {
+        [FOREGROUND] = "foreground",
+        [BACKGROUND] = "running",
+        [STOPPED] = "stopped",
+        [NEEDSTERMINAL] = "needs terminal",
+    };
+    struct list_elem *e;
+
+    fprintf(out, "{\"jid\":%d,\"pgrp\":%d,\"status\":\"%s\",\"commands\":[",
+            job->jid, (int) job->pgrp, status_names[job->status]);
+    for (e = list_begin(&job->commands); e != list_end(&job->commands);
+         e = list_next(e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        char **argv;
+
+        fprintf(out, "%s{\"pid\":%d,\"state\":\"%s\",\"argv\":[",
+                e == list_begin(&job->commands) ? "" : ",", (int) cmd->pid,
+                cmd->completed ? "done" : cmd->stopped ? "stopped"
+                : "running");
+        for (argv = cmd->argv; *argv; argv++) {
+            if (argv != cmd->argv)
+                fputc(',', out);
+            json_string(out, *argv);
+        }
+        fputs("]}", out);
+    }
+    fputs("]}", out);
+}
+
+/* Write the current jobs as a JSON array, only those started at or
+ * after 'since' unless it is NULL */
+static void
+json_jobs(FILE *out, struct timespec *since)
+{
+    struct list *jobs = esh_get_jobs();
+    struct list_elem *e;
+    bool first = true;
+
+    fputc('[', out);
+    for (e = list_begin(jobs); e != list_end(jobs); e = list_next(e)) {
+        struct esh_pipeline *job = list_entry(e, struct esh_pipeline, elem);
+        if (since != NULL && (job->started.tv_sec < since->tv_sec
+                              || (job->started.tv_sec == since->tv_sec
+                                  && job->started.tv_nsec < since->tv_nsec)))
+            continue;
+        if (!first)
+            fputc(',', out);
+        json_job(out, job);
+        first = false;
+    }
+    fputc(']', out);
+}
+
+/* Reply with an error */
+static void
+reply_error(FILE *out, const char *error)
+{
+    fputs("{\"ok\":false,\"error\":", out);
+    json_string(out, error);
+    fputc('}', out);
+}
+
+/* Return the job named by 'arg', as '%jid' or 'jid', or NULL */
+static struct esh_pipeline *
+job_from_argument(const char *arg)
+{
+    if (arg == NULL)
+        return NULL;
+    return esh_get_job_from_jid(atoi(arg[0] == '%' ? arg + 1 : arg));
+}
+
+/* Carry out one request, writing the reply to 'out' */
+static void
+handle_request(char *line, FILE *out)
+{
+    char *args = line + strcspn(line, " \t");
+    if (*args != '\0')
+        *args++ = '\0';
+    args += strspn(args, " \t");
+
+    if (!strcmp(line, "run")) {
+        struct timespec before;
+        clock_gettime(CLOCK_MONOTONIC, &before);
+
+        int status = run_line(args, true);
+        if (status == ESH_CONTROL_REFUSED) {
+            reply_error(out, "builtins cannot be run in the background");
+            return;
+        }
+        if (status == ESH_CONTROL_SYNTAX_ERROR) {
+            reply_error(out, "syntax error");
+            return;
+        }
+        fprintf(out, "{\"ok\":true,\"status\":%d,\"jobs\":", status);
+        json_jobs(out, &before);
+        fputc('}', out);
+        return;
+    }
+
+    if (!strcmp(line, "jobs")) {
+        fputs("{\"ok\":true,\"jobs\":", out);
+        json_jobs(out, NULL);
+        fputc('}', out);
+        return;
+    }
+
+    char *jobarg = strtok(args, " \t"), *sigarg = strtok(NULL, " \t");
+    bool fg = !strcmp(line, "fg"), bg = !strcmp(line, "bg"),
+         stop = !strcmp(line, "stop");
+    if (!fg && !bg && !stop && strcmp(line, "kill")) {
+        reply_error(out, "unknown request");
+        return;
+    }
+
+    struct esh_pipeline *job = job_from_argument(jobarg);
+    if (job == NULL) {
+        reply_error(out, "no such job");
+        return;
+    }
+
+    if (fg) {
+        char cmdline[32];
+        snprintf(cmdline, sizeof cmdline, "fg %d", job->jid);
+        int status = run_line(cmdline, false);
+        fprintf(out, "{\"ok\":true,\"status\":%d}", status);
+        return;
+    }
+
+    bool ok;
+    if (bg) {
+        ok = esh_job_resume(job, BACKGROUND);
+    } else {
+        int sig = stop ? SIGSTOP : sigarg ? atoi(sigarg) : SIGKILL;
+        if (sig <= 0 || sig >= NSIG) {
+            reply_error(out, "bad signal");
+            return;
+        }
+        ok = kill(-job->pgrp, sig) == 0;
+    }
+    if (ok)
+        fputs("{\"ok\":true}", out);
+    else
+        reply_error(out, strerror(errno));
+}
+
+static void
+client_close(struct client *c)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    list_remove(&c->elem);
+    nclients--;
+    free(c->out);
+    free(c);
+}
+
+/* Write as much of the pending replies as the socket takes, and watch
+ * for it to take more if there are any left.  Returns false if the
+ * client was closed. */
+static bool
+client_flush(struct client *c)
+{
+    size_t done = 0;
+
+    while (done < c->outlen) {
+        ssize_t n = send(c->fd, c->out + done, c->outlen - done,
+                         MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && errno == EAGAIN)
+            break;
+        if (n <= 0) {
+            client_close(c);
+            return false;
+        }
+        done += n;
+    }
+    memmove(c->out, c->out + done, c->outlen - done);
+    c->outlen -= done;
+
+    if (c->outlen == 0 && c->closing) {
+        client_close(c);
+        return false;
+    }
+
+    struct epoll_event ev = {
+        .events = EPOLLIN | (c->outlen > 0 ? EPOLLOUT : 0),
+        .data.ptr = c,
+    };
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    return true;
+}
+
+/* Handle the complete lines received.  Returns false if the client
+ * was closed. */
+static bool
+client_requests(struct client *c)
+{
+    char *start = c->in, *eol;
+    char *reply;
+    size_t replylen;
+    FILE *out = open_memstream(&reply, &replylen);
+
+    while ((eol = memchr(start, '\n', c->in + c->inlen - start)) != NULL) {
+        *eol = '\0';
+        if (eol > start && eol[-1] == '\r')
+            eol[-1] = '\0';
+        requests++;
+        handle_request(start, out);
+        fputc('\n', out);
+        start = eol + 1;
+    }
+    c->inlen -= start - c->in;
+    memmove(c->in, start, c->inlen);
+
+    if (c->inlen == sizeof c->in) {     /* a line that does not fit */
+        reply_error(out, "line too long");
+        fputc('\n', out);
+        c->inlen = 0;
+        c->closing = true;
+    }
+    fclose(out);
+
+    c->out = realloc(c->out, c->outlen + replylen);
+    memcpy(c->out + c->outlen, reply, replylen);
+    c->outlen += replylen;
+    free(reply);
+
+    return client_flush(c);
+}
+
+/* Read what a client sent and reply to it */
+static void
+client_readable(struct client *c)
+{
+    for (;;) {
+        ssize_t n = read(c->fd, c->in + c->inlen, sizeof c->in - c->inlen);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && errno == EAGAIN)
+            return;
+        if (n <= 0) {           /* reply to what was sent, then close */
+            c->closing = true;
+            client_requests(c);
+            return;
+        }
+        c->inlen += n;
+        if (!client_requests(c) || c->closing)
+            return;
+    }
+}
+
+/* Accept the pending connections of the shell's own user */
+static void
+accept_clients(void)
+{
+    int fd;
+
+    while ((fd = accept4(listen_fd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        struct ucred cred;
+        socklen_t len = sizeof cred;
+
+        if (nclients == CONTROL_MAX_CLIENTS
+            || getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1
+            || (cred.uid != geteuid() && cred.uid != 0)) {
+            close(fd);
+            continue;
+        }
+
+        struct client *c = calloc(1, sizeof *c);
+        c->fd = fd;
+        list_push_back(&clients, &c->elem);
+        nclients++;
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+/* Return an epoll descriptor that is readable when the control socket
+ * needs attention; call esh_control_ready() then */
+int
+esh_control_fd(void)
+{
+    if (epfd == -1) {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd == -1)
+            esh_sys_fatal_error("epoll_create1: ");
+        list_init(&clients);
+    }
+    return epfd;
+}
+
+/* Serve the clients that are ready, without blocking */
+void
+esh_control_ready(void)
+{
+    struct epoll_event events[CONTROL_EVENTS];
+    int i, n = epoll_wait(esh_control_fd(), events, CONTROL_EVENTS, 0);
+
+    serving = true;
+    for (i = 0; i < n; i++) {
+        struct client *c = events[i].data.ptr;
+
+        if (c == NULL) {
+            accept_clients();
+        } else if (events[i].events & EPOLLOUT) {
+            if (client_flush(c) && (events[i].events & EPOLLIN))
+                client_readable(c);
+        } else {
+            client_readable(c);
+        }
+    }
+    serving = false;
+}
+
+/* Remove the socket when the shell exits */
+static void
+remove_socket(void)
+{
+    if (socket_path != NULL)
+        unlink(socket_path);
+}
+
+/*
+ * Listen on a control socket at 'path', or at $XDG_RUNTIME_DIR/esh.pid
+ * (/tmp/esh-uid.pid without it) if 'path' is NULL.  Requests to run
+ * command lines are carried out by 'run'.  The path is exported as
+ * $ESH_CONTROL_SOCKET.  Returns false if the socket cannot be created,
+ * or while a request is being carried out.
+ */
+bool
+esh_control_open(const char *path, esh_control_run_t run)
+{
+    static bool registered;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    char defpath[PATH_MAX];
+
+    if (path == NULL) {
+        const char *dir = getenv("XDG_RUNTIME_DIR");
+        if (dir != NULL && *dir != '\0')
+            snprintf(defpath, sizeof defpath, "%s/esh.%d", dir, (int) getpid());
+        else
+            snprintf(defpath, sizeof defpath, "/tmp/esh-%d.%d",
+                     (int) getuid(), (int) getpid());
+        path = defpath;
+    }
+    if (strlen(path) >= sizeof addr.sun_path) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    if (!esh_control_close())
+        return false;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return false;
+
+    /* A socket left behind by a shell that is gone is replaced */
+    mode_t mask = umask(0077);
+    int rc = bind(fd, (struct sockaddr *) &addr, sizeof addr);
+    if (rc == -1 && errno == EADDRINUSE) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connect(probe, (struct sockaddr *) &addr, sizeof addr) == -1
+            && errno == ECONNREFUSED) {
+            unlink(path);
+            rc = bind(fd, (struct sockaddr *) &addr, sizeof addr);
+        } else {
+            errno = EADDRINUSE;
+        }
+        close(probe);
+    }
+    umask(mask);
+
+    if (rc == -1 || listen(fd, SOMAXCONN) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return false;
+    }
+
+    listen_fd = fd;
+    socket_path = strdup(path);
+    run_line = run;
+    setenv("ESH_CONTROL_SOCKET", socket_path, 1);
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(esh_control_fd(), EPOLL_CTL_ADD, listen_fd, &ev);
+
+    if (!registered) {
+        atexit(remove_socket);
+        registered = true;
+    }
+    return true;
+}
+
+/* Stop listening, close every connection and remove the socket.
+ * Returns false while a request is being carried out. */
+bool
+esh_control_close(void)
+{
+    if (serving) {
+        errno = EBUSY;
+        return false;
+    }
+    if (listen_fd == -1)
+        return true;
+
+    while (!list_empty(&clients))
+        client_close(list_entry(list_front(&clients), struct client, elem));
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, listen_fd, NULL);
+    close(listen_fd);
+    listen_fd = -1;
+    remove_socket();
+    free(socket_path);
+    socket_path = NULL;
+    unsetenv("ESH_CONTROL_SOCKET");
+    return true;
+}
+
+/* Print the socket path, the number of connections and of requests */
+void
+esh_control_print(void)
+{
+    if (listen_fd == -1)
+        printf("control socket off\n");
+    else
+        printf("control socket %s, %d clients, %lu requests\n",
+               socket_path, nclients, requests);
+}
@@ -4,10 +4,7 @@
 %{
 #include <stdio.h>
 #include <stdlib.h>
-#define YYDEBUG	1
-int yydebug;
-void yyerror(const char *msg);
-int yylex(void);
+#include <string.h>
 
 /*
  * Error messages, csh-style
@@ -16,31 +13,93 @@ int yylex(void);
 #define INVNUL  "Invalid null command."
 #define AMBINP  "Ambiguous input redirect."
 #define AMBOUT  "Ambiguous output redirect."
+#define MISHDOC "Missing end of here-document."
+#define EXTHDOC "Unexpected text after here-documents."
 
 #include "esh.h"
 
 #define obstack_chunk_alloc malloc
 #define obstack_chunk_free free
 
+/*
+ * The state of a parser.  The parser is pure and the flex scanner is
+ * reentrant, so each esh_parser can be used by a different thread.
+ */
+struct esh_parser {
+    /* The command line being parsed.  Words, argv arrays, commands and
+     * pipelines are all allocated from its arena. */
+    struct esh_command_line * commandline;
+
+    /* An obstack of char * in which the argv of the command being parsed
+     * grows before it is copied to the arena.  The words of a command are
+     * always contiguous, so only one argv grows at a time. */
+    struct obstack words;
+
+    enum esh_lex_mode lex_mode;     /* lexer used for the current line */
+    struct esh_lexer fast_lexer;    /* state of the whole-line lexer */
+    char * inputline;               /* input left for the flex scanner */
+    void * scanner;                 /* the flex scanner */
+
+    /* The lines after the command line, which hold the bodies of its
+     * here-documents, in order; NULL if there are none */
+    const char * heredocs;
+};
+
 struct cmd_helper {
-    struct obstack words;   /* an obstack of char * to collect argv */
     char *iored_input;
     char *iored_output;
     bool append_to_output;
+    char *heredoc;
 };
 
 /* Initialize cmd_helper and, optionally, set first argv */
 static void
-init_cmd(struct cmd_helper *cmd, char *firstcmd,
+init_cmd(struct esh_parser *parser, struct cmd_helper *cmd, char *firstcmd,
          char *iored_input, char *iored_output, bool append_to_output)
 {
-    obstack_init(&cmd->words);
     if (firstcmd)
-        obstack_ptr_grow(&cmd->words, firstcmd);
+        obstack_ptr_grow(&parser->words, firstcmd);
 
     cmd->iored_output = iored_output;
     cmd->iored_input = iored_input;
     cmd->append_to_output = append_to_output;
+    cmd->heredoc = NULL;
+}
+
+/*
+ * Return a copy of the body of the next here-document, which ends with
+ * a line that holds only 'word', or NULL if there is no such line.
+ * The final newline of the body is kept.
+ */
+static char *
+heredoc_body(struct esh_parser *parser, const char *word)
+{
+    const char *body = parser->heredocs, *line = body;
+    size_t wlen = strlen(word);
+
+    while (line != NULL) {
+        const char *nl = strchr(line, '\n');
+        size_t len = nl ? (size_t) (nl - line) : strlen(line);
+
+        if (len == wlen && !memcmp(line, word, wlen)) {
+            parser->heredocs = nl ? nl + 1 : line + len;
+            return obstack_copy0(&parser->commandline->arena, body,
+                                 line - body);
+        }
+        line = nl ? nl + 1 : NULL;
+    }
+    return NULL;
+}
+
+/* Return 'word' followed by a newline, the text of a here-string */
+static char *
+herestring_body(struct esh_parser *parser, const char *word)
+{
+    struct obstack *arena = &parser->commandline->arena;
+    obstack_grow(arena, word, strlen(word));
+    obstack_1grow(arena, '\n');
+    obstack_1grow(arena, '\0');
+    return obstack_finish(arena);
 }
 
 /* print error message */
@@ -50,34 +109,35 @@ static void p_error(char *msg);
  * Ensures NULL-terminated argv[] array
  */
 static struct esh_command *
-make_esh_command(struct cmd_helper *cmd)
+make_esh_command(struct esh_parser *parser, struct cmd_helper *cmd)
 {
-    obstack_ptr_grow(&cmd->words, NULL);
+    struct obstack *arena = &parser->commandline->arena;
+    obstack_ptr_grow(&parser->words, NULL);
 
-    int sz = obstack_object_size(&cmd->words);
-    char **argv = malloc(sz);
-    memcpy(argv, obstack_finish(&cmd->words), sz);
-    obstack_free(&cmd->words, NULL);
+    int sz = obstack_object_size(&parser->words);
+    char **grown = obstack_finish(&parser->words);
+    char **argv = obstack_copy(arena, grown, sz);
+    obstack_free(&parser->words, grown);
 
     if (*argv == NULL) {
-        free(argv);
         return NULL;
     }
 
-    return esh_command_create(argv,
-                              cmd->iored_input,
-                              cmd->iored_output,
-                              cmd->append_to_output);
+    struct esh_command *pcmd = esh_command_create(arena,
+                                                  argv,
+                                                  cmd->iored_input,
+                                                  cmd->iored_output,
+                                                  cmd->append_to_output);
+    pcmd->heredoc = cmd->heredoc;
+    return pcmd;
 }
 
-/* Called by parser when command line is complete */
-static void cmdline_complete(struct esh_command_line *);
-
-/* work-around for bug in flex 2.31 and later */
-static void yyunput (int c,char *buf_ptr  ) __attribute__((unused));
-
 %}
 
+%define api.pure full
+%parse-param {struct esh_parser *parser}
+%lex-param {struct esh_parser *parser}
+
 /* LALR stack types */
 %union {
   struct cmd_helper command;
@@ -95,14 +155,21 @@ static void yyunput (int c,char *buf_ptr  ) __attribute__((unused));
 /* Terminals */
 %token <word> WORD
 %token GREATER_GREATER
+%token LESS_LESS LESS_LESS_LESS
+
+%{
+static int yylex(YYSTYPE *lvalp, struct esh_parser *parser);
+static void yyerror(struct esh_parser *parser, const char *msg);
+%}
 
 %%
-cmd_line: cmd_list { cmdline_complete($1); }
+cmd_line: cmd_list
 
-cmd_list:	/* Null Command */ { $$ = esh_command_line_create_empty(); }
+cmd_list:	/* Null Command */ { $$ = parser->commandline; }
 |		pipeline {
             esh_pipeline_finish($1);
-            $$ = esh_command_line_create($1);
+            $$ = parser->commandline;
+            list_push_back(&$$->pipes, &$1->elem);
         }
 |		cmd_list ';'
 |		cmd_list '&' {
@@ -130,9 +197,9 @@ cmd_list:	/* Null Command */ { $$ = esh_command_line_create_empty(); }
         }
 
 pipeline: command {
-            struct esh_command * pcmd = make_esh_command(&$1);
+            struct esh_command * pcmd = make_esh_command(parser, &$1);
             if (pcmd == NULL) { p_error(INVNUL); YYABORT; }
-            $$ = esh_pipeline_create(pcmd);
+            $$ = esh_pipeline_create(&parser->commandline->arena, pcmd);
 		}
 |		pipeline '|' command {
 		    /* Error: 'ls >x | wc' */
@@ -142,9 +209,9 @@ pipeline: command {
 		    if (last->iored_output) { p_error(AMBOUT); YYABORT; }
 
 		    /* Error: 'ls | <x wc' */
-		    if ($3.iored_input) { p_error(AMBINP); YYABORT; }
+		    if ($3.iored_input || $3.heredoc) { p_error(AMBINP); YYABORT; }
 
-            struct esh_command * pcmd = make_esh_command(&$3);
+            struct esh_command * pcmd = make_esh_command(parser, &$3);
             if (pcmd == NULL) { p_error(INVNUL); YYABORT; }
 
             list_push_back(&$1->commands, &pcmd->elem);
@@ -155,23 +222,22 @@ pipeline: command {
 |		pipeline '|' error { p_error(INVNUL); YYABORT; }
 
 command:   WORD {
-            init_cmd(&$$, $1, NULL, NULL, false);
+            init_cmd(parser, &$$, $1, NULL, NULL, false);
         }
 |		input
 |		output
 |		command WORD {
             $$ = $1;
-            obstack_ptr_grow(&$$.words, $2);
+            obstack_ptr_grow(&parser->words, $2);
 		}
 |		command input {
-            obstack_free(&$2.words, NULL);
             /* Error: ambiguous redirect 'a <b <c' */
-            if($1.iored_input)   { p_error(AMBINP); YYABORT; }
+            if($1.iored_input || $1.heredoc) { p_error(AMBINP); YYABORT; }
             $$ = $1;
             $$.iored_input = $2.iored_input;
+            $$.heredoc = $2.heredoc;
 		}
 |		command output {
-            obstack_free(&$2.words, NULL);
             /* Error: ambiguous redirect 'a >b >c' */
             if ($1.iored_output) { p_error(AMBOUT); YYABORT; }
             $$ = $1;
@@ -180,31 +246,61 @@ command:   WORD {
 		}
 
 input:	'<' WORD {
-            init_cmd(&$$, NULL, $2, NULL, false);
+            init_cmd(parser, &$$, NULL, $2, NULL, false);
+        }
+|		LESS_LESS WORD {
+            init_cmd(parser, &$$, NULL, NULL, NULL, false);
+            $$.heredoc = heredoc_body(parser, $2);
+            if ($$.heredoc == NULL) { p_error(MISHDOC); YYABORT; }
+        }
+|		LESS_LESS_LESS WORD {
+            init_cmd(parser, &$$, NULL, NULL, NULL, false);
+            $$.heredoc = herestring_body(parser, $2);
         }
 |		'<' error	  { p_error(MISRED); YYABORT; }
+|		LESS_LESS error	  { p_error(MISRED); YYABORT; }
+|		LESS_LESS_LESS error { p_error(MISRED); YYABORT; }
 
 output:	'>' WORD {
-            init_cmd(&$$, NULL, NULL, $2, false);
+            init_cmd(parser, &$$, NULL, NULL, $2, false);
         }
 |		GREATER_GREATER WORD {
-            init_cmd(&$$, NULL, NULL, $2, true);
+            init_cmd(parser, &$$, NULL, NULL, $2, true);
         }
 		/* Error: missing redirect */
 |		'>' error 	  { p_error(MISRED); YYABORT; }
 |		GREATER_GREATER error { p_error(MISRED); YYABORT; }
 
 %%
-static char * inputline;    /* currently processed input line */
+/* The flex scanner reads the line one character at a time */
 #define YY_INPUT(buf,result,max_size) \
     { \
-        result = *inputline ? (buf[0] = *inputline++, 1) : YY_NULL; \
+        char **input = &yyextra->inputline; \
+        result = **input ? (buf[0] = *(*input)++, 1) : YY_NULL; \
     }
 
-#define YY_NO_UNPUT
-#define YY_NO_INPUT
+#define YY_DECL static int flex_lex(YYSTYPE *yylval_param, yyscan_t yyscanner)
 #include "lex.yy.c"
 
+/* Return the next token from the lexer selected for this line */
+static int
+yylex(YYSTYPE *lvalp, struct esh_parser *parser)
+{
+    if (parser->lex_mode == ESH_LEX_FLEX)
+        return flex_lex(lvalp, parser->scanner);
+
+    int token = esh_lex_next(&parser->fast_lexer, &lvalp->word);
+    if (token == ESH_LEX_WORD)
+        return WORD;
+    if (token == ESH_LEX_APPEND)
+        return GREATER_GREATER;
+    if (token == ESH_LEX_HEREDOC)
+        return LESS_LESS;
+    if (token == ESH_LEX_HERESTRING)
+        return LESS_LESS_LESS;
+    return token;
+}
+
 static void
 p_error(char *msg)
 {
@@ -212,28 +308,86 @@ p_error(char *msg)
     fprintf(stderr, "%s\n", msg);
 }
 
-extern int yyparse (void);
-
 /* do not use default error handling since errors are handled above. */
+static void
+yyerror(struct esh_parser *parser, const char *msg) { }
+
+/* Create a parser */
+struct esh_parser *
+esh_parser_create(void)
+{
+    struct esh_parser *parser = malloc(sizeof *parser);
+
+    obstack_init(&parser->words);
+    if (yylex_init_extra(parser, &parser->scanner) != 0) {
+        obstack_free(&parser->words, NULL);
+        free(parser);
+        return NULL;
+    }
+    return parser;
+}
+
+/* Destroy a parser */
 void
-yyerror(const char *msg) { }
+esh_parser_destroy(struct esh_parser *parser)
+{
+    yylex_destroy(parser->scanner);
+    obstack_free(&parser->words, NULL);
+    free(parser);
+}
 
-static struct esh_command_line * commandline;
-static void cmdline_complete(struct esh_command_line *cline)
+/*
+ * parse a commandline using 'parser'.  Lines after the first hold the
+ * bodies of the here-documents it opens, and nothing else.
+ */
+struct esh_command_line *
+esh_parse_command_line_r(struct esh_parser *parser, char * line)
 {
-    commandline = cline;
+    parser->commandline = esh_command_line_create_empty();
+    parser->lex_mode = esh_lex_mode;
+    parser->heredocs = NULL;
+
+    char *nl = strchr(line, '\n');
+    if (nl != NULL) {
+        parser->heredocs = nl + 1;
+        line = obstack_copy0(&parser->commandline->arena, line, nl - line);
+    }
+
+    if (parser->lex_mode == ESH_LEX_FAST) {
+        esh_lex_init(&parser->fast_lexer, &parser->commandline->arena, line);
+    } else {
+        parser->inputline = line;
+        yyrestart(NULL, parser->scanner);
+    }
+
+    int error = yyparse(parser);
+
+    /* Lines no here-document took */
+    if (!error && parser->heredocs != NULL
+        && parser->heredocs[strspn(parser->heredocs, "\n")] != '\0') {
+        p_error(EXTHDOC);
+        error = 1;
+    }
+
+    if (error) {
+        /* discard the argv of the command the error occurred in */
+        obstack_free(&parser->words, obstack_finish(&parser->words));
+        esh_command_line_free(parser->commandline);
+        return NULL;
+    }
+    return parser->commandline;
 }
 
 /*
- * parse a commandline.
+ * parse a commandline with the shell's own parser.
  */
 struct esh_command_line *
 esh_parse_command_line(char * line)
 {
-    inputline = line;
-    commandline = NULL;
-
-    int error = yyparse();
+    static struct esh_parser *parser;
+    if (parser == NULL) {
+        parser = esh_parser_create();
+    }
 
-    return error ? NULL : commandline;
+    return esh_parse_command_line_r(parser, line);
 }
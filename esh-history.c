@@ -0,0 +1,605 @@
+/*
+ * esh-history.c
+ * Persistent command history.
+ *
+ * History is a plain text file, one command per line, to which every
+ * session appends with O_APPEND and one write(2) per line, so that the
+ * lines of concurrent sessions never interleave.  The file is never
+ * read as a whole: it is mapped, readline is given the last few hundred
+ * lines, found by scanning back from the end, and the rest is only
+ * looked at when it is searched.
+ *
+ * Searches use a trigram index, built the first time one is needed and
+ * extended with whatever any session appended since.  The posting list
+ * of a trigram holds the numbers of the lines it occurs in, as varint
+ * encoded deltas, so that most take one byte.  A query decodes the
+ * shortest list among its trigrams and checks the lines in it, newest
+ * first, with memmem(); queries of fewer than three bytes check every
+ * line.  Lines already found in a search are skipped.
+ *
+ * Ctrl-R replaces the line being edited with the most recent command
+ * that contains it, and with older ones when pressed again; Alt-P does
+ * the same for commands that start with it.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <readline/readline.h>
+#include <readline/history.h>
+
+#include "esh-sys-utils.h"
+#include "esh.h"
+
+#define HISTORY_LOAD 500        /* lines given to readline at startup */
+#define HISTORY_LIST 20         /* lines 'history' prints by default */
+
+/* The posting list of one trigram */
+struct posting {
+    uint32_t trigram;           /* bytes of the trigram, plus 1; 0 if unused */
+    uint32_t count;             /* lines in the list */
+    uint32_t last;              /* the last line in the list */
+    uint32_t len, cap;          /* bytes used and allocated in 'data' */
+    uint8_t *data;              /* varint deltas between line numbers */
+};
+
+static char *path;              /* NULL if history is off */
+static int append_fd = -1;
+static char *last_added;        /* not added again right away */
+
+/* The mapped file and its index */
+static const char *map;
+static size_t mapped;
+static dev_t map_dev;
+static ino_t map_ino;
+
+static size_t *lines;           /* offset of each indexed line */
+static uint32_t nlines, lines_cap;
+static size_t indexed;          /* bytes of the file indexed */
+
+static struct posting *table;   /* open addressing, by trigram */
+static uint32_t table_size, table_used;
+static size_t posting_bytes;
+
+/* The search in progress */
+static struct {
+    char *query;
+    size_t len;
+    bool prefix;
+    uint32_t *candidates;       /* lines that may match, ascending */
+    uint32_t ncandidates;
+    bool all;                   /* every line is a candidate */
+    long next;                  /* candidates below this are left */
+    uint64_t *seen;             /* hashes of the lines found */
+    uint32_t seen_size, nseen;
+} search;
+
+/* Return the text and length of indexed line i */
+static const char *
+line_text(uint32_t i, size_t *len)
+{
+    size_t end = i + 1 < nlines ? lines[i + 1] : indexed;
+    *len = end - lines[i] - 1;          /* without the newline */
+    return map + lines[i];
+}
+
+static uint64_t
+line_hash(const char *s, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    while (len-- > 0) {
+        h ^= (unsigned char) *s++;
+        h *= 0x100000001b3ULL;
+    }
+    return h | 1;               /* never 0, which marks free slots */
+}
+
+/* Find the posting list of trigram t, adding it if 'add' */
+static struct posting *
+posting_find(uint32_t t, bool add)
+{
+    uint32_t i;
+
+    if (table_size == 0 && !add)
+        return NULL;
+
+    if (add && (table_used + 1) * 4 > table_size * 3) {
+        struct posting *old = table;
+        uint32_t old_size = table_size;
+
+        table_size = table_size ? table_size * 2 : 4096;
+        table = calloc(table_size, sizeof *table);
+        for (i = 0; i < old_size; i++) {
+            if (old[i].trigram) {
+                uint32_t j = old[i].trigram * 2654435761U & (table_size - 1);
+                while (table[j].trigram)
+                    j = (j + 1) & (table_size - 1);
+                table[j] = old[i];
+            }
+        }
+        free(old);
+    }
+
+    for (i = (t + 1) * 2654435761U & (table_size - 1); table[i].trigram;
+         i = (i + 1) & (table_size - 1))
+        if (table[i].trigram == t + 1)
+            return &table[i];
+
+    if (!add)
+        return NULL;
+    table[i].trigram = t + 1;
+    table_used++;
+    return &table[i];
+}
+
+/* Add line number 'line' to posting list p, unless it is there */
+static void
+posting_add(struct posting *p, uint32_t line)
+{
+    uint32_t delta;
+
+    if (p->count > 0 && p->last == line)
+        return;
+    delta = p->count > 0 ? line - p->last : line;
+
+    if (p->len + 5 > p->cap) {
+        p->cap = p->cap ? p->cap * 2 : 8;
+        p->data = realloc(p->data, p->cap);
+    }
+    posting_bytes -= p->len;
+    while (delta >= 0x80) {
+        p->data[p->len++] = delta | 0x80;
+        delta >>= 7;
+    }
+    p->data[p->len++] = delta;
+    posting_bytes += p->len;
+
+    p->last = line;
+    p->count++;
+}
+
+/* Decode posting list p into 'out', which holds p->count lines */
+static void
+posting_decode(struct posting *p, uint32_t *out)
+{
+    uint32_t i = 0, line = 0, pos = 0;
+
+    while (pos < p->len) {
+        uint32_t delta = 0;
+        int shift = 0;
+        while (p->data[pos] & 0x80) {
+            delta |= (uint32_t) (p->data[pos++] & 0x7f) << shift;
+            shift += 7;
+        }
+        delta |= (uint32_t) p->data[pos++] << shift;
+        line = i == 0 ? delta : line + delta;
+        out[i++] = line;
+    }
+}
+
+static uint32_t
+trigram(const char *s)
+{
+    return (unsigned char) s[0] << 16 | (unsigned char) s[1] << 8
+         | (unsigned char) s[2];
+}
+
+/* Forget the mapping and the index */
+static void
+index_reset(void)
+{
+    uint32_t i;
+
+    if (map != NULL)
+        munmap((void *) map, mapped);
+    map = NULL;
+    mapped = indexed = 0;
+    nlines = 0;
+    for (i = 0; i < table_size; i++) {
+        free(table[i].data);
+        table[i] = (struct posting) { 0 };
+    }
+    table_used = 0;
+    posting_bytes = 0;
+}
+
+/* Map the file again if it grew or was replaced.  Returns false if it
+ * cannot be read. */
+static bool
+refresh_map(void)
+{
+    struct stat st;
+
+    if (stat(path, &st) == -1)
+        return errno == ENOENT;
+
+    if (map != NULL && (st.st_dev != map_dev || st.st_ino != map_ino
+                        || (size_t) st.st_size < mapped))
+        index_reset();
+    if ((size_t) st.st_size == mapped)
+        return true;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    void *m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED)
+        return false;
+
+    if (map != NULL)
+        munmap((void *) map, mapped);
+    map = m;
+    mapped = st.st_size;
+    map_dev = st.st_dev;
+    map_ino = st.st_ino;
+    return true;
+}
+
+/* Index the complete lines appended since the last call */
+static bool
+index_update(void)
+{
+    if (!refresh_map())
+        return false;
+
+    const char *nl;
+    while (indexed < mapped
+           && (nl = memchr(map + indexed, '\n', mapped - indexed)) != NULL) {
+        size_t start = indexed, end = nl - map, j;
+
+        if (nlines == lines_cap) {
+            lines_cap = lines_cap ? lines_cap * 2 : 1024;
+            lines = realloc(lines, lines_cap * sizeof *lines);
+        }
+        lines[nlines] = start;
+        for (j = start; j + 3 <= end; j++)
+            posting_add(posting_find(trigram(map + j), true), nlines);
+        nlines++;
+        indexed = end + 1;
+    }
+    return true;
+}
+
+/* Remember that a line with hash h was found; returns false if it was
+ * found before */
+static bool
+search_remember(uint64_t h)
+{
+    uint32_t i;
+
+    if ((search.nseen + 1) * 2 > search.seen_size) {
+        uint64_t *old = search.seen;
+        uint32_t old_size = search.seen_size;
+
+        search.seen_size = old_size ? old_size * 2 : 256;
+        search.seen = calloc(search.seen_size, sizeof *search.seen);
+        for (i = 0; i < old_size; i++) {
+            if (old[i]) {
+                uint32_t j = old[i] & (search.seen_size - 1);
+                while (search.seen[j])
+                    j = (j + 1) & (search.seen_size - 1);
+                search.seen[j] = old[i];
+            }
+        }
+        free(old);
+    }
+
+    for (i = h & (search.seen_size - 1); search.seen[i];
+         i = (i + 1) & (search.seen_size - 1))
+        if (search.seen[i] == h)
+            return false;
+    search.seen[i] = h;
+    search.nseen++;
+    return true;
+}
+
+/* Start a search for lines that contain 'query', or start with it if
+ * 'prefix' */
+static void
+search_start(const char *query, bool prefix)
+{
+    size_t j;
+
+    free(search.query);
+    free(search.candidates);
+    free(search.seen);
+    memset(&search, 0, sizeof search);
+    search.query = strdup(query);
+    search.len = strlen(query);
+    search.prefix = prefix;
+
+    if (!index_update())
+        return;
+
+    if (search.len < 3) {
+        search.all = true;
+        search.next = nlines;
+        return;
+    }
+
+    /* Every matching line is on the list of each trigram of the query */
+    struct posting *shortest = NULL;
+    for (j = 0; j + 3 <= search.len; j++) {
+        struct posting *p = posting_find(trigram(query + j), false);
+        if (p == NULL)
+            return;             /* nothing matches */
+        if (shortest == NULL || p->count < shortest->count)
+            shortest = p;
+    }
+    search.candidates = malloc(shortest->count * sizeof *search.candidates);
+    search.ncandidates = shortest->count;
+    posting_decode(shortest, search.candidates);
+    search.next = search.ncandidates;
+}
+
+/* Find the next older line that matches the search and was not found
+ * before.  Returns false if there is none. */
+static bool
+search_next(const char **text, size_t *len)
+{
+    while (search.next > 0) {
+        search.next--;
+        uint32_t i = search.all ? search.next
+                   : search.candidates[search.next];
+        const char *s = line_text(i, len);
+
+        if (search.prefix ? *len >= search.len
+                            && !memcmp(s, search.query, search.len)
+                          : memmem(s, *len, search.query, search.len) != NULL) {
+            if (search_remember(line_hash(s, *len))) {
+                *text = s;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* Readline command: replace the line with the next match.  Pressed
+ * again right away, it continues the same search. */
+static int
+search_key(rl_command_func_t *self, bool prefix)
+{
+    const char *text;
+    size_t len;
+
+    if (rl_last_func != self)
+        search_start(rl_line_buffer, prefix);
+
+    if (!search_next(&text, &len)) {
+        rl_ding();
+        return 0;
+    }
+
+    char *line = strndup(text, len);
+    rl_replace_line(line, 0);
+    rl_point = rl_end;
+    free(line);
+    return 0;
+}
+
+static int
+search_substring(int count, int key)
+{
+    return search_key(search_substring, false);
+}
+
+static int
+search_prefix(int count, int key)
+{
+    return search_key(search_prefix, true);
+}
+
+/* Give readline the last HISTORY_LOAD lines of the file */
+static void
+load_recent(void)
+{
+    size_t p = mapped, newlines = 0;
+
+    /* Only the tail of the file is touched */
+    while (p > 0 && !(map[p - 1] == '\n' && ++newlines > HISTORY_LOAD))
+        p--;
+    while (p < mapped) {
+        const char *nl = memchr(map + p, '\n', mapped - p);
+        if (nl == NULL)
+            break;              /* still being written */
+        char *line = strndup(map + p, nl - (map + p));
+        add_history(line);
+        free(line);
+        p = nl - map + 1;
+    }
+}
+
+/*
+ * Keep history in file 'path', appending to it and loading its most
+ * recent lines into readline, and bind Ctrl-R and Alt-P to search it.
+ * Returns false if the file cannot be opened.
+ */
+bool
+esh_history_open(const char *file)
+{
+    append_fd = open(file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (append_fd == -1)
+        return false;
+    path = strdup(file);
+
+    using_history();
+    stifle_history(HISTORY_LOAD * 2);
+    if (refresh_map())
+        load_recent();
+
+    rl_add_defun("esh-history-search", search_substring, CTRL('R'));
+    rl_add_defun("esh-history-search-prefix", search_prefix, -1);
+    rl_bind_keyseq("\\ep", search_prefix);
+    return true;
+}
+
+/* Lock the history file with flock operation 'op', first reopening it
+ * if it was replaced by 'history -c' in some session, since a lock on
+ * the old file excludes nobody.  Returns false if it cannot be opened. */
+static bool
+lock_file(int op)
+{
+    struct stat st;
+
+    for (;;) {
+        flock(append_fd, op);
+        if (fstat(append_fd, &st) == 0 && st.st_nlink > 0)
+            return true;
+        close(append_fd);       /* closing unlocks */
+        append_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                         0600);
+        if (append_fd == -1)
+            return false;
+    }
+}
+
+/* Write 'data' to the history file.  Holds a shared lock, so that it
+ * is not replaced during the write. */
+static void
+append_line(const char *data, size_t len)
+{
+    if (!lock_file(LOCK_SH))
+        return;
+    if (write(append_fd, data, len) != (ssize_t) len)
+        esh_sys_error("esh: history: %s: ", path);
+    flock(append_fd, LOCK_UN);
+}
+
+/*
+ * Add a command line to the history, unless it is empty, starts with
+ * a space (which keeps it private) or repeats the previous one.
+ */
+void
+esh_history_add(const char *line)
+{
+    if (path == NULL || *line == '\0' || *line == ' ' || strchr(line, '\n')
+        || (last_added != NULL && !strcmp(line, last_added)))
+        return;
+
+    free(last_added);
+    last_added = strdup(line);
+    add_history(line);
+
+    size_t len = strlen(line);
+    char buf[len + 1];
+    memcpy(buf, line, len);
+    buf[len] = '\n';
+    append_line(buf, len + 1);
+}
+
+/* Print the last 'n' lines with their numbers, or the last
+ * HISTORY_LIST if 'n' is negative */
+void
+esh_history_print(long n)
+{
+    uint32_t i;
+
+    if (path == NULL || !index_update())
+        return;
+    if (n < 0)
+        n = HISTORY_LIST;
+    for (i = n < nlines ? nlines - n : 0; i < nlines; i++) {
+        size_t len;
+        const char *s = line_text(i, &len);
+        printf("%6u  %.*s\n", i + 1, (int) len, s);
+    }
+}
+
+/* Print the lines that contain 'query' (or start with it if 'prefix'),
+ * newest first, each only once.  Returns the number printed. */
+long
+esh_history_search(const char *query, bool prefix)
+{
+    const char *s;
+    size_t len;
+    long found = 0;
+
+    if (path == NULL)
+        return 0;
+    search_start(query, prefix);
+    while (search_next(&s, &len)) {
+        printf("%.*s\n", (int) len, s);
+        found++;
+    }
+    return found;
+}
+
+/*
+ * Rewrite the history file with only the most recent copy of each
+ * line.  Sessions that append meanwhile wait for it, and then append
+ * to the new file.  Returns false on failure.
+ */
+bool
+esh_history_compact(void)
+{
+    uint32_t i, nkeep = 0;
+
+    if (path == NULL)
+        return false;
+
+    if (!lock_file(LOCK_EX))
+        return false;
+    if (!index_update()) {
+        flock(append_fd, LOCK_UN);
+        return false;
+    }
+
+    /* Keep the newest copy of each line, in their original order */
+    uint32_t *keep = malloc((nlines + 1) * sizeof *keep);
+    search_start("", false);
+    for (i = nlines; i-- > 0; ) {
+        size_t len;
+        const char *s = line_text(i, &len);
+        if (search_remember(line_hash(s, len)))
+            keep[nkeep++] = i;
+    }
+
+    char tmp[strlen(path) + 32];
+    snprintf(tmp, sizeof tmp, "%s.%d.tmp", path, (int) getpid());
+    /* Only the user may read it, as the file it replaces */
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    FILE *out = fd != -1 ? fdopen(fd, "w") : NULL;
+    if (out == NULL && fd != -1) {
+        close(fd);
+        unlink(tmp);
+    }
+    bool ok = out != NULL;
+    while (ok && nkeep-- > 0) {
+        size_t len;
+        const char *s = line_text(keep[nkeep], &len);
+        ok = fwrite(s, 1, len + 1, out) == len + 1;
+    }
+    free(keep);
+    if (out != NULL && (fclose(out) != 0 || !ok || rename(tmp, path) != 0)) {
+        unlink(tmp);
+        ok = false;
+    }
+
+    /* Closing the old file unlocks it; appends now go to the new one */
+    close(append_fd);
+    append_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    return ok && append_fd != -1;
+}
+
+/* Print the history file, its size and that of its index */
+void
+esh_history_print_info(void)
+{
+    if (path == NULL) {
+        printf("history off\n");
+        return;
+    }
+    index_update();
+    printf("history %s, %zu bytes, %u lines\n", path, mapped, nlines);
+    printf("index %u trigrams, %zu bytes of postings\n", table_used,
+           posting_bytes);
+}
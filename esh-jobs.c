@@ -0,0 +1,479 @@
+/*
+ * esh-jobs.c
+ * The job table.
+ *
+ * Jobs are kept on current_jobs in the order they were started, which is
+ * the order in which 'jobs' lists them.  In addition, jobs are indexed by
+ * job id and by process group, and their commands by pid, so that none
+ * of the lookups done when a child is reaped has to scan the job list.
+ *
+ * Children are reaped with wait4(2), and the resources each process used
+ * are kept on its command and added up on its job.  The last few jobs
+ * that completed are kept, so that 'jobs -v' can show them.
+ *
+ * Every change to the table is also copied to the shared memory
+ * snapshot, if it is on (see esh-snapshot.c).
+ */
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "esh.h"
+
+/* List of current jobs */
+struct list current_jobs;
+
+/* Most recently assigned job id */
+int jid;
+
+/* How many completed jobs are kept */
+#define JOB_HISTORY 10
+
+/* Copies of the most recently completed jobs, oldest first */
+static struct list completed_jobs;
+static int ncompleted;
+
+static struct hash jobs_by_jid;     /* <esh_pipeline> by jid */
+static struct hash jobs_by_pgrp;    /* <esh_pipeline> by pgrp */
+static struct hash cmds_by_pid;     /* <esh_command> by pid, live only */
+
+static unsigned
+job_jid_hash(const struct hash_elem *e, void *aux)
+{
+    return hash_int(hash_entry(e, struct esh_pipeline, jid_elem)->jid);
+}
+
+static bool
+job_jid_less(const struct hash_elem *a, const struct hash_elem *b, void *aux)
+{
+    return hash_entry(a, struct esh_pipeline, jid_elem)->jid
+         < hash_entry(b, struct esh_pipeline, jid_elem)->jid;
+}
+
+static unsigned
+job_pgrp_hash(const struct hash_elem *e, void *aux)
+{
+    return hash_int(hash_entry(e, struct esh_pipeline, pgrp_elem)->pgrp);
+}
+
+static bool
+job_pgrp_less(const struct hash_elem *a, const struct hash_elem *b, void *aux)
+{
+    return hash_entry(a, struct esh_pipeline, pgrp_elem)->pgrp
+         < hash_entry(b, struct esh_pipeline, pgrp_elem)->pgrp;
+}
+
+static unsigned
+cmd_pid_hash(const struct hash_elem *e, void *aux)
+{
+    return hash_int(hash_entry(e, struct esh_command, pid_elem)->pid);
+}
+
+static bool
+cmd_pid_less(const struct hash_elem *a, const struct hash_elem *b, void *aux)
+{
+    return hash_entry(a, struct esh_command, pid_elem)->pid
+         < hash_entry(b, struct esh_command, pid_elem)->pid;
+}
+
+/* Initialize the job table */
+void
+esh_jobs_init(void)
+{
+    list_init(&current_jobs);
+    hash_init(&jobs_by_jid, job_jid_hash, job_jid_less, NULL);
+    hash_init(&jobs_by_pgrp, job_pgrp_hash, job_pgrp_less, NULL);
+    hash_init(&cmds_by_pid, cmd_pid_hash, cmd_pid_less, NULL);
+    list_init(&completed_jobs);
+    ncompleted = 0;
+    jid = 0;
+}
+
+/* Return the list of current jobs */
+struct list *
+esh_get_jobs(void)
+{
+    return &current_jobs;
+}
+
+/* Return the most recently completed jobs, oldest first */
+struct list *
+esh_get_completed_jobs(void)
+{
+    return &completed_jobs;
+}
+
+/* Return job corresponding to jid, or NULL */
+struct esh_pipeline *
+esh_get_job_from_jid(int jid)
+{
+    struct esh_pipeline key = { .jid = jid };
+    struct hash_elem *e = hash_find(&jobs_by_jid, &key.jid_elem);
+    return e ? hash_entry(e, struct esh_pipeline, jid_elem) : NULL;
+}
+
+/* Return job corresponding to pgrp, or NULL */
+struct esh_pipeline *
+esh_get_job_from_pgrp(pid_t pgrp)
+{
+    struct esh_pipeline key = { .pgrp = pgrp };
+    struct hash_elem *e = hash_find(&jobs_by_pgrp, &key.pgrp_elem);
+    return e ? hash_entry(e, struct esh_pipeline, pgrp_elem) : NULL;
+}
+
+/* Return the command of a current job whose process is pid, or NULL */
+struct esh_command *
+esh_get_cmd_from_pid(pid_t pid)
+{
+    struct esh_command key = { .pid = pid };
+    struct hash_elem *e = hash_find(&cmds_by_pid, &key.pid_elem);
+    return e ? hash_entry(e, struct esh_command, pid_elem) : NULL;
+}
+
+/*
+ * Add a freshly started pipeline to the job table and assign its job id.
+ * Its pgrp and the pids of its commands must be set; commands with a
+ * pid of 0 were not started and count as completed.
+ */
+void
+esh_job_add(struct esh_pipeline *job)
+{
+    struct list_elem *e;
+
+    if (list_empty(&current_jobs)) {
+        jid = 0;
+    }
+    job->jid = ++jid;
+    clock_gettime(CLOCK_MONOTONIC, &job->started);
+    job->finished = (struct timespec) { 0, 0 };
+    memset(&job->rusage, 0, sizeof job->rusage);
+
+    list_push_back(&current_jobs, &job->elem);
+    hash_insert(&jobs_by_jid, &job->jid_elem);
+    hash_insert(&jobs_by_pgrp, &job->pgrp_elem);
+
+    for (e = list_begin(&job->commands); e != list_end(&job->commands);
+         e = list_next(e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        cmd->completed = cmd->pid == 0;
+        cmd->stopped = false;
+        memset(&cmd->rusage, 0, sizeof cmd->rusage);
+        if (!cmd->completed) {
+            hash_insert(&cmds_by_pid, &cmd->pid_elem);
+        }
+    }
+    esh_snapshot_update();
+}
+
+/* Remove a job from the job table.  The job is not deallocated. */
+void
+esh_job_remove(struct esh_pipeline *job)
+{
+    struct list_elem *e;
+
+    list_remove(&job->elem);
+    hash_delete(&jobs_by_jid, &job->jid_elem);
+    hash_delete(&jobs_by_pgrp, &job->pgrp_elem);
+
+    for (e = list_begin(&job->commands); e != list_end(&job->commands);
+         e = list_next(e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        if (!cmd->completed) {
+            hash_delete(&cmds_by_pid, &cmd->pid_elem);
+        }
+    }
+
+    if (list_empty(&current_jobs)) {
+        jid = 0;
+    }
+}
+
+/* Return true if every process of a job that has not terminated
+ * is stopped */
+bool
+esh_job_is_stopped(struct esh_pipeline *job)
+{
+    struct list_elem *e;
+    for (e = list_begin(&job->commands); e != list_end(&job->commands);
+         e = list_next(e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        if (!cmd->completed && !cmd->stopped) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Continue a job by sending SIGCONT to its process group, and mark
+ * it as running with the given status (FOREGROUND or BACKGROUND).
+ * Returns false if the signal could not be sent.
+ */
+bool
+esh_job_resume(struct esh_pipeline *job, enum job_status status)
+{
+    struct list_elem *e;
+    for (e = list_begin(&job->commands); e != list_end(&job->commands);
+         e = list_next(e)) {
+        list_entry(e, struct esh_command, elem)->stopped = false;
+    }
+
+    job->status = status;
+    esh_snapshot_update();
+    return kill(-job->pgrp, SIGCONT) == 0;
+}
+
+/* Print the command line of a job as '(argv | argv ...)' */
+void
+esh_job_print_commands(struct esh_pipeline *pipeline)
+{
+    printf("(");
+
+    struct list_elem *e;
+    for (e = list_begin(&pipeline->commands); e != list_end(&pipeline->commands); e = list_next(e)) {
+
+        struct esh_command *command = list_entry(e, struct esh_command, elem);
+
+        char **argv = command->argv;
+        while (*argv) {
+            printf("%s ", *argv);
+            argv++;
+        }
+
+        if (list_size(&pipeline->commands) > 1) {
+            printf("| ");
+        }
+    }
+
+    printf(")\n");
+    fflush(stdout);
+}
+
+/* Add the resources in 'b' to those in 'a'.  The maximum resident set
+ * size of a job is that of its largest process. */
+static void
+rusage_add(struct rusage *a, const struct rusage *b)
+{
+    timeradd(&a->ru_utime, &b->ru_utime, &a->ru_utime);
+    timeradd(&a->ru_stime, &b->ru_stime, &a->ru_stime);
+    if (b->ru_maxrss > a->ru_maxrss) {
+        a->ru_maxrss = b->ru_maxrss;
+    }
+    a->ru_minflt += b->ru_minflt;
+    a->ru_majflt += b->ru_majflt;
+    a->ru_nvcsw += b->ru_nvcsw;
+    a->ru_nivcsw += b->ru_nivcsw;
+}
+
+/* Keep a copy of a job that completed, forgetting the oldest one */
+static void
+remember_completed(struct esh_pipeline *job)
+{
+    list_push_back(&completed_jobs, &esh_pipeline_copy(job)->elem);
+    if (++ncompleted > JOB_HISTORY) {
+        esh_pipeline_free(list_entry(list_pop_front(&completed_jobs),
+                                     struct esh_pipeline, elem));
+        ncompleted--;
+    }
+}
+
+/* Record a status change of process pid; see esh_job_change_status() */
+static struct esh_pipeline *
+job_change_status(pid_t pid, int status, const struct rusage *rusage)
+{
+    struct esh_command *cmd = esh_get_cmd_from_pid(pid);
+    if (cmd == NULL) {
+        return NULL;
+    }
+
+    struct esh_pipeline *pipeline = cmd->pipeline;
+
+    cmd->status = status;
+
+    if (WIFSTOPPED(status)) {
+        cmd->stopped = true;
+
+        if (pipeline->status != STOPPED && WSTOPSIG(status) != SIGTTOU) {
+            printf("\n[%d]+ Stopped      ", pipeline->jid);
+            esh_job_print_commands(pipeline);
+        }
+        pipeline->status = STOPPED;
+        return NULL;
+    }
+
+    if (!WIFEXITED(status) && !WIFSIGNALED(status)) {
+        return NULL;
+    }
+
+    hash_delete(&cmds_by_pid, &cmd->pid_elem);
+    cmd->completed = true;
+    if (rusage) {
+        cmd->rusage = *rusage;
+        rusage_add(&pipeline->rusage, rusage);
+    }
+
+    struct list_elem *e;
+    for (e = list_begin(&pipeline->commands); e != list_end(&pipeline->commands);
+         e = list_next(e)) {
+        if (!list_entry(e, struct esh_command, elem)->completed) {
+            return NULL;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &pipeline->finished);
+    esh_job_remove(pipeline);
+    remember_completed(pipeline);
+    return pipeline;
+}
+
+/*
+ * Record a status change of process pid, as reported by wait4(2).
+ * A job that stops is reported.  Once all of its processes have
+ * terminated, a job is removed from the table and returned; the
+ * caller must deallocate it.  Otherwise, returns NULL.
+ */
+struct esh_pipeline *
+esh_job_change_status(pid_t pid, int status, const struct rusage *rusage)
+{
+    struct esh_pipeline *done = job_change_status(pid, status, rusage);
+    esh_snapshot_update();
+    return done;
+}
+
+/* Return how long a job has run, or ran if it completed, in seconds */
+double
+esh_job_wall_time(struct esh_pipeline *job)
+{
+    struct timespec end = job->finished;
+    if (end.tv_sec == 0 && end.tv_nsec == 0) {      /* still running */
+        clock_gettime(CLOCK_MONOTONIC, &end);
+    }
+    return end.tv_sec - job->started.tv_sec
+         + (end.tv_nsec - job->started.tv_nsec) / 1e9;
+}
+
+static double
+seconds(struct timeval tv)
+{
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Print real, user and sys time to stderr, as 'time' does */
+void
+esh_print_time(double real, const struct rusage *rusage)
+{
+    fprintf(stderr, "real %.3fs  user %.3fs  sys %.3fs\n", real,
+            seconds(rusage->ru_utime), seconds(rusage->ru_stime));
+}
+
+/*
+ * Get the resources used so far by a live process from /proc.  Its
+ * current resident set size stands in for the maximum, and context
+ * switches are not counted.  Returns false if pid is gone.
+ */
+static bool
+proc_rusage(pid_t pid, struct rusage *rusage)
+{
+    char path[64], buf[1024];
+    unsigned long minflt, majflt, utime, stime;
+    long rss;
+
+    snprintf(path, sizeof path, "/proc/%d/stat", (int) pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return false;
+    }
+    char *p = fgets(buf, sizeof buf, f) ? strrchr(buf, ')') : NULL;
+    fclose(f);
+
+    /* Fields 3 to 24 of proc(5), after the command name */
+    if (p == NULL || sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %lu %*u "
+                            "%lu %*u %lu %lu %*d %*d %*d %*d %*d %*d %*u "
+                            "%*u %ld", &minflt, &majflt, &utime, &stime,
+                            &rss) != 5) {
+        return false;
+    }
+
+    long ticks = sysconf(_SC_CLK_TCK);
+    memset(rusage, 0, sizeof *rusage);
+    rusage->ru_utime.tv_sec = utime / ticks;
+    rusage->ru_utime.tv_usec = utime % ticks * 1000000 / ticks;
+    rusage->ru_stime.tv_sec = stime / ticks;
+    rusage->ru_stime.tv_usec = stime % ticks * 1000000 / ticks;
+    rusage->ru_maxrss = rss * (sysconf(_SC_PAGESIZE) / 1024);
+    rusage->ru_minflt = minflt;
+    rusage->ru_majflt = majflt;
+    return true;
+}
+
+static void
+print_rusage(const struct rusage *rusage)
+{
+    printf("user %.3fs sys %.3fs rss %ld KB faults %ld/%ld csw %ld/%ld",
+           seconds(rusage->ru_utime), seconds(rusage->ru_stime),
+           rusage->ru_maxrss, rusage->ru_minflt, rusage->ru_majflt,
+           rusage->ru_nvcsw, rusage->ru_nivcsw);
+}
+
+/*
+ * Print the resources used by a job, then those of each of its
+ * processes with its state, e.g.
+ *     real 1.500s user 1.200s sys 0.010s rss 2048 KB faults 120/0 csw 3/40
+ *     1234 exit 0     user 1.200s ... (sort big)
+ * Processes that are still running are looked up in /proc.  Faults
+ * are minor/major, and context switches voluntary/involuntary.
+ */
+void
+esh_job_print_usage(struct esh_pipeline *job)
+{
+    int n = list_size(&job->commands), i = 0;
+    struct rusage total = job->rusage, live[n];
+    bool alive[n];
+    struct list_elem *e;
+
+    for (e = list_begin(&job->commands); e != list_end(&job->commands);
+         e = list_next(e), i++) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        alive[i] = !cmd->completed && proc_rusage(cmd->pid, &live[i]);
+        if (alive[i]) {
+            rusage_add(&total, &live[i]);
+        }
+    }
+
+    printf("    real %.3fs ", esh_job_wall_time(job));
+    print_rusage(&total);
+    printf("\n");
+
+    i = 0;
+    for (e = list_begin(&job->commands); e != list_end(&job->commands);
+         e = list_next(e), i++) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        char state[32];
+        const struct rusage *rusage = &cmd->rusage;
+
+        if (cmd->pid == 0) {
+            continue;           /* never started */
+        } else if (!cmd->completed) {
+            snprintf(state, sizeof state, cmd->stopped ? "stopped" : "running");
+            rusage = alive[i] ? &live[i] : NULL;
+        } else if (WIFSIGNALED(cmd->status)) {
+            snprintf(state, sizeof state, "signal %d", WTERMSIG(cmd->status));
+        } else {
+            snprintf(state, sizeof state, "exit %d", WEXITSTATUS(cmd->status));
+        }
+
+        printf("    %-7d %-10s ", cmd->pid, state);
+        if (rusage) {
+            print_rusage(rusage);
+        }
+        printf(" (");
+        char **argv;
+        for (argv = cmd->argv; *argv; argv++) {
+            printf("%s%s", *argv, argv[1] ? " " : "");
+        }
+        printf(")\n");
+    }
+}
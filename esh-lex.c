@@ -0,0 +1,280 @@
+/*
+ * esh-lex.c
+ * A lexer that scans a whole command line at once.
+ *
+ * It recognizes the same tokens as the flex scanner in esh-grammar.l,
+ * but instead of copying each word it works on a private copy of the
+ * line, allocated from the command line's arena: words are terminated
+ * in place and handed to the parser as pointers into that copy.
+ *
+ * Finding the end of a word is the hot loop.  It is done 16 or 32
+ * bytes at a time with SSE2 or AVX2 where available, and with a table
+ * lookup otherwise.  The copy is padded with zeros so that vector loads
+ * never reach past its end.
+ */
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "esh.h"
+
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
+
+/* Largest vector size used, and thus the padding behind the line */
+#define LEX_PADDING 32
+
+/* Characters that end a word: blanks, metacharacters and the NUL
+ * that ends the line. */
+#define LEX_SPECIALS " \t\n|&;<>"
+
+enum esh_lex_mode esh_lex_mode;
+
+/* Finds the first character of p that ends a word */
+typedef char * (* find_special_t)(char *p);
+
+static char *find_special_scalar(char *p);
+static find_special_t find_special = find_special_scalar;
+
+static bool special[256];
+
+static char *
+find_special_scalar(char *p)
+{
+    while (!special[(unsigned char) *p])
+        p++;
+    return p;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static char *
+find_special_sse2(char *p)
+{
+    const __m128i blank = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'),
+        nl = _mm_set1_epi8('\n'), bar = _mm_set1_epi8('|'),
+        amp = _mm_set1_epi8('&'), semi = _mm_set1_epi8(';'),
+        lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>'),
+        nul = _mm_setzero_si128();
+
+    for (;; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, blank), _mm_cmpeq_epi8(v, tab)),
+                _mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, bar))),
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, semi)),
+                _mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, gt))));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, nul));
+
+        int mask = _mm_movemask_epi8(m);
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+}
+
+__attribute__((target("avx2")))
+static char *
+find_special_avx2(char *p)
+{
+    const __m256i blank = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t'),
+        nl = _mm256_set1_epi8('\n'), bar = _mm256_set1_epi8('|'),
+        amp = _mm256_set1_epi8('&'), semi = _mm256_set1_epi8(';'),
+        lt = _mm256_set1_epi8('<'), gt = _mm256_set1_epi8('>'),
+        nul = _mm256_setzero_si256();
+
+    for (;; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, blank),
+                                _mm256_cmpeq_epi8(v, tab)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, nl),
+                                _mm256_cmpeq_epi8(v, bar))),
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, amp),
+                                _mm256_cmpeq_epi8(v, semi)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, lt),
+                                _mm256_cmpeq_epi8(v, gt))));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, nul));
+
+        unsigned mask = _mm256_movemask_epi8(m);
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+}
+#endif /* HAVE_X86_SIMD */
+
+/* Select the lexer by name; see esh_lex_set_mode() */
+static bool
+select_mode(const char *name)
+{
+    if (!strcmp(name, "flex")) {
+        esh_lex_mode = ESH_LEX_FLEX;
+        return true;
+    }
+
+    find_special_t scan = NULL;
+    if (!strcmp(name, "scalar"))
+        scan = find_special_scalar;
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    bool has_sse2 = __builtin_cpu_supports("sse2");
+    bool has_avx2 = __builtin_cpu_supports("avx2");
+
+    if (!strcmp(name, "sse2") && has_sse2)
+        scan = find_special_sse2;
+    else if (!strcmp(name, "avx2") && has_avx2)
+        scan = find_special_avx2;
+    else if (!strcmp(name, "auto"))
+        scan = has_avx2 ? find_special_avx2
+             : has_sse2 ? find_special_sse2 : find_special_scalar;
+#else
+    if (!strcmp(name, "auto"))
+        scan = find_special_scalar;
+#endif
+
+    if (scan == NULL)
+        return false;
+
+    esh_lex_mode = ESH_LEX_FAST;
+    find_special = scan;
+    return true;
+}
+
+/* Fill the table of specials and pick the best scanner */
+static void
+lex_setup_once(void)
+{
+    const char *s;
+    for (s = LEX_SPECIALS; *s; s++)
+        special[(unsigned char) *s] = true;
+    special[0] = true;
+
+    select_mode("auto");
+}
+
+static void
+lex_setup(void)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, lex_setup_once);
+}
+
+/*
+ * Select the lexer by name: "flex", "scalar", "sse2", "avx2", or
+ * "auto" for the fastest one the CPU supports.  Returns false if the
+ * name is unknown or not supported on this CPU.
+ */
+bool
+esh_lex_set_mode(const char *name)
+{
+    lex_setup();
+    return select_mode(name);
+}
+
+/* Prepare lx to scan 'line', copying it into 'arena' */
+void
+esh_lex_init(struct esh_lexer *lx, struct obstack *arena, const char *line)
+{
+    lex_setup();
+
+    size_t len = strlen(line);
+    char *copy = obstack_alloc(arena, len + 1 + LEX_PADDING);
+    memcpy(copy, line, len);
+    memset(copy + len, 0, 1 + LEX_PADDING);
+
+    lx->pos = copy;
+    lx->pending = 0;
+}
+
+/*
+ * Return the next token: 0 at the end of the line, ESH_LEX_WORD with
+ * *word set, ESH_LEX_APPEND for '>>', ESH_LEX_HEREDOC for '<<',
+ * ESH_LEX_HERESTRING for '<<<', or the metacharacter itself.
+ *
+ * A word is terminated by overwriting the character that follows it
+ * with a NUL; if that character is a metacharacter, it is remembered
+ * and returned by the next call.
+ */
+int
+esh_lex_next(struct esh_lexer *lx, char **word)
+{
+    int c = lx->pending;
+    lx->pending = 0;
+
+    if (c == 0) {
+        while (*lx->pos == ' ' || *lx->pos == '\t')
+            lx->pos++;
+
+        c = (unsigned char) *lx->pos;
+        if (c == 0)
+            return 0;
+
+        if (!special[c]) {
+            char *end = find_special(lx->pos);
+            *word = lx->pos;
+
+            c = (unsigned char) *end;
+            *end = '\0';
+            lx->pos = c ? end + 1 : end;
+            if (c != ' ' && c != '\t')
+                lx->pending = c;
+            return ESH_LEX_WORD;
+        }
+        lx->pos++;
+    }
+
+    if (c == '>' && *lx->pos == '>') {
+        lx->pos++;
+        return ESH_LEX_APPEND;
+    }
+    if (c == '<' && *lx->pos == '<') {
+        lx->pos++;
+        if (*lx->pos == '<') {
+            lx->pos++;
+            return ESH_LEX_HERESTRING;
+        }
+        return ESH_LEX_HEREDOC;
+    }
+    return c;
+}
+
+/*
+ * Return the number of here-documents command line 'line' opens, and
+ * store the words that end them, in order, in a malloc'd array in
+ * *words, each malloc'd too.  The body of each here-document is made
+ * of the lines read after the command line up to one that holds only
+ * its word.
+ */
+size_t
+esh_lex_heredoc_words(const char *line, char ***words)
+{
+    struct obstack arena;
+    struct esh_lexer lx;
+    char *word;
+    int token;
+    size_t n = 0;
+
+    *words = NULL;
+    if (strstr(line, "<<") == NULL)
+        return 0;
+
+    obstack_init(&arena);
+    esh_lex_init(&lx, &arena, line);
+    while ((token = esh_lex_next(&lx, &word)) != 0) {
+        if (token != ESH_LEX_HEREDOC)
+            continue;
+        if (esh_lex_next(&lx, &word) != ESH_LEX_WORD)
+            break;              /* a syntax error, reported by the parser */
+        *words = realloc(*words, (n + 1) * sizeof **words);
+        (*words)[n++] = strdup(word);
+    }
+    obstack_free(&arena, NULL);
+    return n;
+}
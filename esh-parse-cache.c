@@ -0,0 +1,230 @@
+/*
+ * esh-parse-cache.c
+ * Remember parsed command lines, so that lines that are entered again
+ * and again need not be lexed and parsed each time.
+ *
+ * The cache maps the text of a line to the pipelines it parsed to.
+ * Each pipeline is kept as a self-contained block made by
+ * esh_pipeline_copy(); these templates are never executed or modified.
+ * A hit returns a new command line holding duplicates of them, each
+ * made by one memcpy and a pass over its pointers.  The cache is
+ * bounded and evicts the least recently used line.  Lines with syntax
+ * errors are not cached, so that their error is reported every time.
+ * Neither are very long lines, which hold here-documents: they would
+ * be copied twice to be kept, and are rarely entered again.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hash.h"
+#include "esh.h"
+
+#define PARSE_CACHE_DEFAULT_LIMIT 256
+#define PARSE_CACHE_MAX_LINE 4096   /* longest line cached, in bytes */
+
+/* A pipeline of a cached line */
+struct parse_template {
+    struct esh_pipeline *pipe;  /* made by esh_pipeline_copy() */
+    size_t size;                /* size of its block */
+};
+
+struct parse_entry {
+    struct hash_elem elem;      /* Link element for parse_cache */
+    struct list_elem lru_elem;  /* Link element for parse_lru */
+    unsigned hash;              /* hash of line */
+    size_t len;                 /* length of line */
+    char *line;                 /* the raw command line */
+    int npipes;
+    struct parse_template *pipes;   /* what it parsed to */
+};
+
+static struct hash parse_cache;
+static bool parse_cache_initialized;
+
+/* Entries, most recently used first */
+static struct list parse_lru;
+
+static size_t parse_limit = PARSE_CACHE_DEFAULT_LIMIT;
+static unsigned long parse_hits, parse_misses, parse_evictions;
+
+static unsigned
+parse_entry_hash(const struct hash_elem *e, void *aux)
+{
+    return hash_entry(e, struct parse_entry, elem)->hash;
+}
+
+/* Order by hash and length first, so that the text of different
+ * lines rarely needs to be compared */
+static bool
+parse_entry_less(const struct hash_elem *a_, const struct hash_elem *b_,
+                 void *aux)
+{
+    struct parse_entry *a = hash_entry(a_, struct parse_entry, elem);
+    struct parse_entry *b = hash_entry(b_, struct parse_entry, elem);
+
+    if (a->hash != b->hash)
+        return a->hash < b->hash;
+    if (a->len != b->len)
+        return a->len < b->len;
+    return memcmp(a->line, b->line, a->len) < 0;
+}
+
+/* Hash a line 8 bytes at a time */
+static unsigned
+line_hash(const char *s, size_t len)
+{
+    uint64_t h = len * 0x9e3779b97f4a7c15ULL, w;
+
+    for (; len >= 8; s += 8, len -= 8) {
+        memcpy(&w, s, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    w = 0;
+    memcpy(&w, s, len);
+    h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 29);
+}
+
+static void
+parse_cache_init(void)
+{
+    if (!parse_cache_initialized) {
+        hash_init(&parse_cache, parse_entry_hash, parse_entry_less, NULL);
+        list_init(&parse_lru);
+        parse_cache_initialized = true;
+    }
+}
+
+/* Remove entry from the cache and deallocate it */
+static void
+parse_entry_remove(struct parse_entry *entry)
+{
+    hash_delete(&parse_cache, &entry->elem);
+    list_remove(&entry->lru_elem);
+
+    int i;
+    for (i = 0; i < entry->npipes; i++)
+        esh_pipeline_free(entry->pipes[i].pipe);
+    free(entry->pipes);
+    free(entry->line);
+    free(entry);
+}
+
+/* Evict least recently used entries until at most 'limit' remain */
+static void
+parse_cache_trim(size_t limit)
+{
+    while (hash_size(&parse_cache) > limit) {
+        struct list_elem *e = list_back(&parse_lru);
+        parse_entry_remove(list_entry(e, struct parse_entry, lru_elem));
+        parse_evictions++;
+    }
+}
+
+/* Make a command line from the templates of a cache entry */
+static struct esh_command_line *
+parse_entry_instantiate(struct parse_entry *entry)
+{
+    struct esh_command_line *cline = esh_command_line_create_empty();
+    int i;
+
+    for (i = 0; i < entry->npipes; i++) {
+        struct esh_pipeline *pipe = esh_pipeline_dup(&cline->arena,
+                                                     entry->pipes[i].pipe,
+                                                     entry->pipes[i].size);
+        list_push_back(&cline->pipes, &pipe->elem);
+    }
+    return cline;
+}
+
+/*
+ * Return the parsed form of 'line', calling 'parse' only if it is not
+ * in the cache.  The result is the caller's own copy and must be
+ * deallocated with esh_command_line_free().  Returns NULL if the line
+ * has a syntax error.
+ */
+struct esh_command_line *
+esh_parse_cached(char *line, struct esh_command_line *(*parse)(char *))
+{
+    if (parse_limit == 0)
+        return parse(line);
+
+    parse_cache_init();
+
+    size_t len = strlen(line);
+    struct parse_entry key = { .hash = line_hash(line, len),
+                               .len = len, .line = line };
+    struct hash_elem *e = hash_find(&parse_cache, &key.elem);
+
+    if (e != NULL) {
+        struct parse_entry *entry = hash_entry(e, struct parse_entry, elem);
+        list_remove(&entry->lru_elem);
+        list_push_front(&parse_lru, &entry->lru_elem);
+        parse_hits++;
+        return parse_entry_instantiate(entry);
+    }
+
+    parse_misses++;
+    struct esh_command_line *cline = parse(line);
+    if (cline == NULL || len > PARSE_CACHE_MAX_LINE)
+        return cline;
+
+    struct parse_entry *entry = malloc(sizeof *entry);
+    entry->hash = key.hash;
+    entry->len = len;
+    entry->line = strdup(line);
+    entry->npipes = list_size(&cline->pipes);
+    entry->pipes = malloc(entry->npipes * sizeof *entry->pipes);
+
+    struct list_elem *p = list_begin(&cline->pipes);
+    int i;
+    for (i = 0; i < entry->npipes; i++, p = list_next(p)) {
+        struct esh_pipeline *pipe = list_entry(p, struct esh_pipeline, elem);
+        entry->pipes[i].pipe = esh_pipeline_copy(pipe);
+        entry->pipes[i].size = esh_pipeline_copy_size(pipe);
+    }
+
+    hash_insert(&parse_cache, &entry->elem);
+    list_push_front(&parse_lru, &entry->lru_elem);
+    parse_cache_trim(parse_limit);
+
+    return cline;
+}
+
+/* Set the maximum number of cached lines; 0 disables the cache */
+void
+esh_parse_cache_set_limit(size_t limit)
+{
+    parse_limit = limit;
+    if (parse_cache_initialized)
+        parse_cache_trim(limit);
+}
+
+/* Forget all cached lines */
+void
+esh_parse_cache_clear(void)
+{
+    if (!parse_cache_initialized)
+        return;
+
+    while (!list_empty(&parse_lru)) {
+        struct list_elem *e = list_front(&parse_lru);
+        parse_entry_remove(list_entry(e, struct parse_entry, lru_elem));
+    }
+}
+
+/* Print the cache's size and counters */
+void
+esh_parse_cache_print(void)
+{
+    unsigned long lookups = parse_hits + parse_misses;
+
+    printf("entries %zu/%zu, hits %lu, misses %lu, evictions %lu",
+           parse_cache_initialized ? hash_size(&parse_cache) : 0,
+           parse_limit, parse_hits, parse_misses, parse_evictions);
+    if (lookups > 0)
+        printf(", hit rate %.1f%%", 100.0 * parse_hits / lookups);
+    printf("\n");
+}
@@ -0,0 +1,232 @@
+/*
+ * esh-path.c
+ * Resolve command names against $PATH, remembering the results.
+ *
+ * The cache maps a command name to the absolute path where it was found
+ * and to the index of the $PATH directory it was found in.  It is
+ * flushed when $PATH changes.  A hit is only trusted if none of the
+ * directories up to and including the one the command was found in has
+ * changed its mtime since the cache was filled: adding a command to an
+ * earlier directory, or removing the command, would change them.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "hash.h"
+#include "esh.h"
+
+struct path_entry {
+    struct hash_elem elem;      /* Link element for path_cache */
+    char *name;                 /* command name as typed */
+    char *path;                 /* absolute path it resolved to */
+    int dir;                    /* index of the $PATH directory */
+    int hits;                   /* number of times it was used */
+};
+
+/* A directory of $PATH and its mtime when the cache was last validated. */
+struct path_dir {
+    char *name;
+    struct timespec mtime;
+};
+
+static struct hash path_cache;
+static bool path_cache_initialized;
+
+static char *path_value;            /* value of $PATH the cache is for */
+static struct path_dir *path_dirs;  /* directories of path_value */
+static int path_ndirs;
+
+static unsigned
+path_entry_hash(const struct hash_elem *e, void *aux)
+{
+    return hash_string(hash_entry(e, struct path_entry, elem)->name);
+}
+
+static bool
+path_entry_less(const struct hash_elem *a, const struct hash_elem *b,
+                void *aux)
+{
+    return strcmp(hash_entry(a, struct path_entry, elem)->name,
+                  hash_entry(b, struct path_entry, elem)->name) < 0;
+}
+
+static void
+path_entry_free(struct hash_elem *e, void *aux)
+{
+    struct path_entry *entry = hash_entry(e, struct path_entry, elem);
+    free(entry->name);
+    free(entry->path);
+    free(entry);
+}
+
+/* Record the current mtime of directory 'dir' */
+static void
+path_dir_stat(struct path_dir *dir)
+{
+    struct stat st;
+    if (stat(dir->name, &st) == 0)
+        dir->mtime = st.st_mtim;
+    else
+        dir->mtime.tv_sec = dir->mtime.tv_nsec = -1;
+}
+
+/* Return true if directory 'dir' changed since path_dir_stat() */
+static bool
+path_dir_changed(struct path_dir *dir)
+{
+    struct timespec old = dir->mtime;
+    path_dir_stat(dir);
+    return old.tv_sec != dir->mtime.tv_sec
+        || old.tv_nsec != dir->mtime.tv_nsec;
+}
+
+/* Split 'value' into path_dirs.  An empty element means the current
+ * directory. */
+static void
+path_split(const char *value)
+{
+    int i;
+
+    for (i = 0; i < path_ndirs; i++)
+        free(path_dirs[i].name);
+    free(path_dirs);
+    free(path_value);
+
+    path_value = strdup(value);
+    path_ndirs = 1;
+    for (i = 0; value[i]; i++)
+        if (value[i] == ':')
+            path_ndirs++;
+
+    path_dirs = malloc(path_ndirs * sizeof *path_dirs);
+    for (i = 0; i < path_ndirs; i++) {
+        size_t len = strcspn(value, ":");
+        path_dirs[i].name = len ? strndup(value, len) : strdup(".");
+        path_dir_stat(&path_dirs[i]);
+        value += len + (value[len] == ':');
+    }
+}
+
+/* Make sure the cache describes the current $PATH */
+static void
+path_validate(void)
+{
+    const char *value = getenv("PATH");
+    if (value == NULL)
+        value = "/bin:/usr/bin";
+
+    if (!path_cache_initialized) {
+        hash_init(&path_cache, path_entry_hash, path_entry_less, NULL);
+        path_cache_initialized = true;
+    } else if (!strcmp(value, path_value)) {
+        return;
+    }
+
+    hash_clear(&path_cache, path_entry_free);
+    path_split(value);
+}
+
+/* Return true if 'path' names an executable regular file */
+static bool
+is_executable(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode)
+        && access(path, X_OK) == 0;
+}
+
+/* Search $PATH for 'name' and add it to the cache.  Returns NULL
+ * if not found. */
+static struct path_entry *
+path_search(const char *name)
+{
+    int i;
+    char buf[PATH_MAX];
+
+    for (i = 0; i < path_ndirs; i++) {
+        snprintf(buf, sizeof buf, "%s/%s", path_dirs[i].name, name);
+        if (!is_executable(buf))
+            continue;
+
+        struct path_entry *entry = malloc(sizeof *entry);
+        entry->name = strdup(name);
+        entry->path = strdup(buf);
+        entry->dir = i;
+        entry->hits = 0;
+        hash_insert(&path_cache, &entry->elem);
+        return entry;
+    }
+    return NULL;
+}
+
+/*
+ * Return the path under which command 'name' should be executed, or
+ * NULL if it cannot be found.  Names containing a slash are returned
+ * unchanged.  The result is valid until the next call.
+ */
+const char *
+esh_path_lookup(const char *name)
+{
+    if (strchr(name, '/'))
+        return name;
+
+    path_validate();
+
+    struct path_entry key = { .name = (char *) name };
+    struct hash_elem *e = hash_find(&path_cache, &key.elem);
+    struct path_entry *entry = NULL;
+
+    if (e != NULL) {
+        entry = hash_entry(e, struct path_entry, elem);
+
+        int i;
+        bool changed = false;
+        for (i = 0; i <= entry->dir; i++)
+            changed |= path_dir_changed(&path_dirs[i]);
+
+        if (changed) {
+            hash_clear(&path_cache, path_entry_free);
+            entry = NULL;
+        }
+    }
+
+    if (entry == NULL)
+        entry = path_search(name);
+
+    if (entry == NULL)
+        return NULL;
+
+    entry->hits++;
+    return entry->path;
+}
+
+/* Forget all remembered locations */
+void
+esh_path_clear(void)
+{
+    if (path_cache_initialized)
+        hash_clear(&path_cache, path_entry_free);
+}
+
+/* Print the remembered locations, like bash's 'hash' */
+void
+esh_path_print(void)
+{
+    struct hash_iterator i;
+
+    if (!path_cache_initialized || hash_empty(&path_cache)) {
+        printf("hash: hash table empty\n");
+        return;
+    }
+
+    printf("hits\tcommand\n");
+    hash_first(&i, &path_cache);
+    while (hash_next(&i)) {
+        struct path_entry *entry;
+        entry = hash_entry(hash_cur(&i), struct path_entry, elem);
+        printf("%4d\t%s\n", entry->hits, entry->path);
+    }
+}
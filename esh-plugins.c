@@ -0,0 +1,848 @@
+/*
+ * esh-plugins.c
+ * Loading plugins and notifying them of events.
+ *
+ * Once plugins are initialized, esh_plugin_initialize() builds one
+ * array per event holding the plugins subscribed to it, in order of
+ * rank.  Notifying plugins of an event walks that array only, so an
+ * event nobody subscribed to costs a single comparison, however many
+ * plugins are loaded.
+ *
+ * To keep startup fast, what a plugin's init() revealed about it - its
+ * rank, the events it subscribes to and the builtins it registers - is
+ * remembered in a manifest file.  A plugin whose shared object has not
+ * changed since is not opened at startup.  It is represented by a
+ * placeholder until one of its events fires or one of its builtins is
+ * run, and only then opened and initialized.  Plugins whose init()
+ * replaces any of the shell's functions are always loaded right away.
+ *
+ * Plugins linked into esh (see STATIC_PLUGINS in the Makefile) register
+ * themselves before main() runs via esh-static-plugin.h.
+ *
+ * The 'plugin' builtin loads and unloads plugins while the shell runs.
+ * Hooks are called by the main thread, which is also the one unloading,
+ * so no hook can be running then - except make_prompt(), which the
+ * prompt worker may be calling; esh_prompt_forget() waits for it.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "esh.h"
+
+#define PSH_MODULE_NAME "esh_module"
+#define PSH_MODULE_ABI_NAME "esh_module_abi"
+
+/* List of loaded plugins */
+struct list esh_plugin_list;
+
+struct esh_plugin_dispatch esh_plugin_events[ESH_PLUGIN_NEVENTS];
+
+/* What is known about a plugin, from initializing it or from the
+ * manifest.  Plugins added to esh_plugin_list directly have none. */
+struct plugin_record {
+    char *path;                 /* shared object, NULL if linked in */
+    struct esh_plugin *plugin;  /* the plugin, or a placeholder */
+    void *handle;               /* from dlopen(), NULL if linked in */
+    bool loaded;                /* false while 'plugin' is a placeholder */
+    int abi;                    /* ABI version */
+    unsigned events;            /* events subscribed to */
+    bool eager;                 /* init() replaced shell functions */
+    char *builtins;             /* builtins registered by init(),
+                                   separated by commas */
+    struct esh_shell *replaced; /* if eager, the shell functions before
+                                   and after init(), in this order */
+    struct timespec mtime;      /* of the shared object */
+    off_t size;
+};
+
+static struct plugin_record **records;
+static int nrecords;
+
+/* Plugins linked into esh, registered before main() */
+static struct plugin_record **static_records;
+static int nstatic_records;
+
+/* The manifest: one plugin_record per line, for shared objects */
+static struct plugin_record **manifest;
+static int nmanifest;
+static bool manifest_read_done, manifest_dirty;
+
+/* Directories plugins were loaded from, to look up plugins by name */
+static char **plugin_dirs;
+static int nplugin_dirs;
+
+static struct esh_shell *shell;
+static struct plugin_record *initializing;  /* record whose init() runs */
+
+static struct plugin_record *
+record_new(void)
+{
+    struct plugin_record *rec = calloc(1, sizeof *rec);
+    rec->abi = 1;
+    return rec;
+}
+
+static void
+record_free(struct plugin_record *rec)
+{
+    free(rec->path);
+    free(rec->builtins);
+    free(rec->replaced);
+    free(rec);
+}
+
+/* Return true if the shared object at path is named 'name'.so */
+static bool
+plugin_name_is(const char *path, const char *name)
+{
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+
+    size_t len = strlen(name);
+    return !strncmp(base, name, len) && !strcmp(base + len, ".so");
+}
+
+/* Return the record of plugin, or NULL */
+static struct plugin_record *
+find_record(struct esh_plugin *plugin)
+{
+    int i;
+    for (i = 0; i < nrecords; i++)
+        if (records[i]->plugin == plugin)
+            return records[i];
+    return NULL;
+}
+
+static void
+add_record(struct plugin_record *rec)
+{
+    records = realloc(records, (nrecords + 1) * sizeof *records);
+    records[nrecords++] = rec;
+    list_push_back(&esh_plugin_list, &rec->plugin->elem);
+}
+
+/* Return the path of the manifest, or NULL if there is no place for it.
+ * $ESH_PLUGIN_MANIFEST overrides the default location. */
+static const char *
+manifest_path(void)
+{
+    static char path[PATH_MAX];
+    const char *env = getenv("ESH_PLUGIN_MANIFEST");
+    if (env != NULL)
+        return *env ? env : NULL;
+
+    const char *cache = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    if (cache != NULL && *cache)
+        snprintf(path, sizeof path, "%s/esh/plugins.manifest", cache);
+    else if (home != NULL)
+        snprintf(path, sizeof path, "%s/.cache/esh/plugins.manifest", home);
+    else
+        return NULL;
+    return path;
+}
+
+/* Read the manifest once */
+static void
+manifest_read(void)
+{
+    if (manifest_read_done)
+        return;
+    manifest_read_done = true;
+
+    const char *path = manifest_path();
+    FILE *f = path ? fopen(path, "r") : NULL;
+    if (f == NULL)
+        return;
+
+    char line[PATH_MAX + 1024], name[PATH_MAX], builtins[1024];
+    while (fgets(line, sizeof line, f) != NULL) {
+        long long sec, size;
+        long nsec;
+        int abi, rank, eager;
+        unsigned events;
+
+        builtins[0] = '\0';
+        if (sscanf(line, "%s %lld %ld %lld %d %d %x %d %1023s", name, &sec,
+                   &nsec, &size, &abi, &rank, &events, &eager, builtins) < 8)
+            continue;
+
+        struct plugin_record *rec = record_new();
+        rec->path = strdup(name);
+        rec->mtime.tv_sec = sec;
+        rec->mtime.tv_nsec = nsec;
+        rec->size = size;
+        rec->abi = abi;
+        rec->plugin = calloc(1, sizeof *rec->plugin);
+        rec->plugin->rank = rank;
+        rec->events = events;
+        rec->eager = eager;
+        rec->builtins = strdup(builtins);
+
+        manifest = realloc(manifest, (nmanifest + 1) * sizeof *manifest);
+        manifest[nmanifest++] = rec;
+    }
+    fclose(f);
+}
+
+/* Return the manifest entry for path, or NULL */
+static struct plugin_record *
+manifest_find(const char *path)
+{
+    int i;
+    for (i = 0; i < nmanifest; i++)
+        if (!strcmp(manifest[i]->path, path))
+            return manifest[i];
+    return NULL;
+}
+
+/* Remember what the initialization of rec revealed */
+static void
+manifest_update(struct plugin_record *rec)
+{
+    /* A name with blanks would not survive being read back */
+    if (rec->path == NULL || strpbrk(rec->path, " \t\n") != NULL)
+        return;
+
+    struct plugin_record *entry = manifest_find(rec->path);
+    if (entry == NULL) {
+        entry = record_new();
+        entry->path = strdup(rec->path);
+        entry->plugin = calloc(1, sizeof *entry->plugin);
+        manifest = realloc(manifest, (nmanifest + 1) * sizeof *manifest);
+        manifest[nmanifest++] = entry;
+    }
+
+    entry->mtime = rec->mtime;
+    entry->size = rec->size;
+    entry->abi = rec->abi;
+    entry->plugin->rank = rec->plugin->rank;
+    entry->events = rec->events;
+    entry->eager = rec->eager;
+    free(entry->builtins);
+    entry->builtins = strdup(rec->builtins ? rec->builtins : "");
+    manifest_dirty = true;
+}
+
+/* Create the directory a file is in, and its parent, if needed */
+static void
+make_parent_dirs(const char *path)
+{
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof dir, "%s", path);
+
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL || slash == dir)
+        return;
+    *slash = '\0';
+    if (mkdir(dir, 0700) == 0 || errno == EEXIST)
+        return;
+
+    make_parent_dirs(dir);
+    mkdir(dir, 0700);
+}
+
+/* Write the manifest if it changed, replacing the old one atomically */
+static void
+manifest_write(void)
+{
+    const char *path = manifest_path();
+    if (!manifest_dirty || path == NULL)
+        return;
+    manifest_dirty = false;
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof tmp, "%s.%d", path, getpid());
+    make_parent_dirs(path);
+
+    FILE *f = fopen(tmp, "w");
+    if (f == NULL)
+        return;
+
+    int i;
+    for (i = 0; i < nmanifest; i++) {
+        struct plugin_record *e = manifest[i];
+        fprintf(f, "%s %lld %ld %lld %d %d %x %d %s\n", e->path,
+                (long long) e->mtime.tv_sec, e->mtime.tv_nsec,
+                (long long) e->size, e->abi, e->plugin->rank, e->events,
+                e->eager, e->builtins);
+    }
+
+    if (fclose(f) != 0 || rename(tmp, path) != 0)
+        unlink(tmp);
+}
+
+/* Load a plugin referred to by modname */
+static struct esh_plugin *
+load_plugin(char *modname, void **handlep, int *abip)
+{
+    void *handle = dlopen(modname, RTLD_LAZY);
+    if (handle == NULL) {
+        fprintf(stderr, "Could not open %s: %s\n", modname, dlerror());
+        return NULL;
+    }
+
+    struct esh_plugin * p = dlsym(handle, PSH_MODULE_NAME);
+    if (p == NULL) {
+        fprintf(stderr, "%s does not define %s\n", modname, PSH_MODULE_NAME);
+        dlclose(handle);
+        return NULL;
+    }
+
+    const int *abi = dlsym(handle, PSH_MODULE_ABI_NAME);
+    if (abi != NULL && *abi > ESH_PLUGIN_ABI_VERSION) {
+        fprintf(stderr, "%s needs plugin ABI version %d, esh has %d\n",
+                modname, *abi, ESH_PLUGIN_ABI_VERSION);
+        dlclose(handle);
+        return NULL;
+    }
+
+    *handlep = handle;
+    *abip = abi ? *abi : 1;
+    return p;
+}
+
+static bool sort_by_rank (const struct list_elem *a,
+                          const struct list_elem *b,
+                          void *aux __attribute__((unused)))
+{
+    struct esh_plugin * pa =  list_entry(a, struct esh_plugin, elem);
+    struct esh_plugin * pb =  list_entry(b, struct esh_plugin, elem);
+    return pa->rank < pb->rank;
+}
+
+/* Load plugins from directory dirname.  Plugins that are up to date in
+ * the manifest are only opened once they are needed. */
+void
+esh_plugin_load_from_directory(char *dirname)
+{
+    DIR * dir = opendir(dirname);
+    if (dir == NULL) {
+        perror("opendir");
+        return;
+    }
+
+    manifest_read();
+
+    plugin_dirs = realloc(plugin_dirs, (nplugin_dirs + 1) * sizeof *plugin_dirs);
+    plugin_dirs[nplugin_dirs++] = strdup(dirname);
+
+    struct dirent * dentry;
+    while ((dentry = readdir(dir)) != NULL) {
+        if (!strstr(dentry->d_name, ".so"))
+            continue;
+
+        char modname[PATH_MAX + 1], path[PATH_MAX];
+        snprintf(modname, sizeof modname, "%s/%s", dirname, dentry->d_name);
+
+        struct stat st;
+        if (realpath(modname, path) == NULL || stat(path, &st) == -1) {
+            fprintf(stderr, "Could not open %s: %s\n", modname,
+                    strerror(errno));
+            continue;
+        }
+
+        struct plugin_record *rec = record_new();
+        rec->path = strdup(path);
+        rec->mtime = st.st_mtim;
+        rec->size = st.st_size;
+
+        struct plugin_record *entry = manifest_find(path);
+        if (entry != NULL && !entry->eager && entry->size == st.st_size
+            && entry->mtime.tv_sec == st.st_mtim.tv_sec
+            && entry->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            rec->plugin = calloc(1, sizeof *rec->plugin);
+            rec->plugin->rank = entry->plugin->rank;
+            rec->abi = entry->abi;
+            rec->events = entry->events;
+            rec->builtins = strdup(entry->builtins);
+            add_record(rec);
+            continue;
+        }
+
+        printf("Loading %s ...", modname);
+        fflush(stdout);
+
+        rec->plugin = load_plugin(path, &rec->handle, &rec->abi);
+        if (rec->plugin == NULL) {
+            record_free(rec);
+            continue;
+        }
+        rec->loaded = true;
+        add_record(rec);
+        printf("done.\n");
+    }
+    closedir(dir);
+}
+
+/* Register a plugin linked into esh.  Called before main() by the
+ * constructor in esh-static-plugin.h. */
+void
+esh_plugin_register_static(struct esh_plugin *plugin, const int *abi)
+{
+    struct plugin_record *rec = record_new();
+    rec->plugin = plugin;
+    rec->loaded = true;
+    rec->abi = abi ? *abi : 1;
+
+    static_records = realloc(static_records,
+                             (nstatic_records + 1) * sizeof *static_records);
+    static_records[nstatic_records++] = rec;
+}
+
+/* Return the events for which plugin has a hook */
+static unsigned
+plugin_hooks(struct esh_plugin *plugin)
+{
+    unsigned hooks = 0;
+
+    if (plugin->process_raw_cmdline)
+        hooks |= ESH_PLUGIN_SUBSCRIBE(ESH_PLUGIN_RAW_CMDLINE);
+    if (plugin->process_pipeline)
+        hooks |= ESH_PLUGIN_SUBSCRIBE(ESH_PLUGIN_PIPELINE);
+    if (plugin->process_builtin)
+        hooks |= ESH_PLUGIN_SUBSCRIBE(ESH_PLUGIN_BUILTIN);
+    if (plugin->make_prompt)
+        hooks |= ESH_PLUGIN_SUBSCRIBE(ESH_PLUGIN_PROMPT);
+    if (plugin->pipeline_forked)
+        hooks |= ESH_PLUGIN_SUBSCRIBE(ESH_PLUGIN_FORKED);
+    if (plugin->command_status_change)
+        hooks |= ESH_PLUGIN_SUBSCRIBE(ESH_PLUGIN_STATUS_CHANGE);
+    return hooks;
+}
+
+/* Return the events plugin is to be notified of.  Version 1 plugins
+ * have no 'events' field, which must not be read.  Plugins not loaded
+ * yet have the subscriptions recorded in the manifest. */
+static unsigned
+plugin_subscriptions(struct esh_plugin *plugin)
+{
+    struct plugin_record *rec = find_record(plugin);
+    if (rec != NULL && !rec->loaded)
+        return rec->events;
+
+    unsigned hooks = plugin_hooks(plugin);
+    if (rec == NULL || rec->abi < 2)
+        return hooks;
+    return plugin->events & hooks;
+}
+
+/* Rebuild the dispatch arrays from esh_plugin_list, which is sorted */
+static void
+build_dispatch(void)
+{
+    int n = list_size(&esh_plugin_list), ev;
+    unsigned subscriptions[n ? n : 1];
+    struct list_elem * e;
+    int i;
+
+    i = 0;
+    for (e = list_begin(&esh_plugin_list); e != list_end(&esh_plugin_list);
+         e = list_next(e))
+        subscriptions[i++] = plugin_subscriptions(list_entry(e, struct esh_plugin, elem));
+
+    for (ev = 0; ev < ESH_PLUGIN_NEVENTS; ev++) {
+        struct esh_plugin_dispatch *d = &esh_plugin_events[ev];
+
+        free(d->plugins);
+        d->plugins = NULL;
+        d->count = 0;
+        d->pending = 0;
+
+        i = 0;
+        for (e = list_begin(&esh_plugin_list); e != list_end(&esh_plugin_list);
+             e = list_next(e), i++) {
+            if (!(subscriptions[i] & ESH_PLUGIN_SUBSCRIBE(ev)))
+                continue;
+
+            struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem);
+            struct plugin_record *rec = find_record(plugin);
+            if (rec != NULL && !rec->loaded)
+                d->pending++;
+
+            d->plugins = realloc(d->plugins, (d->count + 1) * sizeof *d->plugins);
+            d->plugins[d->count++] = plugin;
+        }
+    }
+}
+
+/* shell->register_builtin while a plugin's init() runs: remembers the
+ * builtin for the manifest */
+static bool
+record_builtin(const char *name, esh_builtin_t handler)
+{
+    if (!esh_builtin_register(name, handler))
+        return false;
+
+    struct plugin_record *rec = initializing;
+    if (rec != NULL) {
+        size_t len = rec->builtins ? strlen(rec->builtins) : 0;
+        rec->builtins = realloc(rec->builtins, len + strlen(name) + 2);
+        sprintf(rec->builtins + len, "%s%s", len ? "," : "", name);
+    }
+    return true;
+}
+
+/* Call the init() method of a loaded plugin and record what it did */
+static void
+init_plugin(struct plugin_record *rec, struct esh_plugin *plugin)
+{
+    if (plugin->init == NULL && rec == NULL)
+        return;
+
+    struct esh_shell before = *shell;
+    if (rec != NULL) {
+        free(rec->builtins);
+        rec->builtins = NULL;
+    }
+
+    initializing = rec;
+    shell->register_builtin = record_builtin;
+    if (plugin->init) {
+        ESH_PLUGIN_HOOK(plugin, "init", plugin->init(shell));
+    }
+    shell->register_builtin = before.register_builtin;
+    initializing = NULL;
+
+    if (rec != NULL) {
+        rec->eager = memcmp(&before, shell, sizeof before) != 0;
+        rec->events = plugin_subscriptions(plugin);
+        manifest_update(rec);
+
+        free(rec->replaced);
+        rec->replaced = NULL;
+        if (rec->eager) {
+            rec->replaced = malloc(2 * sizeof *rec->replaced);
+            rec->replaced[0] = before;
+            rec->replaced[1] = *shell;
+        }
+    }
+}
+
+static int lazy_builtin(struct esh_command *cmd);
+
+/* Call fn for each builtin of rec */
+static void
+for_each_builtin(struct plugin_record *rec, void (*fn)(const char *name))
+{
+    if (rec->builtins == NULL)
+        return;
+
+    char *names = strdup(rec->builtins), *save, *name;
+    for (name = strtok_r(names, ",", &save); name != NULL;
+         name = strtok_r(NULL, ",", &save))
+        fn(name);
+    free(names);
+}
+
+static void
+register_stub(const char *name)
+{
+    esh_builtin_register(name, lazy_builtin);
+}
+
+static void
+unregister_stub(const char *name)
+{
+    if (esh_builtin_lookup(name) == lazy_builtin)
+        esh_builtin_unregister(name);
+}
+
+/* Open and initialize a plugin that was represented by a placeholder.
+ * If it cannot be loaded, it is dropped.  The caller must rebuild the
+ * dispatch arrays. */
+static void
+load_deferred(struct plugin_record *rec)
+{
+    struct esh_plugin *placeholder = rec->plugin;
+    struct esh_plugin *plugin = load_plugin(rec->path, &rec->handle, &rec->abi);
+
+    for_each_builtin(rec, unregister_stub);
+    if (plugin == NULL) {
+        list_remove(&placeholder->elem);
+        rec->plugin = NULL;
+        free(placeholder);
+        return;
+    }
+
+    list_insert(&placeholder->elem, &plugin->elem);
+    list_remove(&placeholder->elem);
+    free(placeholder);
+
+    rec->plugin = plugin;
+    rec->loaded = true;
+    init_plugin(rec, plugin);
+    manifest_write();
+}
+
+/* Load the plugins subscribed to event ev that are not loaded yet */
+void
+esh_plugin_resolve(enum esh_plugin_event ev)
+{
+    struct esh_plugin_dispatch *d = &esh_plugin_events[ev];
+    int i;
+
+    for (i = 0; i < d->count; i++) {
+        struct plugin_record *rec = find_record(d->plugins[i]);
+        if (rec != NULL && !rec->loaded)
+            load_deferred(rec);
+    }
+    build_dispatch();
+}
+
+/* Handler of the builtins of plugins that are not loaded yet: loads
+ * the plugin, then runs the builtin it registered */
+static int
+lazy_builtin(struct esh_command *cmd)
+{
+    const char *name = cmd->argv[0];
+    int i;
+
+    for (i = 0; i < nrecords; i++) {
+        struct plugin_record *rec = records[i];
+        if (rec->loaded || rec->plugin == NULL || rec->builtins == NULL)
+            continue;
+
+        size_t len = strlen(name);
+        const char *p = rec->builtins;
+        while ((p = strstr(p, name)) != NULL) {
+            if ((p == rec->builtins || p[-1] == ',')
+                && (p[len] == ',' || p[len] == '\0'))
+                break;
+            p += len;
+        }
+        if (p != NULL) {
+            load_deferred(rec);
+            build_dispatch();
+            break;
+        }
+    }
+
+    esh_builtin_t builtin = esh_builtin_lookup(name);
+    if (builtin == NULL || builtin == lazy_builtin) {
+        fprintf(stderr, "esh: %s: no longer provided by its plugin\n", name);
+        esh_builtin_unregister(name);
+        return 127;
+    }
+    return builtin(cmd);
+}
+
+/* Initialize loaded plugins */
+void
+esh_plugin_initialize(struct esh_shell *sh)
+{
+    shell = sh;
+
+    int i;
+    for (i = 0; i < nstatic_records; i++)
+        add_record(static_records[i]);
+
+    /* Sort plugins and call init() method. */
+    list_sort(&esh_plugin_list, sort_by_rank, NULL);
+
+    struct list_elem * e = list_begin(&esh_plugin_list);
+    for (; e != list_end(&esh_plugin_list); e = list_next(e)) {
+        struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem);
+        struct plugin_record *rec = find_record(plugin);
+
+        if (rec != NULL && !rec->loaded)
+            for_each_builtin(rec, register_stub);
+        else
+            init_plugin(rec, plugin);
+    }
+
+    /* Subscriptions may have been made by init() */
+    build_dispatch();
+    manifest_write();
+}
+
+/* Return the record of the plugin 'name' (see esh_plugin_load()) */
+static struct plugin_record *
+find_record_by_name(const char *name)
+{
+    char path[PATH_MAX];
+    bool is_path = strchr(name, '/') != NULL;
+    int i;
+
+    if (is_path && realpath(name, path) == NULL)
+        return NULL;
+
+    for (i = 0; i < nrecords; i++) {
+        const char *p = records[i]->path;
+        if (p == NULL)
+            continue;
+        if (is_path ? !strcmp(p, path) : plugin_name_is(p, name))
+            return records[i];
+    }
+    return NULL;
+}
+
+/* Find the shared object of plugin 'name'; stores its real path */
+static bool
+find_plugin_file(const char *name, char *path)
+{
+    if (strchr(name, '/') != NULL)
+        return realpath(name, path) != NULL;
+
+    int i;
+    for (i = 0; i < nplugin_dirs; i++) {
+        char file[PATH_MAX + 1];
+        snprintf(file, sizeof file, "%s/%s.so", plugin_dirs[i], name);
+        if (realpath(file, path) != NULL)
+            return true;
+    }
+    return false;
+}
+
+/* Put back the shell functions that rec's init() replaced, unless
+ * someone replaced them again since */
+static void
+restore_shell(struct plugin_record *rec)
+{
+    typedef void (* shell_function_t)(void);
+    shell_function_t *current = (shell_function_t *) shell;
+    shell_function_t *before = (shell_function_t *) &rec->replaced[0];
+    shell_function_t *after = (shell_function_t *) &rec->replaced[1];
+    size_t i;
+
+    for (i = 0; i < sizeof *shell / sizeof *current; i++)
+        if (current[i] == after[i])
+            current[i] = before[i];
+}
+
+/* Unload the plugin of rec and forget rec */
+static void
+unload_record(struct plugin_record *rec)
+{
+    struct esh_plugin *plugin = rec->plugin;
+
+    /* From now on, no hook will be called, and no builtin run */
+    list_remove(&plugin->elem);
+    build_dispatch();
+    esh_prompt_forget(plugin);
+
+    char *names = rec->builtins ? strdup(rec->builtins) : NULL, *save, *name;
+    for (name = names ? strtok_r(names, ",", &save) : NULL; name != NULL;
+         name = strtok_r(NULL, ",", &save))
+        esh_builtin_unregister(name);
+    free(names);
+
+    if (rec->loaded) {
+        if (rec->replaced != NULL)
+            restore_shell(rec);
+        if (rec->abi >= 3 && plugin->fini != NULL)
+            plugin->fini();
+        dlclose(rec->handle);
+    } else {
+        free(plugin);
+    }
+
+    int i;
+    for (i = 0; i < nrecords; i++)
+        if (records[i] == rec)
+            break;
+    memmove(records + i, records + i + 1, (nrecords - i - 1) * sizeof *records);
+    nrecords--;
+    record_free(rec);
+}
+
+/* Load plugin 'name' and initialize it right away */
+bool
+esh_plugin_load(const char *name)
+{
+    char path[PATH_MAX];
+    struct stat st;
+
+    if (!find_plugin_file(name, path) || stat(path, &st) == -1) {
+        fprintf(stderr, "esh: plugin: %s: not found\n", name);
+        return false;
+    }
+
+    if (find_record_by_name(path) != NULL) {
+        fprintf(stderr, "esh: plugin: %s: already loaded\n", name);
+        return false;
+    }
+
+    struct plugin_record *rec = record_new();
+    rec->path = strdup(path);
+    rec->mtime = st.st_mtim;
+    rec->size = st.st_size;
+    rec->plugin = load_plugin(path, &rec->handle, &rec->abi);
+    if (rec->plugin == NULL) {
+        record_free(rec);
+        return false;
+    }
+    rec->loaded = true;
+    add_record(rec);
+    list_sort(&esh_plugin_list, sort_by_rank, NULL);
+
+    init_plugin(rec, rec->plugin);
+    build_dispatch();
+    manifest_write();
+    return true;
+}
+
+/* Unload plugin 'name', calling its fini() */
+bool
+esh_plugin_unload(const char *name)
+{
+    struct plugin_record *rec = find_record_by_name(name);
+    if (rec == NULL) {
+        fprintf(stderr, "esh: plugin: %s: not loaded\n", name);
+        return false;
+    }
+
+    unload_record(rec);
+    return true;
+}
+
+/* Unload plugin 'name' and load it again, e.g. after it was rebuilt */
+bool
+esh_plugin_reload(const char *name)
+{
+    struct plugin_record *rec = find_record_by_name(name);
+    if (rec == NULL) {
+        fprintf(stderr, "esh: plugin: %s: not loaded\n", name);
+        return false;
+    }
+
+    char *path = strdup(rec->path);
+    unload_record(rec);
+    bool ok = esh_plugin_load(path);
+    free(path);
+    return ok;
+}
+
+/* Print the plugins in rank order */
+void
+esh_plugin_print(void)
+{
+    struct list_elem * e = list_begin(&esh_plugin_list);
+    for (; e != list_end(&esh_plugin_list); e = list_next(e)) {
+        struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem);
+        struct plugin_record *rec = find_record(plugin);
+
+        printf("%4d %-8s %s\n", plugin->rank,
+               rec == NULL ? "added" : !rec->loaded ? "deferred"
+               : rec->path == NULL ? "static" : "loaded",
+               rec && rec->path ? rec->path : "-");
+    }
+}
+
+/* Return the file name of a loaded plugin's shared object, or NULL if
+ * it has none or is not loaded */
+const char *
+esh_plugin_name(struct esh_plugin *plugin)
+{
+    struct plugin_record *rec = find_record(plugin);
+    if (rec == NULL || rec->path == NULL)
+        return NULL;
+
+    const char *base = strrchr(rec->path, '/');
+    return base ? base + 1 : rec->path;
+}
@@ -0,0 +1,435 @@
+/*
+ * esh-prompt.c
+ * The prompt, assembled from fragments made by plugins.
+ *
+ * By default every plugin's make_prompt() is called before each prompt.
+ * In async mode, fragments are instead computed by a worker thread and
+ * cached.  A cached fragment goes stale when the current directory
+ * changes, when a job changes state, or when it is older than the TTL.
+ * Building the prompt then asks the worker for a refresh and waits for
+ * it at most until the deadline; a fragment that is not ready by then
+ * is shown with its stale value.  When the worker finishes later, it
+ * signals an eventfd, so that the shell can redraw the prompt.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "esh-sys-utils.h"
+#include "esh.h"
+
+#define PROMPT_DEFAULT_DEADLINE_MS 50
+#define PROMPT_DEFAULT_TTL_MS 2000
+
+/* The cached fragment of one plugin */
+struct fragment {
+    struct esh_plugin *plugin;
+    char *text;                 /* last fragment made, or NULL */
+    bool made_valid;            /* true once one was made, even NULL */
+    double made;                /* when it was made */
+    unsigned generation;        /* value of 'generation' it is valid for */
+};
+
+static bool async;
+static int deadline_ms = PROMPT_DEFAULT_DEADLINE_MS;
+static int ttl_ms = PROMPT_DEFAULT_TTL_MS;
+
+/* The following are guarded by 'lock' while the worker runs. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond;        /* worker waits for requests */
+static pthread_cond_t done_cond;        /* builder waits for fragments */
+static struct fragment *fragments;
+static int nfragments;
+static unsigned generation;     /* bumped when all fragments go stale */
+static bool refresh_requested;
+static bool builder_waiting;    /* esh_prompt_build() waits for the worker */
+static struct esh_plugin *calling;  /* plugin the worker is calling */
+static bool worker_started;
+
+static int efd = -1;
+static char cwd[PATH_MAX];
+
+/* Statistics, only used by the main thread */
+static unsigned long prompts, deadline_misses;
+static double ready, latency_last, latency_total, latency_max;
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Make 'fragments' match the plugins subscribed to ESH_PLUGIN_PROMPT.
+ * Called with 'lock' held. */
+static void
+sync_fragments(void)
+{
+    struct esh_plugin_dispatch *d = &esh_plugin_events[ESH_PLUGIN_PROMPT];
+    int i;
+
+    if (nfragments == d->count) {
+        for (i = 0; i < d->count; i++)
+            if (fragments[i].plugin != d->plugins[i])
+                break;
+        if (i == d->count)
+            return;
+    }
+
+    for (i = 0; i < nfragments; i++)
+        free(fragments[i].text);
+    free(fragments);
+
+    nfragments = d->count;
+    fragments = calloc(nfragments ? nfragments : 1, sizeof *fragments);
+    for (i = 0; i < nfragments; i++)
+        fragments[i].plugin = d->plugins[i];
+}
+
+static bool
+fragment_fresh(struct fragment *f, double t)
+{
+    return f->made_valid && f->generation == generation
+        && (t - f->made) * 1000 < ttl_ms;
+}
+
+/* Return true if all fragments are fresh.  Called with 'lock' held. */
+static bool
+all_fresh(void)
+{
+    double t = now();
+    int i;
+
+    for (i = 0; i < nfragments; i++)
+        if (!fragment_fresh(&fragments[i], t))
+            return false;
+    return true;
+}
+
+/* Concatenate the given fragments into one malloc'd string, or return
+ * NULL if there are none.  NULL fragments count as empty. */
+static char *
+concatenate(char **texts, int n)
+{
+    size_t len = 0;
+    int i;
+
+    if (n == 0)
+        return NULL;
+
+    for (i = 0; i < n; i++)
+        if (texts[i])
+            len += strlen(texts[i]);
+
+    char *prompt = malloc(len + 1), *p = prompt;
+    for (i = 0; i < n; i++) {
+        if (texts[i]) {
+            size_t l = strlen(texts[i]);
+            memcpy(p, texts[i], l);
+            p += l;
+        }
+    }
+    *p = '\0';
+    return prompt;
+}
+
+/* Concatenate the cached fragments.  Called with 'lock' held. */
+static char *
+concatenate_cached(void)
+{
+    char *texts[nfragments ? nfragments : 1];
+    int i;
+
+    for (i = 0; i < nfragments; i++)
+        texts[i] = fragments[i].text;
+    return concatenate(texts, nfragments);
+}
+
+/* Refresh stale fragments whenever asked to */
+static void *
+prompt_worker(void *arg)
+{
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (!refresh_requested)
+            pthread_cond_wait(&work_cond, &lock);
+        refresh_requested = false;
+
+        bool changed = false;
+        int i;
+        for (i = 0; i < nfragments; i++) {
+            struct fragment *f = &fragments[i];
+            if (fragment_fresh(f, now()))
+                continue;
+
+            struct esh_plugin *plugin = f->plugin;
+            unsigned gen = generation;
+
+            calling = plugin;
+            pthread_mutex_unlock(&lock);
+            char *text;
+            ESH_PLUGIN_HOOK(plugin, "make_prompt",
+                            text = plugin->make_prompt());
+            pthread_mutex_lock(&lock);
+            calling = NULL;
+            pthread_cond_broadcast(&done_cond);
+
+            /* The fragments may have been replaced meanwhile */
+            if (i >= nfragments || fragments[i].plugin != plugin) {
+                free(text);
+                break;
+            }
+
+            f = &fragments[i];
+            changed |= !f->made_valid || (f->text == NULL) != (text == NULL)
+                       || (text != NULL && strcmp(f->text, text));
+            free(f->text);
+            f->text = text;
+            f->made_valid = true;
+            f->made = now();
+            f->generation = gen;
+        }
+
+        /* If the prompt was already shown, tell the shell to redraw it */
+        if (changed && !builder_waiting) {
+            uint64_t one = 1;
+            if (write(efd, &one, sizeof one) < 0)
+                perror("prompt worker: write");
+        }
+    }
+    return NULL;
+}
+
+/* Start the worker, with all signals blocked so that it never handles
+ * any of the shell's */
+static bool
+start_worker(void)
+{
+    esh_prompt_eventfd();
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&done_cond, &attr);
+    pthread_cond_init(&work_cond, NULL);
+    pthread_condattr_destroy(&attr);
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    pthread_t thread;
+    int rc = pthread_create(&thread, NULL, prompt_worker, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0)
+        return false;
+
+    pthread_detach(thread);
+    worker_started = true;
+    return true;
+}
+
+/*
+ * Build the prompt from fresh and cached fragments, waiting for the
+ * worker until the deadline at most.
+ */
+static char *
+build_async(void)
+{
+    char dir[PATH_MAX];
+    if (getcwd(dir, sizeof dir) != NULL && strcmp(dir, cwd)) {
+        strcpy(cwd, dir);
+        esh_prompt_invalidate();
+    }
+
+    pthread_mutex_lock(&lock);
+    sync_fragments();
+
+    if (!all_fresh()) {
+        refresh_requested = true;
+        pthread_cond_signal(&work_cond);
+
+        double end = now() + deadline_ms / 1000.0;
+        struct timespec ts = { .tv_sec = end,
+                               .tv_nsec = (end - (time_t) end) * 1e9 };
+
+        builder_waiting = true;
+        while (!all_fresh()) {
+            if (pthread_cond_timedwait(&done_cond, &lock, &ts) != 0) {
+                deadline_misses++;
+                break;
+            }
+        }
+        builder_waiting = false;
+    }
+
+    char *prompt = concatenate_cached();
+    pthread_mutex_unlock(&lock);
+    return prompt;
+}
+
+/* Call all plugins right away */
+static char *
+build_sync(void)
+{
+    struct esh_plugin_dispatch *d = esh_plugin_subscribers(ESH_PLUGIN_PROMPT);
+    char *texts[d->count ? d->count : 1];
+    int i;
+
+    for (i = 0; i < d->count; i++) {
+        struct esh_plugin *plugin = d->plugins[i];
+        ESH_PLUGIN_HOOK(plugin, "make_prompt",
+                        texts[i] = plugin->make_prompt());
+    }
+
+    char *prompt = concatenate(texts, d->count);
+    for (i = 0; i < d->count; i++)
+        free(texts[i]);
+    return prompt;
+}
+
+/*
+ * Assemble the prompt from the fragments of the plugins implementing
+ * make_prompt, in rank order.  Returns a malloc'd string, or NULL if
+ * no plugin makes a fragment.
+ */
+char *
+esh_prompt_build(void)
+{
+    if (esh_plugin_subscribers(ESH_PLUGIN_PROMPT)->count == 0)
+        return NULL;
+
+    return async ? build_async() : build_sync();
+}
+
+/* Assemble the prompt from the cached fragments, without calling or
+ * waiting for plugins.  Same as esh_prompt_build() in sync mode. */
+char *
+esh_prompt_current(void)
+{
+    if (!async)
+        return esh_prompt_build();
+
+    pthread_mutex_lock(&lock);
+    sync_fragments();
+    char *prompt = concatenate_cached();
+    pthread_mutex_unlock(&lock);
+    return prompt;
+}
+
+/* Switch between async and sync mode.  Returns false if the worker
+ * cannot be started. */
+bool
+esh_prompt_set_async(bool on)
+{
+    if (on && !worker_started && !start_worker())
+        return false;
+
+    async = on;
+    return true;
+}
+
+/* Set how long building the prompt waits for the worker */
+void
+esh_prompt_set_deadline(int ms)
+{
+    deadline_ms = ms;
+}
+
+/* Set how long a fragment is used before it is refreshed */
+void
+esh_prompt_set_ttl(int ms)
+{
+    ttl_ms = ms;
+}
+
+/* Mark all cached fragments as stale */
+void
+esh_prompt_invalidate(void)
+{
+    if (!worker_started)
+        return;
+
+    pthread_mutex_lock(&lock);
+    generation++;
+    pthread_mutex_unlock(&lock);
+}
+
+/* Wait until the worker is not calling into plugin, and drop the
+ * fragments of plugins no longer subscribed to the prompt.  The plugin
+ * must already be gone from the dispatch arrays, so that the worker
+ * will not call it again. */
+void
+esh_prompt_forget(struct esh_plugin *plugin)
+{
+    if (!worker_started)
+        return;
+
+    pthread_mutex_lock(&lock);
+    while (calling == plugin)
+        pthread_cond_wait(&done_cond, &lock);
+    sync_fragments();
+    pthread_mutex_unlock(&lock);
+}
+
+/* Return the eventfd signalled when fragments were refreshed after
+ * the prompt was shown */
+int
+esh_prompt_eventfd(void)
+{
+    if (efd == -1) {
+        efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (efd == -1)
+            esh_sys_fatal_error("eventfd: ");
+    }
+    return efd;
+}
+
+/* Consume the eventfd.  Returns true if it was signalled. */
+bool
+esh_prompt_refreshed(void)
+{
+    uint64_t count;
+    return read(esh_prompt_eventfd(), &count, sizeof count) == sizeof count;
+}
+
+/* Record that the shell is ready for input and about to build the
+ * prompt */
+void
+esh_prompt_latency_start(void)
+{
+    ready = now();
+}
+
+/* Record that the prompt is shown and input can be typed */
+void
+esh_prompt_latency_stop(void)
+{
+    double latency = now() - ready;
+
+    prompts++;
+    latency_last = latency;
+    latency_total += latency;
+    if (latency > latency_max)
+        latency_max = latency;
+    esh_stats_add(ESH_STAT_PROMPT, latency * 1e9);
+}
+
+/* Print the mode, settings and prompt latency */
+void
+esh_prompt_print(void)
+{
+    printf("mode %s, deadline %d ms, ttl %d ms\n",
+           async ? "async" : "sync", deadline_ms, ttl_ms);
+    printf("prompts %lu, latency last %.3f ms, mean %.3f ms, max %.3f ms, "
+           "deadline misses %lu\n", prompts, latency_last * 1e3,
+           prompts ? latency_total / prompts * 1e3 : 0, latency_max * 1e3,
+           deadline_misses);
+}
@@ -0,0 +1,90 @@
+/*
+ * esh-snapshot-read.c
+ * Read the job table snapshot a shell publishes; see esh-snapshot.h.
+ * Uses nothing but the C library, for use in monitoring programs.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "esh-snapshot.h"
+
+/* How often a reader retries while the shell is updating the snapshot
+ * before it assumes that the shell died in the middle of it */
+#define READ_RETRIES (1 << 20)
+
+/* Write the shared memory object name of shell pid's snapshot */
+void
+esh_snapshot_name(char *name, size_t size, pid_t pid)
+{
+    snprintf(name, size, "/esh-snapshot.%d", (int) pid);
+}
+
+/* Map the snapshot of shell 'pid' read-only.  Returns NULL, with errno
+ * set, if there is none or it has an unknown layout. */
+const struct esh_snapshot *
+esh_snapshot_map(pid_t pid)
+{
+    char name[64];
+    esh_snapshot_name(name, sizeof name, pid);
+
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+        return NULL;
+
+    struct esh_snapshot *snapshot = mmap(NULL, sizeof *snapshot, PROT_READ,
+                                         MAP_SHARED, fd, 0);
+    close(fd);
+    if (snapshot == MAP_FAILED)
+        return NULL;
+
+    if (snapshot->magic != ESH_SNAPSHOT_MAGIC
+        || snapshot->version != ESH_SNAPSHOT_VERSION
+        || snapshot->size != sizeof *snapshot) {
+        munmap(snapshot, sizeof *snapshot);
+        errno = EPROTO;
+        return NULL;
+    }
+    return snapshot;
+}
+
+/* Unmap a snapshot */
+void
+esh_snapshot_unmap(const struct esh_snapshot *snapshot)
+{
+    munmap((void *) snapshot, sizeof *snapshot);
+}
+
+/*
+ * Copy a consistent snapshot from the shared 'snapshot' into 'copy';
+ * only the listed jobs are copied.  Makes no system calls.  Returns
+ * false if the shell has exited, or if it seems to have died during an
+ * update (errno is EAGAIN then).
+ */
+bool
+esh_snapshot_read(const struct esh_snapshot *snapshot,
+                  struct esh_snapshot *copy)
+{
+    int tries;
+
+    for (tries = 0; tries < READ_RETRIES; tries++) {
+        uint64_t seq = __atomic_load_n(&snapshot->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+
+        memcpy(copy, snapshot, offsetof(struct esh_snapshot, jobs));
+        int n = copy->nlisted;
+        if (n < 0 || n > ESH_SNAPSHOT_JOBS)
+            continue;           /* torn; seq will have changed */
+        memcpy(copy->jobs, snapshot->jobs, n * sizeof copy->jobs[0]);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&snapshot->seq, __ATOMIC_RELAXED) == seq)
+            return copy->alive;
+    }
+    errno = EAGAIN;
+    return false;
+}
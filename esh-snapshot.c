@@ -0,0 +1,208 @@
+/*
+ * esh-snapshot.c
+ * Publish a snapshot of the job table in shared memory.
+ *
+ * Once turned on, the job table is copied to a POSIX shared memory
+ * object whenever a job is added, changes state or is removed, so that
+ * monitoring programs can read it without running 'jobs' or scanning
+ * /proc; see esh-snapshot.h for its layout and the readers' side.
+ * Only the main thread changes jobs, so there is a single writer.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "esh.h"
+#include "esh-snapshot.h"
+
+_Static_assert((int) ESH_SNAPSHOT_FOREGROUND == FOREGROUND
+               && (int) ESH_SNAPSHOT_BACKGROUND == BACKGROUND
+               && (int) ESH_SNAPSHOT_STOPPED == STOPPED
+               && (int) ESH_SNAPSHOT_NEEDSTERMINAL == NEEDSTERMINAL,
+               "esh_snapshot_status must match job_status");
+
+static struct esh_snapshot *snapshot;
+static char name[64];
+
+/* Add the bytes of 'data' to 64-bit FNV-1a hash 'h' */
+static uint64_t
+fnv1a(uint64_t h, const char *data, size_t len)
+{
+    while (len-- > 0) {
+        h ^= (unsigned char) *data++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* Append 's' to the command text of length *len, truncating it to fit
+ * 'command', and hash its bytes and NUL into 'digest' */
+static void
+append(char *command, size_t *len, const char *s, uint64_t *digest)
+{
+    size_t n = strlen(s), room = ESH_SNAPSHOT_COMMAND - 1 - *len;
+
+    *digest = fnv1a(*digest, s, n + 1);
+    if (n > room)
+        n = room;
+    memcpy(command + *len, s, n);
+    *len += n;
+}
+
+static uint64_t
+timeval_us(struct timeval tv)
+{
+    return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+/* Fill in the snapshot of one job */
+static void
+snapshot_job(struct esh_snapshot_job *s, struct esh_pipeline *job)
+{
+    uint64_t digest = 0xcbf29ce484222325ULL;
+    size_t len = 0;
+    struct list_elem *e;
+
+    s->jid = job->jid;
+    s->pgrp = job->pgrp;
+    s->status = job->status;
+    s->nprocs = s->nrunning = 0;
+
+    /* argv strings are hashed with their NULs, so that 'a b' and 'ab'
+     * differ; so are the separators, which are not part of any argv */
+    for (e = list_begin(&job->commands); e != list_end(&job->commands);
+         e = list_next(e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        char **argv;
+
+        s->nprocs++;
+        if (!cmd->completed && !cmd->stopped)
+            s->nrunning++;
+
+        if (e != list_begin(&job->commands))
+            append(s->command, &len, " | ", &digest);
+        for (argv = cmd->argv; *argv; argv++) {
+            if (argv != cmd->argv)
+                append(s->command, &len, " ", &digest);
+            append(s->command, &len, *argv, &digest);
+        }
+    }
+    s->command[len] = '\0';
+    s->argv_digest = digest;
+    s->started_ns = job->started.tv_sec * 1000000000ULL + job->started.tv_nsec;
+
+    s->utime_us = timeval_us(job->rusage.ru_utime);
+    s->stime_us = timeval_us(job->rusage.ru_stime);
+    s->maxrss_kb = job->rusage.ru_maxrss;
+    s->minflt = job->rusage.ru_minflt;
+    s->majflt = job->rusage.ru_majflt;
+    s->nvcsw = job->rusage.ru_nvcsw;
+    s->nivcsw = job->rusage.ru_nivcsw;
+}
+
+/* Copy the job table to the snapshot, if it is on */
+void
+esh_snapshot_update(void)
+{
+    if (snapshot == NULL)
+        return;
+
+    uint64_t seq = snapshot->seq;
+    __atomic_store_n(&snapshot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    struct list *jobs = esh_get_jobs();
+    struct list_elem *e;
+    int n = 0;
+
+    for (e = list_begin(jobs); e != list_end(jobs); e = list_next(e), n++)
+        if (n < ESH_SNAPSHOT_JOBS)
+            snapshot_job(&snapshot->jobs[n],
+                         list_entry(e, struct esh_pipeline, elem));
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    snapshot->updated_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    snapshot->updates++;
+    snapshot->njobs = n;
+    snapshot->nlisted = n < ESH_SNAPSHOT_JOBS ? n : ESH_SNAPSHOT_JOBS;
+
+    __atomic_store_n(&snapshot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * Start publishing the job table.  Returns false, with errno set, if
+ * the shared memory object cannot be created.  It can only be read by
+ * the shell's user, since command lines may hold secrets.
+ */
+bool
+esh_snapshot_start(void)
+{
+    static bool registered;
+
+    if (snapshot != NULL)
+        return true;
+
+    esh_snapshot_name(name, sizeof name, getpid());
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return false;
+
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, sizeof *snapshot) == 0)
+        map = mmap(NULL, sizeof *snapshot, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        shm_unlink(name);
+        return false;
+    }
+
+    snapshot = map;
+    snapshot->version = ESH_SNAPSHOT_VERSION;
+    snapshot->size = sizeof *snapshot;
+    snapshot->pid = getpid();
+    snapshot->alive = 1;
+    esh_snapshot_update();
+    /* Set last, so that readers never map a half initialized one */
+    __atomic_store_n(&snapshot->magic, ESH_SNAPSHOT_MAGIC, __ATOMIC_RELEASE);
+
+    if (!registered) {
+        atexit(esh_snapshot_stop);
+        registered = true;
+    }
+    return true;
+}
+
+/* Stop publishing the job table, and remove the snapshot.  Readers
+ * that still have it mapped see that the shell is gone. */
+void
+esh_snapshot_stop(void)
+{
+    if (snapshot == NULL)
+        return;
+
+    uint64_t seq = snapshot->seq;
+    __atomic_store_n(&snapshot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    snapshot->alive = 0;
+    __atomic_store_n(&snapshot->seq, seq + 2, __ATOMIC_RELEASE);
+
+    munmap(snapshot, sizeof *snapshot);
+    snapshot = NULL;
+    shm_unlink(name);
+}
+
+/* Print whether the job table is published, and where */
+void
+esh_snapshot_print(void)
+{
+    if (snapshot == NULL)
+        printf("snapshot off\n");
+    else
+        printf("snapshot /dev/shm%s, %lu updates\n", name,
+               (unsigned long) snapshot->updates);
+}
@@ -0,0 +1,85 @@
+/*
+ * esh - the 'extensible' shell.
+ *
+ * The snapshot of its job table a shell publishes in shared memory, for
+ * monitoring programs.  This header does not depend on esh.h, so that
+ * such programs can include it alone and link esh-snapshot-read.o (or
+ * libesh.a, from which nothing else is then pulled in).
+ *
+ * The snapshot of shell 'pid' is the POSIX shared memory object named
+ * by esh_snapshot_name().  The shell updates it under a seqlock: 'seq'
+ * is odd while an update is under way, and changes with every update.
+ * A reader copies the snapshot and retries if 'seq' was odd or changed
+ * meanwhile, so once it is mapped, reading it takes no system calls.
+ */
+#ifndef _ESH_SNAPSHOT_H
+#define _ESH_SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define ESH_SNAPSHOT_MAGIC 0x45534853       /* "ESHS" */
+#define ESH_SNAPSHOT_VERSION 1
+#define ESH_SNAPSHOT_JOBS 64        /* jobs listed; others are only counted */
+#define ESH_SNAPSHOT_COMMAND 128    /* bytes of command text kept per job */
+
+/* Job status; the same values as enum job_status in esh.h */
+enum esh_snapshot_status {
+    ESH_SNAPSHOT_FOREGROUND,
+    ESH_SNAPSHOT_BACKGROUND,
+    ESH_SNAPSHOT_STOPPED,
+    ESH_SNAPSHOT_NEEDSTERMINAL,
+};
+
+struct esh_snapshot_job {
+    int32_t jid;
+    int32_t pgrp;
+    int32_t status;                 /* enum esh_snapshot_status */
+    int32_t nprocs;                 /* processes in the pipeline */
+    int32_t nrunning;               /* of which not terminated nor stopped */
+    int32_t reserved;
+    uint64_t argv_digest;           /* 64-bit FNV-1a of every argv */
+    uint64_t started_ns;            /* CLOCK_MONOTONIC */
+    /* Resources used by its terminated processes, as in getrusage(2) */
+    uint64_t utime_us, stime_us;
+    int64_t maxrss_kb, minflt, majflt, nvcsw, nivcsw;
+    char command[ESH_SNAPSHOT_COMMAND];     /* "argv | argv", truncated */
+};
+
+struct esh_snapshot {
+    uint32_t magic;                 /* ESH_SNAPSHOT_MAGIC */
+    uint32_t version;               /* ESH_SNAPSHOT_VERSION */
+    uint32_t size;                  /* sizeof (struct esh_snapshot) */
+    int32_t pid;                    /* of the shell */
+    uint64_t seq;                   /* odd while being updated */
+    uint64_t updates;               /* updates so far */
+    uint64_t updated_ns;            /* time of the last, CLOCK_MONOTONIC */
+    int32_t alive;                  /* cleared when the shell exits */
+    int32_t njobs;                  /* jobs in the table */
+    int32_t nlisted;                /* of which listed below, oldest first */
+    int32_t reserved;
+    struct esh_snapshot_job jobs[ESH_SNAPSHOT_JOBS];
+};
+
+/* Write the shared memory object name of shell pid's snapshot */
+void esh_snapshot_name(char *name, size_t size, pid_t pid);
+
+/* Map the snapshot of shell 'pid' read-only.  Returns NULL, with errno
+ * set, if there is none or it has an unknown layout. */
+const struct esh_snapshot * esh_snapshot_map(pid_t pid);
+
+/* Unmap a snapshot */
+void esh_snapshot_unmap(const struct esh_snapshot *snapshot);
+
+/*
+ * Copy a consistent snapshot from the shared 'snapshot' into 'copy';
+ * only the listed jobs are copied.  Makes no system calls.  Returns
+ * false if the shell has exited, or if it seems to have died during an
+ * update (errno is EAGAIN then).
+ */
+bool esh_snapshot_read(const struct esh_snapshot *snapshot,
+                       struct esh_snapshot *copy);
+
+#endif /* esh-snapshot.h */
@@ -0,0 +1,375 @@
+/*
+ * esh-spawn.c
+ * Launch the processes that make up a pipeline.
+ *
+ * Two engines are provided.  The default one is built on posix_spawn(3),
+ * which glibc implements with clone(CLONE_VFORK): the parent's page
+ * tables are never copied, so launch cost does not grow with the size
+ * of the shell.  The 'fork' engine uses plain fork(2)/execv(3) and is
+ * kept for comparison and as a fallback.
+ *
+ * In both engines the parent computes everything a child needs up front
+ * (see struct spawn_stage); the child never touches the esh_pipeline.
+ * Commands are resolved against $PATH in the parent (see esh-path.c),
+ * so a command that does not exist is reported before anything is
+ * started.
+ *
+ * Here-documents and here-strings are written by the parent to a sealed
+ * memfd, which becomes the child's stdin like a pipe end would.  No file
+ * is created, no process is needed to feed it, and as it is a regular
+ * file the child can read it at its own pace, or seek or map it.  The
+ * text is then dropped from the command, so that the copies the job
+ * table keeps of it stay small.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "esh-sys-utils.h"
+#include "esh.h"
+
+extern char **environ;
+
+/* Engine used by esh_spawn_pipeline() */
+enum esh_spawn_engine esh_spawn_engine = ESH_SPAWN_POSIX;
+
+/* Mode for files created by output redirection */
+#define REDIRECT_MODE (S_IRUSR | S_IRGRP | S_IWGRP | S_IWUSR)
+
+/* Signals a child must see with their default disposition. */
+static const int child_default_signals[] = {
+    SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD
+};
+
+/* Everything a child needs to set itself up, computed by the parent. */
+struct spawn_stage {
+    const char *path;           /* resolved location of argv[0] */
+    char **argv;
+    int in_fd;                  /* pipe end to install as stdin, or -1 */
+    int out_fd;                 /* pipe end to install as stdout, or -1 */
+    char *iored_input;          /* file to open as stdin, or NULL */
+    char *iored_output;         /* file to open as stdout, or NULL */
+    bool append_to_output;
+    pid_t pgrp;                 /* 0 makes the child a group leader */
+    int tty_fd;                 /* if not -1, move the group into the
+                                   foreground on this terminal */
+};
+
+/* Translate an engine name as given on the command line.
+ * Returns false if the name is not recognized. */
+bool
+esh_spawn_set_engine(const char *name)
+{
+    if (!strcmp(name, "spawn"))
+        esh_spawn_engine = ESH_SPAWN_POSIX;
+    else if (!strcmp(name, "fork"))
+        esh_spawn_engine = ESH_SPAWN_FORK;
+    else
+        return false;
+    return true;
+}
+
+/* Launch one stage via posix_spawn().  Returns pid or -1. */
+static pid_t
+spawn_stage_posix(struct spawn_stage *stage)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t mask;
+    pid_t pid;
+    int rc;
+    unsigned i;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+    /* All pipe ends are close-on-exec; dup2 clears the flag on the copy. */
+    if (stage->in_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, stage->in_fd, 0);
+    if (stage->out_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, stage->out_fd, 1);
+
+    if (stage->iored_input)
+        posix_spawn_file_actions_addopen(&actions, 0, stage->iored_input,
+                                         O_RDONLY, 0);
+    if (stage->iored_output)
+        posix_spawn_file_actions_addopen(&actions, 1, stage->iored_output,
+                O_WRONLY | O_CREAT |
+                (stage->append_to_output ? O_APPEND : O_TRUNC),
+                REDIRECT_MODE);
+
+#ifdef __GLIBC_PREREQ
+#if __GLIBC_PREREQ(2, 35)
+    /* Runs after setpgid with all signals blocked, so no SIGTTOU. */
+    if (stage->tty_fd != -1)
+        posix_spawn_file_actions_addtcsetpgrp_np(&actions, stage->tty_fd);
+#endif
+#endif
+
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    for (i = 0; i < sizeof child_default_signals / sizeof (int); i++)
+        sigaddset(&mask, child_default_signals[i]);
+    posix_spawnattr_setsigdefault(&attr, &mask);
+    posix_spawnattr_setpgroup(&attr, stage->pgrp);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP
+                                    | POSIX_SPAWN_SETSIGMASK
+                                    | POSIX_SPAWN_SETSIGDEF);
+
+    /* Returns once the child has exec'd, or failed to */
+    uint64_t start = esh_stats_now();
+    rc = posix_spawn(&pid, stage->path, &actions, &attr,
+                     stage->argv, environ);
+    if (rc == 0)
+        esh_stats_add_since(ESH_STAT_EXEC, start);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (rc != 0) {
+        errno = rc;
+        esh_sys_error("%s: ", stage->argv[0]);
+        return -1;
+    }
+    return pid;
+}
+
+/* Install file 'path' as file descriptor 'fd' in a forked child.
+ * Returns false on failure. */
+static bool
+child_redirect(int fd, char *path, int flags)
+{
+    int nfd = open(path, flags, REDIRECT_MODE);
+    if (nfd == -1 || dup2(nfd, fd) == -1) {
+        esh_sys_error("%s: ", path);
+        return false;
+    }
+    close(nfd);
+    return true;
+}
+
+/*
+ * Launch one stage via fork() and execv().  Returns pid or -1.
+ * Like posix_spawn(), returns only once the child has exec'd or given
+ * up: the child holds the write end of a close-on-exec pipe, and
+ * writes to it if it fails.
+ */
+static pid_t
+spawn_stage_fork(struct spawn_stage *stage)
+{
+    int execfds[2];
+    if (pipe2(execfds, O_CLOEXEC) == -1) {
+        esh_sys_error("pipe: ");
+        return -1;
+    }
+
+    uint64_t start = esh_stats_now();
+    pid_t pid = fork();
+    if (pid == -1) {
+        esh_sys_error("Fork Error ");
+        close(execfds[0]);
+        close(execfds[1]);
+        return -1;
+    }
+
+    if (pid > 0) {
+        char failed;
+        ssize_t n;
+
+        close(execfds[1]);
+        while ((n = read(execfds[0], &failed, 1)) == -1 && errno == EINTR)
+            continue;
+        if (n == 0)
+            esh_stats_add_since(ESH_STAT_EXEC, start);
+        close(execfds[0]);
+        return pid;
+    }
+
+    /* child */
+    sigset_t mask;
+    unsigned i;
+
+    close(execfds[0]);
+    if (setpgid(0, stage->pgrp) < 0) {
+        esh_sys_error("Error Setting Process Group ");
+        goto fail;
+    }
+
+    /* SIGTTOU is still blocked from the parent. */
+    if (stage->tty_fd != -1)
+        tcsetpgrp(stage->tty_fd, getpgrp());
+
+    for (i = 0; i < sizeof child_default_signals / sizeof (int); i++)
+        signal(child_default_signals[i], SIG_DFL);
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+
+    if (stage->in_fd != -1)
+        dup2(stage->in_fd, 0);
+    if (stage->out_fd != -1)
+        dup2(stage->out_fd, 1);
+
+    if (stage->iored_input
+        && !child_redirect(0, stage->iored_input, O_RDONLY))
+        goto fail;
+    if (stage->iored_output
+        && !child_redirect(1, stage->iored_output, O_WRONLY | O_CREAT |
+                           (stage->append_to_output ? O_APPEND : O_TRUNC)))
+        goto fail;
+
+    execv(stage->path, stage->argv);
+    esh_sys_error("%s: ", stage->argv[0]);
+fail:
+    if (write(execfds[1], "", 1) < 0)
+        perror("esh: write");
+    _exit(EXIT_FAILURE);
+}
+
+/* Return a sealed memfd that holds 'text', open for reading from its
+ * start, or -1 on failure */
+static int
+heredoc_fd(const char *text)
+{
+    size_t len = strlen(text), done = 0;
+    int fd = memfd_create("esh-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    if (fd == -1) {
+        esh_sys_error("memfd_create: ");
+        return -1;
+    }
+    while (done < len) {
+        ssize_t n = write(fd, text + done, len - done);
+        if (n == -1 && errno != EINTR) {
+            esh_sys_error("here-document: ");
+            close(fd);
+            return -1;
+        }
+        done += n > 0 ? n : 0;
+    }
+
+    /* The child sees exactly 'text', whatever it does to the file */
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE
+                           | F_SEAL_SEAL);
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+/*
+ * Launch all commands of 'pipe' in a new process group.
+ * If tty_fd is not -1, the group becomes the terminal's foreground group.
+ *
+ * Sets pipe->pgrp and the pid of each command that was started
+ * (0 for commands that could not be started), and clears their
+ * here-documents.
+ * Returns the number of processes started; nothing is started if
+ * any command cannot be found.
+ * Must be called with SIGCHLD blocked.
+ */
+int
+esh_spawn_pipeline(struct esh_pipeline *pipe, int tty_fd)
+{
+    int started = 0, i = 0, n = list_size(&pipe->commands);
+    int next_in = -1;
+    struct list_elem *e;
+    char *paths[n];
+
+    for (e = list_begin(&pipe->commands); e != list_end(&pipe->commands);
+         e = list_next(e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        const char *path = esh_path_lookup(cmd->argv[0]);
+
+        if (path == NULL) {
+            fprintf(stderr, "esh: %s: command not found\n", cmd->argv[0]);
+            while (i > 0)
+                free(paths[--i]);
+            return 0;
+        }
+        paths[i++] = strdup(path);
+    }
+
+    pipe->pgrp = 0;
+    i = 0;
+
+    bool blocked = esh_signal_block(SIGTTOU);
+    for (e = list_begin(&pipe->commands); e != list_end(&pipe->commands);
+         e = list_next(e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        int fds[2] = { -1, -1 };
+
+        if (list_next(e) != list_end(&pipe->commands)
+            && pipe2(fds, O_CLOEXEC) == -1) {
+            esh_sys_error("pipe: ");
+            break;
+        }
+
+        /* Only the first command can have one; see esh-grammar.y */
+        int text_fd = cmd->heredoc ? heredoc_fd(cmd->heredoc) : -1;
+        if (cmd->heredoc != NULL && text_fd == -1) {
+            if (fds[0] != -1) {
+                close(fds[0]);
+                close(fds[1]);
+            }
+            break;
+        }
+
+        struct spawn_stage stage = {
+            .path = paths[i++],
+            .argv = cmd->argv,
+            .in_fd = text_fd != -1 ? text_fd : next_in,
+            .out_fd = fds[1],
+            .iored_input = cmd->iored_input,
+            .iored_output = cmd->iored_output,
+            .append_to_output = cmd->append_to_output,
+            .pgrp = pipe->pgrp,
+            .tty_fd = pipe->pgrp == 0 ? tty_fd : -1,
+        };
+
+        uint64_t start = esh_stats_now();
+        ESH_TRACE_BEGIN(ESH_TRACE_SPAWN, 0, cmd->argv[0]);
+        pid_t pid = esh_spawn_engine == ESH_SPAWN_FORK
+                    ? spawn_stage_fork(&stage)
+                    : spawn_stage_posix(&stage);
+        ESH_TRACE_END(ESH_TRACE_SPAWN, pid, cmd->argv[0]);
+        if (pid > 0)
+            esh_stats_add_since(ESH_STAT_SPAWN, start);
+
+        if (next_in != -1)
+            close(next_in);
+        if (text_fd != -1) {
+            close(text_fd);
+            cmd->heredoc = NULL;
+        }
+        if (fds[1] != -1)
+            close(fds[1]);
+        next_in = fds[0];
+
+        cmd->pid = pid > 0 ? pid : 0;
+        if (pid <= 0)
+            continue;
+
+        /* Also done here to close the race with the forked child. */
+        if (pipe->pgrp == 0)
+            pipe->pgrp = pid;
+        setpgid(pid, pipe->pgrp);
+        started++;
+    }
+
+    if (next_in != -1)
+        close(next_in);
+    for (i = 0; i < n; i++)
+        free(paths[i]);
+
+    if (started > 0 && tty_fd != -1)
+        tcsetpgrp(tty_fd, pipe->pgrp);
+    if (!blocked)
+        esh_signal_unblock(SIGTTOU);
+
+    return started;
+}
@@ -0,0 +1,20 @@
+/*
+ * esh-static-plugin.h
+ * Registration of plugins linked into esh.
+ *
+ * The Makefile compiles each plugin listed in STATIC_PLUGINS with this
+ * header included first, and with its 'esh_module' and 'esh_module_abi'
+ * renamed so that several plugins can be linked together.  The
+ * constructor below registers the plugin before main() runs, in place
+ * of loading it with dlopen().
+ */
+#include "esh.h"
+
+extern struct esh_plugin esh_module;
+extern const int esh_module_abi __attribute__((weak));
+
+static void __attribute__((constructor))
+esh_static_plugin_register(void)
+{
+    esh_plugin_register_static(&esh_module, &esh_module_abi);
+}
@@ -0,0 +1,295 @@
+/*
+ * esh-stats.c
+ * Always-on latency histograms of the shell's hot paths.
+ *
+ * Each histogram has log-linear buckets, as in HdrHistogram: every
+ * power of two is split into 8 buckets, so that a value is known to
+ * within 12.5% whatever its magnitude, from nanoseconds to hours, in a
+ * fixed 4 KB.  Recording is a few relaxed atomic operations, since the
+ * prompt worker records plugin hooks, too.
+ *
+ * The histograms can also be written periodically to a file in the
+ * Prometheus text format, e.g. for node_exporter's textfile collector.
+ * The file is replaced atomically, so that it is never read half
+ * written.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "esh-sys-utils.h"
+#include "esh.h"
+
+#define SUB_BITS 3
+#define SUB (1 << SUB_BITS)                 /* buckets per power of two */
+#define NBUCKETS ((64 - SUB_BITS + 1) * SUB)
+
+#define STATS_DEFAULT_INTERVAL 15           /* seconds between exports */
+
+struct histogram {
+    uint64_t counts[NBUCKETS];
+    uint64_t count, sum, min, max;          /* in ns */
+};
+
+static struct histogram histograms[ESH_STAT_N];
+
+static const struct {
+    const char *name;
+    const char *help;
+} stat_info[ESH_STAT_N] = {
+    [ESH_STAT_SPAWN] = { "spawn", "Time to launch one process of a pipeline" },
+    [ESH_STAT_EXEC] = { "exec", "Time from fork to successful exec" },
+    [ESH_STAT_PARSE] = { "parse", "Time to parse a command line" },
+    [ESH_STAT_PLUGIN] = { "plugin", "Time spent in one plugin hook" },
+    [ESH_STAT_TERMINAL] = { "terminal", "Time to hand over the terminal" },
+    [ESH_STAT_PROMPT] = { "prompt", "Time from ready for input to prompt shown" },
+};
+
+static char *export_path;
+static int export_interval = STATS_DEFAULT_INTERVAL;
+static int tfd = -1;
+
+/* Return the CLOCK_MONOTONIC time in ns */
+uint64_t
+esh_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Return the bucket of value v */
+static int
+bucket_of(uint64_t v)
+{
+    if (v < SUB)
+        return v;
+
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - SUB_BITS;
+    return (shift + 1) * SUB + ((v >> shift) & (SUB - 1));
+}
+
+/* Return the largest value that falls into bucket b */
+static uint64_t
+bucket_max(int b)
+{
+    if (b < SUB)
+        return b;
+
+    int shift = b / SUB - 1;
+    uint64_t low = (uint64_t) (SUB + b % SUB) << shift;
+    return low + ((uint64_t) 1 << shift) - 1;
+}
+
+/* Record a value of ns nanoseconds */
+void
+esh_stats_add(enum esh_stat stat, uint64_t ns)
+{
+    struct histogram *h = &histograms[stat];
+
+    __atomic_fetch_add(&h->counts[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+
+    /* A minimum of 0 means none yet; a real 0 is never replaced */
+    uint64_t min = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    while ((min == 0 || ns < min)
+           && !__atomic_compare_exchange_n(&h->min, &min, ns, true,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        continue;
+
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&h->max, &max, ns, true,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        continue;
+}
+
+/* Record the time since 'start', as returned by esh_stats_now() */
+void
+esh_stats_add_since(enum esh_stat stat, uint64_t start)
+{
+    esh_stats_add(stat, esh_stats_now() - start);
+}
+
+/* Return the value below which fraction q of the values lie, as the
+ * largest value of its bucket, but no more than the maximum */
+static uint64_t
+quantile(struct histogram *h, double q)
+{
+    uint64_t rank = q * h->count + 0.5, seen = 0;
+    int b;
+
+    if (rank == 0)
+        rank = 1;
+    for (b = 0; b < NBUCKETS; b++) {
+        seen += h->counts[b];
+        if (seen >= rank)
+            return bucket_max(b) < h->max ? bucket_max(b) : h->max;
+    }
+    return h->max;
+}
+
+/* Print count, mean, percentiles and maximum of each histogram, in us */
+void
+esh_stats_print(void)
+{
+    int i;
+
+    printf("%-10s %8s %10s %10s %10s %10s %10s %10s\n", "(us)", "count",
+           "min", "mean", "p50", "p90", "p99", "max");
+    for (i = 0; i < ESH_STAT_N; i++) {
+        struct histogram *h = &histograms[i];
+        if (h->count == 0) {
+            printf("%-10s %8d\n", stat_info[i].name, 0);
+            continue;
+        }
+        printf("%-10s %8lu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+               stat_info[i].name, (unsigned long) h->count, h->min / 1e3,
+               (double) h->sum / h->count / 1e3, quantile(h, .5) / 1e3,
+               quantile(h, .9) / 1e3, quantile(h, .99) / 1e3, h->max / 1e3);
+    }
+}
+
+/* Forget all recorded values */
+void
+esh_stats_reset(void)
+{
+    memset(histograms, 0, sizeof histograms);
+}
+
+/* Write the histograms in the Prometheus text format.  Buckets are
+ * 1, 2.5 and 5 times each power of ten from 1 us to 10 s. */
+static void
+write_prometheus(FILE *out)
+{
+    int pid = getpid(), i;
+
+    for (i = 0; i < ESH_STAT_N; i++) {
+        struct histogram *h = &histograms[i];
+        const char *name = stat_info[i].name;
+        uint64_t below = 0, decade;
+        int b = 0, m;
+
+        fprintf(out, "# HELP esh_%s_seconds %s.\n", name, stat_info[i].help);
+        fprintf(out, "# TYPE esh_%s_seconds histogram\n", name);
+        for (decade = 1000; decade <= 10000000000ULL; decade *= 10) {
+            for (m = 0; m < 3; m++) {
+                uint64_t le = decade * (m == 0 ? 2 : m == 1 ? 5 : 10) / 2;
+                if (m > 0 && decade == 10000000000ULL)
+                    break;
+                for (; b < NBUCKETS && bucket_max(b) <= le; b++)
+                    below += h->counts[b];
+                fprintf(out,
+                        "esh_%s_seconds_bucket{pid=\"%d\",le=\"%g\"} %lu\n",
+                        name, pid, le / 1e9, (unsigned long) below);
+            }
+        }
+        fprintf(out, "esh_%s_seconds_bucket{pid=\"%d\",le=\"+Inf\"} %lu\n",
+                name, pid, (unsigned long) h->count);
+        fprintf(out, "esh_%s_seconds_sum{pid=\"%d\"} %.9f\n",
+                name, pid, h->sum / 1e9);
+        fprintf(out, "esh_%s_seconds_count{pid=\"%d\"} %lu\n",
+                name, pid, (unsigned long) h->count);
+    }
+}
+
+/* Write the histograms to the export file, via a temporary file that
+ * replaces it.  Returns false on failure. */
+static bool
+export_now(void)
+{
+    char tmp[strlen(export_path) + 32];
+    snprintf(tmp, sizeof tmp, "%s.%d.tmp", export_path, (int) getpid());
+
+    FILE *out = fopen(tmp, "w");
+    if (out == NULL)
+        return false;
+
+    write_prometheus(out);
+    if (fclose(out) != 0 || rename(tmp, export_path) != 0) {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+/* Arm the export timer, or disarm it if there is no export file */
+static void
+arm_timer(void)
+{
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+    if (export_path != NULL) {
+        its.it_interval.tv_sec = export_interval;
+        its.it_value.tv_sec = export_interval;
+    }
+    timerfd_settime(esh_stats_timerfd(), 0, &its, NULL);
+}
+
+/* Write the histograms a last time when esh exits */
+static void
+export_at_exit(void)
+{
+    if (export_path != NULL)
+        export_now();
+}
+
+/*
+ * Write the histograms to 'path' now, then every 'interval' seconds
+ * (0 for the default) while the shell waits for input, and when it
+ * exits.  Stop writing them if 'path' is NULL.  Returns false if the
+ * file cannot be written.
+ */
+bool
+esh_stats_export(const char *path, int interval)
+{
+    static bool registered;
+    if (!registered) {
+        atexit(export_at_exit);
+        registered = true;
+    }
+
+    free(export_path);
+    export_path = path ? strdup(path) : NULL;
+    export_interval = interval > 0 ? interval : STATS_DEFAULT_INTERVAL;
+    arm_timer();
+
+    return export_path == NULL || export_now();
+}
+
+/* Return the timerfd that expires when the histograms are to be
+ * exported */
+int
+esh_stats_timerfd(void)
+{
+    if (tfd == -1) {
+        tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (tfd == -1)
+            esh_sys_fatal_error("timerfd_create: ");
+    }
+    return tfd;
+}
+
+/* Consume the timerfd and export the histograms */
+void
+esh_stats_timer_expired(void)
+{
+    uint64_t expirations;
+
+    if (read(esh_stats_timerfd(), &expirations, sizeof expirations) > 0
+        && export_path != NULL && !export_now())
+        esh_sys_error("esh: stats: %s: ", export_path);
+}
+
+/* Print where the histograms are exported to, if anywhere */
+void
+esh_stats_print_export(void)
+{
+    if (export_path != NULL)
+        printf("exported to %s every %d s\n", export_path, export_interval);
+}
@@ -154,3 +154,85 @@ esh_signal_sethandler(int sig, sa_sigaction_t handler)
     if (sigaction(sig, &sa, NULL) != 0)
         esh_sys_fatal_error("sigaction failed for signal %d", sig);
 }
+
+/* Initial size of an input reader's buffer; it grows for longer lines */
+#define READER_BUFSIZE  (64 * 1024)
+
+struct esh_reader {
+    int fd;
+    char *buf;
+    size_t size;        /* allocated size of buf */
+    size_t start;       /* first unconsumed byte */
+    size_t end;         /* end of data read so far */
+    bool eof;
+};
+
+/* Create a buffered line reader for file descriptor fd */
+struct esh_reader *
+esh_reader_open(int fd)
+{
+    struct esh_reader *r = malloc(sizeof *r);
+    r->fd = fd;
+    r->size = READER_BUFSIZE;
+    r->buf = malloc(r->size);
+    r->start = r->end = 0;
+    r->eof = false;
+    return r;
+}
+
+/*
+ * Return the next line read from r, without its newline, or NULL at
+ * end of input.  The line is stored in r's buffer and remains valid
+ * until the next call.  Input is read in large blocks rather than
+ * byte by byte.
+ */
+char *
+esh_reader_getline(struct esh_reader *r)
+{
+    for (;;) {
+        char *line = r->buf + r->start;
+        char *nl = memchr(line, '\n', r->end - r->start);
+        if (nl != NULL) {
+            *nl = '\0';
+            r->start = nl + 1 - r->buf;
+            return line;
+        }
+
+        if (r->eof) {
+            if (r->start == r->end)
+                return NULL;
+
+            /* last line lacks a newline; there is always room for a NUL */
+            r->buf[r->end] = '\0';
+            r->start = r->end;
+            return line;
+        }
+
+        /* move the partial line to the front, grow if it fills the buffer */
+        memmove(r->buf, line, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+        if (r->end + 1 == r->size) {
+            r->size *= 2;
+            r->buf = realloc(r->buf, r->size);
+        }
+
+        ssize_t n = read(r->fd, r->buf + r->end, r->size - r->end - 1);
+        if (n > 0) {
+            r->end += n;
+        } else if (n == 0) {
+            r->eof = true;
+        } else if (errno != EINTR) {
+            esh_sys_error("read: ");
+            r->eof = true;
+        }
+    }
+}
+
+/* Deallocate a reader.  Its file descriptor is not closed. */
+void
+esh_reader_close(struct esh_reader *r)
+{
+    free(r->buf);
+    free(r);
+}
@@ -44,3 +44,16 @@ typedef void (*sa_sigaction_t)(int, siginfo_t *, void *);
 
 /* Install signal handler for signal 'sig' */
 void esh_signal_sethandler(int sig, sa_sigaction_t handler);
+
+/* Buffered line reader for non-interactive input */
+struct esh_reader;
+
+/* Create a reader for file descriptor 'fd' */
+struct esh_reader * esh_reader_open(int fd);
+
+/* Return next line without its newline, or NULL at end of input.
+ * The line is valid until the next call. */
+char * esh_reader_getline(struct esh_reader *r);
+
+/* Deallocate a reader; does not close its file descriptor */
+void esh_reader_close(struct esh_reader *r);
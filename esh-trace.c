@@ -0,0 +1,257 @@
+/*
+ * esh-trace.c
+ * A trace of what the shell does, for finding out where time goes.
+ *
+ * Events are recorded into a ring buffer with a timestamp and the
+ * thread that recorded them; once the ring is full, the oldest events
+ * are overwritten.  Recording claims a slot with one atomic increment
+ * and takes no lock, since the prompt worker records events, too.  A
+ * slot's sequence number is written last, so that a slot that is being
+ * written is recognized and skipped when the trace is dumped.
+ *
+ * While tracing is off, each trace point costs a test of
+ * esh_trace_enabled; see ESH_TRACE_EVENT in esh.h.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#include "esh.h"
+
+#define TRACE_DEFAULT_SIZE (1 << 16)
+#define TRACE_DETAIL 32
+
+const char *esh_trace_names[ESH_TRACE_NEVENTS] = {
+    [ESH_TRACE_LINE] = "line",
+    [ESH_TRACE_PARSE] = "parse",
+    [ESH_TRACE_PLUGIN] = "plugin",
+    [ESH_TRACE_BUILTIN] = "builtin",
+    [ESH_TRACE_SPAWN] = "spawn",
+    [ESH_TRACE_TERMINAL] = "terminal",
+    [ESH_TRACE_WAIT] = "wait",
+    [ESH_TRACE_CHILD] = "child",
+    [ESH_TRACE_PROMPT] = "prompt",
+};
+
+bool esh_trace_enabled;
+
+struct trace_event {
+    unsigned long seq;          /* index in the trace + 1, 0 if unused */
+    uint64_t ns;                /* CLOCK_MONOTONIC */
+    long arg;
+    int tid;
+    char phase;
+    unsigned char ev;
+    char detail[TRACE_DETAIL];  /* truncated */
+};
+
+struct trace_ring {
+    unsigned long head;         /* index of the next event */
+    unsigned long mask;         /* size - 1 */
+    struct trace_event events[];
+};
+
+/* A ring that was replaced is never freed, since the prompt worker
+ * may still be recording into it. */
+static struct trace_ring *ring;
+static unsigned long cleared;   /* events of 'ring' before it are forgotten */
+static uint64_t start_ns;
+static __thread int tid;
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Record an event */
+void
+esh_trace_record(char phase, enum esh_trace_event ev, long arg,
+                 const char *detail)
+{
+    struct trace_ring *r = __atomic_load_n(&ring, __ATOMIC_ACQUIRE);
+    if (r == NULL)
+        return;
+
+    if (tid == 0)
+        tid = syscall(SYS_gettid);
+
+    unsigned long i = __atomic_fetch_add(&r->head, 1, __ATOMIC_RELAXED);
+    struct trace_event *e = &r->events[i & r->mask];
+
+    __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    e->ns = now_ns();
+    e->arg = arg;
+    e->tid = tid;
+    e->phase = phase;
+    e->ev = ev;
+    if (detail) {
+        strncpy(e->detail, detail, TRACE_DETAIL - 1);
+        e->detail[TRACE_DETAIL - 1] = '\0';
+    } else {
+        e->detail[0] = '\0';
+    }
+    __atomic_store_n(&e->seq, i + 1, __ATOMIC_RELEASE);
+}
+
+/* Start recording into a ring of 'size' events, rounded up to a power
+ * of two */
+bool
+esh_trace_start(unsigned size)
+{
+    unsigned long n = 1;
+
+    if (size == 0)
+        size = TRACE_DEFAULT_SIZE;
+    while (n < size)
+        n <<= 1;
+
+    if (ring == NULL || ring->mask + 1 != n) {
+        struct trace_ring *r = calloc(1, sizeof *r + n * sizeof r->events[0]);
+        if (r == NULL)
+            return false;
+        r->mask = n - 1;
+        if (ring == NULL)
+            start_ns = now_ns();
+        cleared = 0;
+        __atomic_store_n(&ring, r, __ATOMIC_RELEASE);
+    }
+
+    esh_trace_enabled = true;
+    return true;
+}
+
+/* Stop recording; what was recorded is kept */
+void
+esh_trace_stop(void)
+{
+    esh_trace_enabled = false;
+}
+
+/* Forget the recorded events */
+void
+esh_trace_clear(void)
+{
+    if (ring != NULL)
+        cleared = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+/* Write s as a JSON string */
+static void
+json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            fprintf(out, "\\u%04x", *s);
+        else
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+/* Copy the event with index i, unless it was overwritten or is being
+ * written.  Returns false if it is not available. */
+static bool
+copy_event(struct trace_ring *r, unsigned long i, struct trace_event *copy)
+{
+    struct trace_event *e = &r->events[i & r->mask];
+
+    if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != i + 1)
+        return false;
+    memcpy(copy, e, sizeof *copy);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&e->seq, __ATOMIC_RELAXED) == i + 1;
+}
+
+/*
+ * Write the events as a JSON object in the Chrome trace event format,
+ * which chrome://tracing and Perfetto load.  Timestamps are in
+ * microseconds since tracing was first started.  Plugin hooks are named
+ * after the hook, with the plugin's file name as an argument.
+ */
+bool
+esh_trace_dump(FILE *out)
+{
+    struct trace_ring *r = __atomic_load_n(&ring, __ATOMIC_ACQUIRE);
+    unsigned long head = r ? __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) : 0;
+    unsigned long i = r && head > r->mask + 1 ? head - r->mask - 1 : 0;
+    if (i < cleared)
+        i = cleared;
+    bool first = true;
+    int pid = getpid();
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (; i < head; i++) {
+        struct trace_event e;
+        if (!copy_event(r, i, &e))
+            continue;
+
+        fprintf(out, "%s\n{\"name\":", first ? "" : ",");
+        first = false;
+        if (e.ev == ESH_TRACE_PLUGIN) {
+            const char *name = esh_plugin_name((struct esh_plugin *) e.arg);
+            json_string(out, e.detail);
+            fprintf(out, ",\"cat\":\"plugin\"");
+            fprintf(out, ",\"args\":{\"plugin\":");
+            json_string(out, name ? name : "(static or unloaded)");
+            fprintf(out, "}");
+        } else {
+            json_string(out, esh_trace_names[e.ev]);
+            fprintf(out, ",\"cat\":\"esh\",\"args\":{\"arg\":%ld", e.arg);
+            if (e.detail[0]) {
+                fprintf(out, ",\"detail\":");
+                json_string(out, e.detail);
+            }
+            fprintf(out, "}");
+        }
+        fprintf(out, ",\"ph\":\"%c\",%s\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+                e.phase, e.phase == 'i' ? "\"s\":\"t\"," : "",
+                (e.ns - start_ns) / 1e3, pid, e.tid);
+    }
+    fprintf(out, "\n]}\n");
+    return fflush(out) == 0 && !ferror(out);
+}
+
+static const char *exit_path;
+
+static void
+dump_at_exit(void)
+{
+    FILE *out = fopen(exit_path, "w");
+    if (out == NULL || !esh_trace_dump(out))
+        perror(exit_path);
+    if (out)
+        fclose(out);
+}
+
+/* Record from now on, and write the trace to 'path' when esh exits */
+void
+esh_trace_dump_at_exit(const char *path)
+{
+    if (!esh_trace_start(0))
+        return;
+    if (exit_path == NULL)
+        atexit(dump_at_exit);
+    exit_path = path;
+}
+
+/* Print whether tracing is on, and how many events were recorded */
+void
+esh_trace_print(void)
+{
+    unsigned long head = ring ? ring->head - cleared : 0;
+    unsigned long size = ring ? ring->mask + 1 : 0;
+
+    printf("tracing %s, %lu events recorded, %lu kept, ring of %lu\n",
+           esh_trace_enabled ? "on" : "off", head,
+           head < size ? head : size, size);
+}
@@ -3,43 +3,44 @@
  * A set of utility routines to manage esh objects.
  */
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
-#include <dirent.h>
-#include <dlfcn.h>
-#include <limits.h>
 
 #include "esh.h"
 
-static const char rcsid [] = "$Id: esh-utils.c,v 1.5 2011/03/29 15:46:28 Exp $";
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
 
-/* List of loaded plugins */
-struct list esh_plugin_list;
+static const char rcsid [] = "$Id: esh-utils.c,v 1.5 2011/03/29 15:46:28 Exp $";
 
-/* Create new command structure and initialize first command word,
- * and/or input or output redirect file. */
+/* Create new command structure in 'arena' and initialize first command
+ * word, and/or input or output redirect file. */
 struct esh_command *
-esh_command_create(char ** argv,
+esh_command_create(struct obstack *arena,
+		   char ** argv,
 		   char *iored_input,
 		   char *iored_output,
 		   bool append_to_output)
 {
-    struct esh_command *cmd = malloc(sizeof *cmd);
+    struct esh_command *cmd = obstack_alloc(arena, sizeof *cmd);
 
     cmd->iored_input = iored_input;
     cmd->iored_output = iored_output;
     cmd->argv = argv;
     cmd->append_to_output = append_to_output;
+    cmd->heredoc = NULL;
 
     return cmd;
 }
 
-/* Create a new pipeline containing only one command */
+/* Create a new pipeline in 'arena' containing only one command */
 struct esh_pipeline *
-esh_pipeline_create(struct esh_command *cmd)
+esh_pipeline_create(struct obstack *arena, struct esh_command *cmd)
 {
-    struct esh_pipeline *pipe = malloc(sizeof *pipe);
+    struct esh_pipeline *pipe = obstack_alloc(arena, sizeof *pipe);
 
     pipe->bg_job = false;
+    pipe->timed = false;
     cmd->pipeline = pipe;
     list_init(&pipe->commands);
     list_push_back(&pipe->commands, &cmd->elem);
@@ -63,24 +64,167 @@ esh_pipeline_finish(struct esh_pipeline *pipe)
     pipe->append_to_output = last->append_to_output;
 }
 
-/* Create an empty command line */
+/* Create an empty command line with an empty arena */
 struct esh_command_line *
 esh_command_line_create_empty(void)
 {
     struct esh_command_line *cmdline = malloc(sizeof *cmdline);
 
     list_init(&cmdline->pipes);
+    obstack_init(&cmdline->arena);
     return cmdline;
 }
 
-/* Create a command line with a single pipeline */
-struct esh_command_line *
-esh_command_line_create(struct esh_pipeline *pipe)
+/* Size of string s including its NUL, or 0 if s is NULL */
+static size_t
+string_size(const char *s)
 {
-    struct esh_command_line *cmdline = esh_command_line_create_empty();
+    return s ? strlen(s) + 1 : 0;
+}
 
-    list_push_back(&cmdline->pipes, &pipe->elem);
-    return cmdline;
+/* Copy string s to *space and advance *space past it */
+static char *
+string_copy(char **space, const char *s)
+{
+    if (s == NULL)
+	return NULL;
+
+    size_t n = strlen(s) + 1;
+    char *copy = memcpy(*space, s, n);
+    *space += n;
+    return copy;
+}
+
+/* Number of commands, argv pointers and string bytes of a pipeline */
+struct pipeline_size {
+    size_t ncmds, nptrs, nchars;
+};
+
+/* Return the size of the block pipeline_copy_into() needs for pipe */
+static size_t
+pipeline_size(struct esh_pipeline *pipe, struct pipeline_size *sz)
+{
+    struct list_elem * e;
+
+    sz->ncmds = sz->nptrs = sz->nchars = 0;
+    for (e = list_begin (&pipe->commands); e != list_end (&pipe->commands);
+	 e = list_next (e)) {
+	struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+	char **p;
+
+	sz->ncmds++;
+	for (p = cmd->argv; *p; p++)
+	    sz->nchars += strlen(*p) + 1;
+	sz->nptrs += p - cmd->argv + 1;
+	sz->nchars += string_size(cmd->iored_input)
+		    + string_size(cmd->iored_output)
+		    + string_size(cmd->heredoc);
+    }
+
+    return sizeof (struct esh_pipeline)
+	   + sz->ncmds * sizeof (struct esh_command)
+	   + sz->nptrs * sizeof (char *)
+	   + sz->nchars;
+}
+
+/*
+ * Copy a pipeline, its commands, their argv arrays and all strings into
+ * the block at 'space', sized by pipeline_size().  The block is laid out
+ * as the pipeline, followed by the commands, then the argv arrays, then
+ * the strings.
+ */
+static struct esh_pipeline *
+pipeline_copy_into(void *space, struct esh_pipeline *pipe,
+		   struct pipeline_size *sz)
+{
+    struct esh_pipeline *copy = space;
+    struct esh_command *cmds = (struct esh_command *) (copy + 1);
+    char **ptrs = (char **) (cmds + sz->ncmds);
+    char *chars = (char *) (ptrs + sz->nptrs);
+    struct list_elem * e;
+
+    *copy = *pipe;
+    list_init(&copy->commands);
+    for (e = list_begin (&pipe->commands); e != list_end (&pipe->commands);
+	 e = list_next (e)) {
+	struct esh_command *cmd = cmds++;
+	char **p;
+
+	*cmd = *list_entry(e, struct esh_command, elem);
+	for (p = cmd->argv, cmd->argv = ptrs; *p; p++)
+	    *ptrs++ = string_copy(&chars, *p);
+	*ptrs++ = NULL;
+	cmd->iored_input = string_copy(&chars, cmd->iored_input);
+	cmd->iored_output = string_copy(&chars, cmd->iored_output);
+	cmd->heredoc = string_copy(&chars, cmd->heredoc);
+	cmd->pipeline = copy;
+	list_push_back(&copy->commands, &cmd->elem);
+    }
+
+    if (sz->ncmds > 0) {
+	copy->iored_input = list_entry(list_front(&copy->commands),
+				       struct esh_command, elem)->iored_input;
+	copy->iored_output = list_entry(list_back(&copy->commands),
+					struct esh_command, elem)->iored_output;
+    }
+    return copy;
+}
+
+/*
+ * Copy a pipeline with its commands and strings into a single malloc'd
+ * block, so that it can outlive the command line it was parsed from.
+ * Deallocate the copy with esh_pipeline_free().
+ */
+struct esh_pipeline *
+esh_pipeline_copy(struct esh_pipeline *pipe)
+{
+    struct pipeline_size sz;
+    return pipeline_copy_into(malloc(pipeline_size(pipe, &sz)), pipe, &sz);
+}
+
+/* Return the size of the block esh_pipeline_copy() makes for pipe */
+size_t
+esh_pipeline_copy_size(struct esh_pipeline *pipe)
+{
+    struct pipeline_size sz;
+    return pipeline_size(pipe, &sz);
+}
+
+/* Return a pointer that points into 'to' where 'p' pointed into 'from' */
+static void *
+relocate(void *p, void *from, void *to)
+{
+    return p ? (char *) to + ((char *) p - (char *) from) : NULL;
+}
+
+/*
+ * Duplicate a pipeline made by esh_pipeline_copy(), whose block is
+ * 'size' bytes, into 'arena'.  As the block is self-contained, this is
+ * a memcpy followed by adjusting the pointers within it.
+ */
+struct esh_pipeline *
+esh_pipeline_dup(struct obstack *arena, struct esh_pipeline *pipe, size_t size)
+{
+    struct esh_pipeline *dup = obstack_copy(arena, pipe, size);
+    struct esh_command *cmd = (struct esh_command *) (dup + 1);
+    size_t i, ncmds = list_size(&pipe->commands);
+
+    list_init(&dup->commands);
+    for (i = 0; i < ncmds; i++, cmd++) {
+	char **p;
+
+	cmd->argv = relocate(cmd->argv, pipe, dup);
+	for (p = cmd->argv; *p; p++)
+	    *p = relocate(*p, pipe, dup);
+	cmd->iored_input = relocate(cmd->iored_input, pipe, dup);
+	cmd->iored_output = relocate(cmd->iored_output, pipe, dup);
+	cmd->heredoc = relocate(cmd->heredoc, pipe, dup);
+	cmd->pipeline = dup;
+	list_push_back(&dup->commands, &cmd->elem);
+    }
+    dup->iored_input = relocate(dup->iored_input, pipe, dup);
+    dup->iored_output = relocate(dup->iored_output, pipe, dup);
+    return dup;
 }
 
 /* Print esh_command structure to stdout */
@@ -102,6 +246,9 @@ esh_command_print(struct esh_command *cmd)
 
     if (cmd->iored_input)
 	printf("  stdin reads from %s\n", cmd->iored_input);
+
+    if (cmd->heredoc)
+	printf("  stdin reads %zu bytes of inline text\n", strlen(cmd->heredoc));
 }
 
 /* Print esh_pipeline structure to stdout */
@@ -140,120 +287,19 @@ esh_command_line_print(struct esh_command_line *cmdline)
 }
 
 /* Deallocation functions. */
+
+/* Release a command line and everything allocated from its arena */
 void
 esh_command_line_free(struct esh_command_line *cmdline)
 {
-    struct list_elem * e = list_begin (&cmdline->pipes);
-
-    for (; e != list_end (&cmdline->pipes); ) {
-	struct esh_pipeline *pipe = list_entry(e, struct esh_pipeline, elem);
-	e = list_remove(e);
-	esh_pipeline_free(pipe);
-    }
+    obstack_free(&cmdline->arena, NULL);
     free(cmdline);
 }
 
+/* Release a pipeline made by esh_pipeline_copy() */
 void
 esh_pipeline_free(struct esh_pipeline *pipe)
 {
-    struct list_elem * e = list_begin (&pipe->commands);
-
-    for (; e != list_end (&pipe->commands); ) {
-	struct esh_command *cmd = list_entry(e, struct esh_command, elem);
-	e = list_remove(e);
-	esh_command_free(cmd);
-    }
     free(pipe);
 }
 
-void
-esh_command_free(struct esh_command * cmd)
-{
-    char ** p = cmd->argv;
-    while (*p) {
-	free(*p++);
-    }
-    if (cmd->iored_input)
-	free(cmd->iored_input);
-    if (cmd->iored_output)
-	free(cmd->iored_output);
-    free(cmd->argv);
-    free(cmd);
-}
-
-#define PSH_MODULE_NAME "esh_module"
-
-/* Load a plugin referred to by modname */
-static struct esh_plugin *
-load_plugin(char *modname)
-{
-    printf("Loading %s ...", modname);
-    fflush(stdout);
-
-    void *handle = dlopen(modname, RTLD_LAZY);
-    if (handle == NULL) {
-	fprintf(stderr, "Could not open %s: %s\n", modname, dlerror());
-	return NULL;
-    }
-
-    struct esh_plugin * p = dlsym(handle, PSH_MODULE_NAME);
-    if (p == NULL) {
-	fprintf(stderr, "%s does not define %s\n", modname, PSH_MODULE_NAME);
-	dlclose(handle);
-	return NULL;
-    }
-
-    printf("done.\n");
-    return p;
-}
-
-static bool sort_by_rank (const struct list_elem *a,
-			  const struct list_elem *b,
-			  void *aux __attribute__((unused)))
-{
-    struct esh_plugin * pa =  list_entry(a, struct esh_plugin, elem);
-    struct esh_plugin * pb =  list_entry(b, struct esh_plugin, elem);
-    return pa->rank < pb->rank;
-}
-
-/* Load plugins from directory dirname */
-void
-esh_plugin_load_from_directory(char *dirname)
-{
-    DIR * dir = opendir(dirname);
-    if (dir == NULL) {
-	perror("opendir");
-	return;
-    }
-
-    struct dirent * dentry;
-    while ((dentry = readdir(dir)) != NULL) {
-	if (!strstr(dentry->d_name, ".so"))
-	    continue;
-
-	char modname[PATH_MAX + 1];
-	snprintf(modname, sizeof modname, "%s/%s", dirname, dentry->d_name);
-
-	struct esh_plugin * plugin = load_plugin(modname);
-	if (plugin)
-	    list_push_back(&esh_plugin_list, &plugin->elem);
-    }
-    closedir(dir);
-}
-
-/* Initialize loaded plugins */
-void
-esh_plugin_initialize(struct esh_shell *shell)
-{
-    /* Sort plugins and call init() method. */
-    list_sort(&esh_plugin_list, sort_by_rank, NULL);
-
-    struct list_elem * e = list_begin(&esh_plugin_list);
-    for (; e != list_end(&esh_plugin_list); e = list_next(e)) {
-	struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem);
-	if (plugin->init)
-	    plugin->init(shell);
-    }
-}
-
-/* TBD: implement unloading. */
@@ -5,51 +5,81 @@
 #include <stdio.h>
 #include <readline/readline.h>
 #include <unistd.h>
+#include <sys/time.h>
 #include <sys/wait.h>
-#include <assert.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <assert.h>
+#include <ctype.h>
+#include <limits.h>
 #include "esh-sys-utils.h"
 #include "esh.h"
 
+/* The terminal state of the shell, restored whenever it takes
+ * back the terminal */
+static struct termios *shell_tty;
+
+/* True while readline's callback handler is installed */
+static bool prompt_active;
+
+/* True once the user typed EOF */
+static bool input_done;
+
+/* The line the user was editing when a control socket request took
+ * down the prompt, put back when the prompt is shown again */
+static char *pending_input;
+static int pending_point;
+
+/* True while a control socket client runs a command line that is to
+ * go to the background as a whole */
+static bool force_background;
+
+/* A command line whose here-documents are being read: its text and the
+ * lines read after it, each followed by a newline, and the words that
+ * end its here-documents.  'words' is NULL if there is none. */
+static struct {
+    char *text;
+    size_t len, size;
+    char **words;
+    size_t nwords;
+    size_t next;            /* the word that ends the current body */
+} heredoc;
+
+/* False when running a script or '-c' command, or when stdin is not
+ * a terminal.  The shell then never touches the terminal. */
+static bool interactive = true;
+
+/* Exit status of the last foreground job, or 2 after a syntax error,
+ * as returned by 'esh -c' */
+static int last_status;
+
 static void
 usage(char *progname)
 {
-    printf("Usage: %s -h\n"
+    printf("Usage: %s [-ah] [-c command | script]\n"
+           " -a            build the prompt asynchronously\n"
            " -h            print this help\n"
-           " -p  plugindir directory from which to load plug-ins\n",
+           " -c  command   run command and exit, without a terminal\n"
+           " -p  plugindir directory from which to load plug-ins\n"
+           " -s  engine    launch jobs with 'spawn' (default) or 'fork'\n"
+           " -C  path      accept requests on control socket 'path'\n"
+           " -l  lexer     parse with 'auto' (default), 'avx2', 'sse2',\n"
+           "               'scalar' or 'flex'\n",
            progname);
 
     exit(EXIT_SUCCESS);
 }
 
 /* Build a prompt by assembling fragments from loaded plugins that
- * implement 'make_prompt.'
- *
- * This function demonstrates how to iterate over all loaded plugins.
+ * implement 'make_prompt.'  See esh-prompt.c.
  */
 static char *
 build_prompt_from_plugins(void)
 {
-    char *prompt = NULL;
-    struct list_elem * e = list_begin(&esh_plugin_list);
-
-    for (; e != list_end(&esh_plugin_list); e = list_next(e)) {
-        struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem);
-
-        if (plugin->make_prompt == NULL) {
-            continue;
-        }
-
-        /* append prompt fragment created by plug-in */
-        char * p = plugin->make_prompt();
-        if (prompt == NULL) {
-            prompt = p;
-        } else {
-            prompt = realloc(prompt, strlen(prompt) + strlen(p) + 1);
-            strcat(prompt, p);
-            free(p);
-        }
-    }
+    char *prompt = esh_prompt_build();
 
     /* default prompt */
     if (prompt == NULL) {
@@ -59,587 +89,1323 @@ build_prompt_from_plugins(void)
     return prompt;
 }
 
+/**
+ * Assign ownership of ther terminal to process group
+ * pgrp, restoring its terminal state if provided.
+ *
+ * Before printing a new prompt, the shell should
+ * invoke this function with its own process group
+ * id (obtained on startup via getpgrp()) and a
+ * sane terminal state (obtained on startup via
+ * esh_sys_tty_init()).
+ *
+ * Taken from Dr. Back's Snippet.
+ *
+ * Does nothing when the shell is not interactive.
+ */
+static void
+give_terminal_to(pid_t pgrp, struct termios *pg_tty_state)
+{
+    if (!interactive) {
+        return;
+    }
+
+    uint64_t start = esh_stats_now();
+    ESH_TRACE_BEGIN(ESH_TRACE_TERMINAL, pgrp, NULL);
+    esh_signal_block(SIGTTOU);
+    int rc = tcsetpgrp(esh_sys_tty_getfd(), pgrp);
+    if (rc == -1) {
+        esh_sys_fatal_error("tcsetpgrp: ");
+    }
+
+    if (pg_tty_state) {
+        esh_sys_tty_restore(pg_tty_state);
+    }
+    esh_signal_unblock(SIGTTOU);
+    ESH_TRACE_END(ESH_TRACE_TERMINAL, pgrp, NULL);
+    esh_stats_add_since(ESH_STAT_TERMINAL, start);
+}
+
 /*
- * Returns the list of current jobs
+ * Notify plugins about a child's status change, then update its job.
+ * Returns the job if it has finished; the caller must deallocate it.
  */
-static struct list * get_jobs(void) {
-    return &current_jobs;
+static struct esh_pipeline * child_status_changed(pid_t pid, int status,
+                                                  struct rusage *rusage)
+{
+    ESH_TRACE_INSTANT(ESH_TRACE_CHILD, pid, WIFSTOPPED(status) ? "stopped"
+                      : WIFSIGNALED(status) ? "signaled"
+                      : WIFEXITED(status) ? "exited" : "continued");
+
+    struct esh_plugin_dispatch *d;
+    d = esh_plugin_subscribers(ESH_PLUGIN_STATUS_CHANGE);
+    if (d->count > 0) {
+        struct esh_command *cmd = esh_get_cmd_from_pid(pid);
+        int i;
+        for (i = 0; cmd != NULL && i < d->count; i++) {
+            struct esh_plugin *plugin = d->plugins[i];
+            ESH_PLUGIN_HOOK(plugin, "command_status_change",
+                            plugin->command_status_change(cmd, status));
+        }
+    }
+
+    esh_prompt_invalidate();
+    return esh_job_change_status(pid, status, rusage);
+}
+
+/* Return the exit status of a job that has finished: that of its last
+ * command, or 128 plus the signal that killed it */
+static int job_exit_status(struct esh_pipeline *job)
+{
+    struct esh_command *last;
+    last = list_entry(list_back(&job->commands), struct esh_command, elem);
+    if (WIFSIGNALED(last->status)) {
+        return 128 + WTERMSIG(last->status);
+    }
+    return WEXITSTATUS(last->status);
+}
+
+/* Report the time a job prefixed with 'time' took once it finished */
+static void report_job_time(struct esh_pipeline *job)
+{
+    if (job->timed) {
+        esh_print_time(esh_job_wall_time(job), &job->rusage);
+    }
 }
 
 /*
- * Searches the pipeline and returns the job corresponding to jid
- * Returns the job, or NULL if not found
+ * Wait for foreground job 'pipeline' until all of its processes have
+ * either terminated or stopped, then take back the terminal.
+ *
+ * Only this job's process group is waited for, so background jobs
+ * changing state do not end the wait early; they stay pending on the
+ * signalfd for the event loop.  Each stage's status is recorded in
+ * its esh_command.
  */
-static struct esh_pipeline * get_job_from_jid(int jid) {
-    struct list_elem *e;
-    for (e = list_begin(&current_jobs); e != list_end(&current_jobs); e = list_next(e)) {
-        struct esh_pipeline *job = list_entry(e, struct esh_pipeline, elem);
-        if (job->jid == jid) {
-            return job;
+static void wait_for_job(struct esh_pipeline *pipeline)
+{
+    pid_t pgrp = pipeline->pgrp;
+    bool waiting = true;
+
+    ESH_TRACE_BEGIN(ESH_TRACE_WAIT, pgrp, NULL);
+    while (waiting) {
+        int status;
+        struct rusage rusage;
+        pid_t pid = wait4(-pgrp, &status, WUNTRACED, &rusage);
+
+        if (pid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;      /* no processes left in the group */
+        }
+
+        struct esh_pipeline *done = child_status_changed(pid, status, &rusage);
+        if (done != NULL) {
+            last_status = job_exit_status(done);
+            report_job_time(done);
+            esh_pipeline_free(done);
+            waiting = false;
+        } else {
+            waiting = !esh_job_is_stopped(pipeline);
         }
     }
+    ESH_TRACE_END(ESH_TRACE_WAIT, pgrp, NULL);
+
+    give_terminal_to(getpgrp(), shell_tty);
+}
+
+/* The shell object plugins use.
+ * Some methods are set to defaults.
+ */
+struct esh_shell shell = {
+    .build_prompt = build_prompt_from_plugins,
+    .readline = readline,       /* GNU readline(3) */
+    .parse_command_line = esh_parse_command_line, /* Default parser */
+    .get_jobs = esh_get_jobs,
+    .get_job_from_jid = esh_get_job_from_jid,
+    .get_job_from_pgrp = esh_get_job_from_pgrp,
+    .get_cmd_from_pid = esh_get_cmd_from_pid,
+    .register_builtin = esh_builtin_register
+};
 
-    return NULL;
+/* The 'exit' builtin: exit with the status given, or else with that
+ * of the last command */
+static int builtin_exit(struct esh_command *cmd)
+{
+    exit(cmd->argv[1] != NULL ? atoi(cmd->argv[1]) : last_status);
 }
 
 /*
- * Searches the pipeline and return the job corresponding to pgrp
- * Returns the job, or NULL if not found
+ * The 'jobs' builtin: list current jobs.  With -v, also list the
+ * resources used by each job and each of its processes, followed by
+ * the jobs that completed most recently and their exit status.
  */
-static struct esh_pipeline * get_job_from_pgrp(pid_t pgrp) {
+static int builtin_jobs(struct esh_command *cmd)
+{
+    char *statusStrings[] = {"Foreground","Running","Stopped", "Needs Terminal"};
+    bool verbose = cmd->argv[1] != NULL && !strcmp(cmd->argv[1], "-v");
     struct list_elem *e;
     for (e = list_begin(&current_jobs); e != list_end(&current_jobs); e = list_next(e)) {
-        struct esh_pipeline *job = list_entry(e, struct esh_pipeline, elem);
-        if (job->pgrp == pgrp) {
-            return job;
+        struct esh_pipeline *pipeline = list_entry(e, struct esh_pipeline, elem);
+        printf("[%d] %s ", pipeline->jid, statusStrings[pipeline->status]);
+        esh_job_print_commands(pipeline);
+        if (verbose) {
+            esh_job_print_usage(pipeline);
         }
     }
 
-    return NULL;
+    struct list *completed = esh_get_completed_jobs();
+    if (verbose && !list_empty(completed)) {
+        printf("Completed:\n");
+        for (e = list_begin(completed); e != list_end(completed); e = list_next(e)) {
+            struct esh_pipeline *pipeline = list_entry(e, struct esh_pipeline, elem);
+            printf("[%d] Done, exit %d ", pipeline->jid, job_exit_status(pipeline));
+            esh_job_print_commands(pipeline);
+            esh_job_print_usage(pipeline);
+        }
+    }
+    return 0;
 }
 
-/* /\* */
-/*  * Searches the commands (processes) and returns the process */
-/*  * corresponding to pid */
-/*  *\/ */
-/* static struct esh_command * get_cmd_from_pid(pid_t pid) */
-/* { */
-/*     // */
-/* } */
-
 /*
- * Prints out the commands for a job
+ * Return the job named by the argument of a job control builtin,
+ * either '%jid' or 'jid', or the most recent job if there is no
+ * argument.  Returns NULL if there is no such job.
  */
-static void print_job_commands(struct list jobs)
+static struct esh_pipeline * job_from_argument(struct esh_command *cmd)
 {
-    struct list_elem *e = list_begin(&jobs);
-    struct esh_pipeline *pipeline = list_entry(e, struct esh_pipeline, elem);
+    if (list_empty(&current_jobs)) {
+        return NULL;
+    }
 
-    printf("(");
-    for (e = list_begin(&pipeline->commands); e != list_end(&pipeline->commands); e = list_next(e)) {
+    int jobid_arg;
+    char *arg = cmd->argv[1];
+    if (arg == NULL) {
+        struct list_elem *e = list_back(&current_jobs);
+        jobid_arg = list_entry(e, struct esh_pipeline, elem)->jid;
+    } else {
+        jobid_arg = atoi(arg[0] == '%' ? arg + 1 : arg);
+    }
+
+    struct esh_pipeline *pipeline = esh_get_job_from_jid(jobid_arg);
+    if (pipeline == NULL) {
+        fprintf(stderr, "esh: %s: no such job\n", cmd->argv[0]);
+    }
+    return pipeline;
+}
 
-        struct esh_command *command = list_entry(e, struct esh_command, elem);
+/* The 'fg' builtin: continue a job in the foreground and wait for it */
+static int builtin_fg(struct esh_command *cmd)
+{
+    struct esh_pipeline *pipeline = job_from_argument(cmd);
+    if (pipeline == NULL) {
+        return 1;
+    }
 
-        char **argv = command->argv;
-        while (*argv) {
-            printf("%s ", *argv);
-            argv++;
-        }
+    esh_job_print_commands(pipeline);
+    give_terminal_to(pipeline->pgrp, shell_tty);
 
-        if (list_size(&pipeline->commands) > 1) {
-            printf("| ");
-        }
+    if (!esh_job_resume(pipeline, FOREGROUND)) {
+        esh_sys_fatal_error("fg error: kill SIGCONT ");
     }
 
-    printf(")\n");
+    wait_for_job(pipeline);
+    return last_status;
 }
 
-static void print_single_job(struct esh_pipeline *pipeline)
+/* The 'bg' builtin: continue a job in the background */
+static int builtin_bg(struct esh_command *cmd)
 {
-    printf("(");
+    struct esh_pipeline *pipeline = job_from_argument(cmd);
+    if (pipeline == NULL) {
+        return 1;
+    }
 
-    struct list_elem *e;
-    for (e = list_begin(&pipeline->commands); e != list_end(&pipeline->commands); e = list_next(e)) {
+    if (!esh_job_resume(pipeline, BACKGROUND)) {
+        esh_sys_fatal_error("SIGCONT Error ");
+    }
 
-        struct esh_command *command = list_entry(e, struct esh_command, elem);
+    esh_job_print_commands(pipeline);
+    return 0;
+}
 
-        char **argv = command->argv;
-        while (*argv) {
-            printf("%s ", *argv);
-            fflush(stdout);
-            argv++;
-        }
+/* The 'kill' builtin: kill a job with SIGKILL */
+static int builtin_kill(struct esh_command *cmd)
+{
+    struct esh_pipeline *pipeline = job_from_argument(cmd);
+    if (pipeline == NULL) {
+        return 1;
+    }
 
-        if (list_size(&pipeline->commands) > 1) {
-            printf("| ");
-        }
+    if (kill(-pipeline->pgrp, SIGKILL) < 0) {
+        esh_sys_fatal_error("SIGKILL Error ");
+    }
+    return 0;
+}
+
+/* The 'stop' builtin: stop a job with SIGSTOP */
+static int builtin_stop(struct esh_command *cmd)
+{
+    struct esh_pipeline *pipeline = job_from_argument(cmd);
+    if (pipeline == NULL) {
+        return 1;
     }
 
-    printf(")\n");
+    if (kill(-pipeline->pgrp, SIGSTOP) < 0) {
+        esh_sys_fatal_error("SIGSTOP Error ");
+    }
+    return 0;
 }
 
 /*
- * Change the status of a given job
+ * The 'hash' builtin: list remembered command locations, forget them
+ * with -r, or look up the given names ahead of time.
  */
-static void change_job_status(pid_t pid, int status)
+static int builtin_hash(struct esh_command *cmd)
 {
-    if (pid > 0) {
+    char **argv = cmd->argv;
+    int status = 0;
 
-        struct list_elem *e;
-        for (e = list_begin(&current_jobs); e != list_end(&current_jobs); e = list_next(e)) {
+    if (argv[1] == NULL) {
+        esh_path_print();
+        return 0;
+    }
 
-            struct esh_pipeline *pipeline = list_entry(e, struct esh_pipeline, elem);
+    if (!strcmp(argv[1], "-r")) {
+        esh_path_clear();
+        return 0;
+    }
 
-            if (pipeline->pgrp == pid) {
+    for (argv++; *argv; argv++) {
+        if (esh_path_lookup(*argv) == NULL) {
+            fprintf(stderr, "esh: hash: %s: not found\n", *argv);
+            status = 1;
+        }
+    }
+    return status;
+}
 
-                if (WIFSTOPPED(status)) {
+/*
+ * The 'parsecache' builtin: print statistics of the parse cache,
+ * clear it with -r, or set its size with -s.
+ */
+static int builtin_parsecache(struct esh_command *cmd)
+{
+    char **argv = cmd->argv;
+
+    if (argv[1] == NULL) {
+        esh_parse_cache_print();
+    } else if (!strcmp(argv[1], "-r")) {
+        esh_parse_cache_clear();
+    } else if (!strcmp(argv[1], "-s") && argv[2] != NULL) {
+        esh_parse_cache_set_limit(atoi(argv[2]));
+    } else {
+        fprintf(stderr, "usage: parsecache [-r | -s size]\n");
+        return 2;
+    }
+    return 0;
+}
 
-                    if (WSTOPSIG(status) == 22) {
-                        pipeline->status = STOPPED;
-                    }
+/*
+ * The 'prompt' builtin: print prompt latency, switch between building
+ * the prompt in 'sync' or 'async' mode, or set the async mode's
+ * deadline (-d) or the lifetime of cached fragments (-t), in ms.
+ */
+static int builtin_prompt(struct esh_command *cmd)
+{
+    char **argv = cmd->argv;
+
+    if (argv[1] == NULL) {
+        esh_prompt_print();
+    } else if (!strcmp(argv[1], "sync") || !strcmp(argv[1], "async")) {
+        if (!esh_prompt_set_async(argv[1][0] == 'a')) {
+            fprintf(stderr, "esh: prompt: cannot start worker\n");
+            return 1;
+        }
+    } else if (!strcmp(argv[1], "-d") && argv[2] != NULL) {
+        esh_prompt_set_deadline(atoi(argv[2]));
+    } else if (!strcmp(argv[1], "-t") && argv[2] != NULL) {
+        esh_prompt_set_ttl(atoi(argv[2]));
+    } else {
+        fprintf(stderr, "usage: prompt [sync | async | -d ms | -t ms]\n");
+        return 2;
+    }
+    return 0;
+}
 
-                    else {
-                        pipeline->status = STOPPED;
-                        printf("\n[%d]+ Stopped      ", pipeline->jid);
-                        print_job_commands(current_jobs);
-                    }
-                }
+/*
+ * The 'plugin' builtin: list plugins, or load, unload or reload the
+ * named plugins.
+ */
+static int builtin_plugin(struct esh_command *cmd)
+{
+    char **argv = cmd->argv;
+    bool (* action)(const char *name) = NULL;
+    int status = 0;
 
-                if (WTERMSIG(status) == 9) {
-                    list_remove(e);
-                }
+    if (argv[1] == NULL) {
+        esh_plugin_print();
+        return 0;
+    }
 
-                else {
-                    // printf("\n");
-                }
+    if (!strcmp(argv[1], "load")) {
+        action = esh_plugin_load;
+    } else if (!strcmp(argv[1], "unload")) {
+        action = esh_plugin_unload;
+    } else if (!strcmp(argv[1], "reload")) {
+        action = esh_plugin_reload;
+    }
 
-                // normal termination
-                if (WIFEXITED(status)) {
-                    list_remove(e);
-                }
+    if (action == NULL || argv[2] == NULL) {
+        fprintf(stderr, "usage: plugin [load | unload | reload name...]\n");
+        return 2;
+    }
 
-                else if (WIFSIGNALED(status)) {
-                    list_remove(e);
-                }
+    for (argv += 2; *argv; argv++) {
+        if (!action(*argv)) {
+            status = 1;
+        }
+    }
+    return status;
+}
 
-                else if (WIFCONTINUED(status)) {
-                    list_remove(e);
-                }
+/* Print the time the shell and its children used so far */
+static int builtin_time(struct esh_command *cmd)
+{
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+
+    printf("shell     user %.3fs  sys %.3fs\n",
+           self.ru_utime.tv_sec + self.ru_utime.tv_usec / 1e6,
+           self.ru_stime.tv_sec + self.ru_stime.tv_usec / 1e6);
+    printf("children  user %.3fs  sys %.3fs\n",
+           children.ru_utime.tv_sec + children.ru_utime.tv_usec / 1e6,
+           children.ru_stime.tv_sec + children.ru_stime.tv_usec / 1e6);
+    return 0;
+}
 
-                if (list_empty(&current_jobs)) {
-                    jid = 0;
-                }
+/*
+ * The 'trace' builtin: print whether tracing is on, turn it on (with a
+ * ring of 'size' events) or off, forget what was recorded, or write it
+ * as Chrome trace event JSON to a file or stdout.
+ */
+static int builtin_trace(struct esh_command *cmd)
+{
+    char **argv = cmd->argv;
+
+    if (argv[1] == NULL) {
+        esh_trace_print();
+    } else if (!strcmp(argv[1], "on")) {
+        if (!esh_trace_start(argv[2] ? atoi(argv[2]) : 0)) {
+            fprintf(stderr, "esh: trace: cannot allocate ring\n");
+            return 1;
+        }
+    } else if (!strcmp(argv[1], "off")) {
+        esh_trace_stop();
+    } else if (!strcmp(argv[1], "clear")) {
+        esh_trace_clear();
+    } else if (!strcmp(argv[1], "dump")) {
+        FILE *out = argv[2] ? fopen(argv[2], "w") : stdout;
+        if (out == NULL || !esh_trace_dump(out)) {
+            esh_sys_error("esh: trace: %s: ", argv[2] ? argv[2] : "stdout");
+            if (out != NULL && out != stdout) {
+                fclose(out);
             }
+            return 1;
         }
+        if (out != stdout) {
+            fclose(out);
+        }
+    } else {
+        fprintf(stderr, "usage: trace [on [size] | off | clear | dump [file]]\n");
+        return 2;
     }
-
-    else if (pid < 0) {
-        esh_sys_fatal_error("Error in wait ");
-    }
+    return 0;
 }
 
 /*
- * SIGCHLD Handler
+ * The 'stats' builtin: print the latency histograms, forget them, or
+ * export them in the Prometheus text format to a file every 'seconds'.
  */
-static void child_handler(int sig, siginfo_t *info, void *_ctxt)
+static int builtin_stats(struct esh_command *cmd)
 {
-    assert (sig == SIGCHLD);
-
-    int status;
-    pid_t pid;
-    while ((pid = waitpid(-1, &status, WUNTRACED|WNOHANG)) > 0) {
-        change_job_status(pid, status);
+    char **argv = cmd->argv;
+
+    if (argv[1] == NULL) {
+        esh_stats_print();
+        esh_stats_print_export();
+    } else if (!strcmp(argv[1], "-r")) {
+        esh_stats_reset();
+    } else if (!strcmp(argv[1], "export") && argv[2] != NULL) {
+        bool off = !strcmp(argv[2], "off");
+        if (!esh_stats_export(off ? NULL : argv[2],
+                              argv[3] ? atoi(argv[3]) : 0)) {
+            esh_sys_error("esh: stats: %s: ", argv[2]);
+            esh_stats_export(NULL, 0);
+            return 1;
+        }
+    } else {
+        fprintf(stderr, "usage: stats [-r | export file [seconds] | export off]\n");
+        return 2;
     }
+    return 0;
 }
 
-/**
- * Assign ownership of ther terminal to process group
- * pgrp, restoring its terminal state if provided.
- *
- * Before printing a new prompt, the shell should
- * invoke this function with its own process group
- * id (obtained on startup via getpgrp()) and a
- * sane terminal state (obtained on startup via
- * esh_sys_tty_init()).
- *
- * Taken from Dr. Back's Snippet.
+/*
+ * The 'snapshot' builtin: print whether the job table is published in
+ * shared memory for monitoring programs, or turn that on or off.
  */
-static void
-give_terminal_to(pid_t pgrp, struct termios *pg_tty_state)
+static int builtin_snapshot(struct esh_command *cmd)
 {
-    esh_signal_block(SIGTTOU);
-    int rc = tcsetpgrp(esh_sys_tty_getfd(), pgrp);
-    if (rc == -1) {
-        esh_sys_fatal_error("tcsetpgrp: ");
+    char **argv = cmd->argv;
+
+    if (argv[1] == NULL) {
+        esh_snapshot_print();
+    } else if (!strcmp(argv[1], "on")) {
+        if (!esh_snapshot_start()) {
+            esh_sys_error("esh: snapshot: ");
+            return 1;
+        }
+    } else if (!strcmp(argv[1], "off")) {
+        esh_snapshot_stop();
+    } else {
+        fprintf(stderr, "usage: snapshot [on | off]\n");
+        return 2;
     }
+    return 0;
+}
 
-    if (pg_tty_state) {
-        esh_sys_tty_restore(pg_tty_state);
+/*
+ * The 'history' builtin: print the last 'n' command lines, those that
+ * contain 'text' or start with 'prefix', the size of the history and
+ * its index, or compact it to the most recent copy of each line.
+ */
+static int builtin_history(struct esh_command *cmd)
+{
+    char **argv = cmd->argv;
+
+    if (argv[1] == NULL || isdigit((unsigned char) argv[1][0])) {
+        esh_history_print(argv[1] ? atol(argv[1]) : -1);
+    } else if ((!strcmp(argv[1], "-s") || !strcmp(argv[1], "-p"))
+               && argv[2] != NULL) {
+        char query[4096] = "";
+        char **arg;
+        for (arg = argv + 2; *arg; arg++) {
+            if (arg != argv + 2) {
+                strncat(query, " ", sizeof query - strlen(query) - 1);
+            }
+            strncat(query, *arg, sizeof query - strlen(query) - 1);
+        }
+        return esh_history_search(query, argv[1][1] == 'p') > 0 ? 0 : 1;
+    } else if (!strcmp(argv[1], "-i")) {
+        esh_history_print_info();
+    } else if (!strcmp(argv[1], "-c")) {
+        if (!esh_history_compact()) {
+            esh_sys_error("esh: history: ");
+            return 1;
+        }
+    } else {
+        fprintf(stderr, "usage: history [n | -s text | -p prefix | -i | -c]\n");
+        return 2;
     }
-    esh_signal_unblock(SIGTTOU);
+    return 0;
 }
 
 /*
- * Wait
+ * The 'complete' builtin: print the commands that start with 'prefix',
+ * or the size of the command completion index.
  */
-static void wait_for_job(struct esh_command_line *cline, struct esh_pipeline *pipeline, struct termios *shell_tty)
+static int builtin_complete(struct esh_command *cmd)
 {
-    int status;
-    pid_t pid;
+    char **argv = cmd->argv;
 
-    if ((pid = waitpid(-1, &status, WUNTRACED)) > 0) {
-        give_terminal_to(getpgrp(), shell_tty);
-        change_job_status(pid, status);
+    if (argv[1] != NULL && argv[2] != NULL) {
+        fprintf(stderr, "usage: complete [prefix]\n");
+        return 2;
     }
+    esh_complete_print(argv[1]);
+    return 0;
 }
 
-/* The shell object plugins use.
- * Some methods are set to defaults.
+static int run_control_line(char *cmdline, bool background);
+
+/*
+ * The 'control' builtin: print the state of the control socket, or
+ * open it at 'path' (or the default path) or close it.
  */
-struct esh_shell shell = {
-    .build_prompt = build_prompt_from_plugins,
-    .readline = readline,       /* GNU readline(3) */
-    .parse_command_line = esh_parse_command_line, /* Default parser */
-    .get_jobs = get_jobs,
-    .get_job_from_jid = get_job_from_jid,
-    .get_job_from_pgrp = get_job_from_pgrp
-    /* .get_cmd_from_pid = get_cmd_from_pid */
+static int builtin_control(struct esh_command *cmd)
+{
+    char **argv = cmd->argv;
+
+    if (argv[1] == NULL) {
+        esh_control_print();
+    } else if (!strcmp(argv[1], "on")) {
+        if (!esh_control_open(argv[2], run_control_line)) {
+            esh_sys_error("esh: control: %s: ", argv[2] ? argv[2] : "socket");
+            return 1;
+        }
+        esh_control_print();
+    } else if (!strcmp(argv[1], "off")) {
+        if (!esh_control_close()) {
+            esh_sys_error("esh: control: ");
+            return 1;
+        }
+    } else {
+        fprintf(stderr, "usage: control [on [path] | off]\n");
+        return 2;
+    }
+    return 0;
+}
+
+/* Builtins provided by the shell itself */
+static struct {
+    const char *name;
+    esh_builtin_t handler;
+} core_builtins[] = {
+    { "exit", builtin_exit },
+    { "jobs", builtin_jobs },
+    { "fg", builtin_fg },
+    { "bg", builtin_bg },
+    { "kill", builtin_kill },
+    { "stop", builtin_stop },
+    { "hash", builtin_hash },
+    { "parsecache", builtin_parsecache },
+    { "prompt", builtin_prompt },
+    { "plugin", builtin_plugin },
+    { "time", builtin_time },
+    { "trace", builtin_trace },
+    { "stats", builtin_stats },
+    { "control", builtin_control },
+    { "snapshot", builtin_snapshot },
+    { "history", builtin_history },
+    { "complete", builtin_complete },
 };
 
-int
-main(int ac, char *av[])
+/* Run a builtin, reporting the time it took if 'timed' */
+static int run_builtin(esh_builtin_t builtin, struct esh_command *cmd,
+                       bool timed)
 {
-    int opt;
-    jid = 0;
-    list_init(&esh_plugin_list);
-    list_init(&current_jobs);
+    if (!timed) {
+        ESH_TRACE_BEGIN(ESH_TRACE_BUILTIN, 0, cmd->argv[0]);
+        int status = builtin(cmd);
+        ESH_TRACE_END(ESH_TRACE_BUILTIN, status, cmd->argv[0]);
+        return status;
+    }
 
-    /* Process command-line arguments. See getopt(3) */
-    while ((opt = getopt(ac, av, "hp:")) > 0) {
-        switch (opt) {
-        case 'h':
-            usage(av[0]);
-            break;
+    struct timespec start, end;
+    struct rusage before, after;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    getrusage(RUSAGE_SELF, &before);
+
+    ESH_TRACE_BEGIN(ESH_TRACE_BUILTIN, 0, cmd->argv[0]);
+    int status = builtin(cmd);
+    ESH_TRACE_END(ESH_TRACE_BUILTIN, status, cmd->argv[0]);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &after);
+    timersub(&after.ru_utime, &before.ru_utime, &after.ru_utime);
+    timersub(&after.ru_stime, &before.ru_stime, &after.ru_stime);
+    esh_print_time(end.tv_sec - start.tv_sec
+                   + (end.tv_nsec - start.tv_nsec) / 1e9, &after);
+    return status;
+}
 
-        case 'p':
-            esh_plugin_load_from_directory(optarg);
-            break;
+/*
+ * Execute one pipeline of a command line.  A pipeline that is started
+ * is copied out of the command line's arena to become a job.
+ */
+static void run_pipeline(struct esh_pipeline *pipeline)
+{
+    struct esh_command *commands;
+    commands = list_entry(list_begin(&pipeline->commands), struct esh_command, elem);
+
+    /* 'time command...' reports how long the pipeline took once it
+     * finishes.  'time' alone is a builtin. */
+    if (!strcmp(commands->argv[0], "time") && commands->argv[1] != NULL) {
+        commands->argv++;
+        pipeline->timed = true;
+    }
+
+    if (force_background) {
+        pipeline->bg_job = true;
+    }
+
+    int i;
+    struct esh_plugin_dispatch *d = esh_plugin_subscribers(ESH_PLUGIN_PIPELINE);
+    for (i = 0; i < d->count; i++) {
+        struct esh_plugin *plugin = d->plugins[i];
+        bool handled;
+        ESH_PLUGIN_HOOK(plugin, "process_pipeline",
+                        handled = plugin->process_pipeline(pipeline));
+        if (handled) {
+            return;
         }
     }
 
-    esh_plugin_load_from_directory("plugins/");
-    esh_plugin_initialize(&shell);
-    setpgid(0, 0);
-    struct termios *shell_tty = esh_sys_tty_init();
-    give_terminal_to(getpgrp(), shell_tty);
+    /* Plugins that implement the process_builtin hook see every
+     * command first, so that they can override any command. */
+    d = esh_plugin_subscribers(ESH_PLUGIN_BUILTIN);
+    for (i = 0; i < d->count; i++) {
+        struct esh_plugin *plugin = d->plugins[i];
+        bool handled;
+        ESH_PLUGIN_HOOK(plugin, "process_builtin",
+                        handled = plugin->process_builtin(commands));
+        if (handled) {
+            return;
+        }
+    }
 
-    /* Read/eval loop. */
-    for (;;) {
+    esh_builtin_t builtin = esh_builtin_lookup(commands->argv[0]);
+    if (builtin != NULL) {
+        last_status = run_builtin(builtin, commands, pipeline->timed);
+    } else {
+        struct esh_pipeline *job = esh_pipeline_copy(pipeline);
+        job->status = job->bg_job ? BACKGROUND : FOREGROUND;
+
+        int tty_fd = job->bg_job || !interactive ? -1 : esh_sys_tty_getfd();
+        fflush(stdout);     /* output of earlier builtins goes first */
+        if (esh_spawn_pipeline(job, tty_fd) == 0) {
+            esh_pipeline_free(job);
+            last_status = 127;
+            return;
+        }
 
-        /* Do not output a prompt unless shell's stdin is a terminal */
-        char * prompt = isatty(0) ? shell.build_prompt() : NULL;
-        char * cmdline = shell.readline(prompt);
-        free (prompt);
+        esh_job_add(job);
+        esh_prompt_invalidate();
 
-        if (cmdline == NULL) { /* User typed EOF */
-            break;
+        d = esh_plugin_subscribers(ESH_PLUGIN_FORKED);
+        for (i = 0; i < d->count; i++) {
+            struct esh_plugin *plugin = d->plugins[i];
+            ESH_PLUGIN_HOOK(plugin, "pipeline_forked",
+                            plugin->pipeline_forked(job));
         }
 
-        struct esh_command_line * cline = shell.parse_command_line(cmdline);
-        free (cmdline);
-        if (cline == NULL) {                /* Error in command line */
-            continue;
+        if (job->bg_job && interactive) {
+            printf("[%d] %d\n", job->jid, job->pgrp);
         }
 
-        if (list_empty(&cline->pipes)) {    /* User hit enter */
-            esh_command_line_free(cline);
-            continue;
+        if (!job->bg_job) {
+            wait_for_job(job);
         }
+    }
+}
 
-        struct esh_pipeline *pipeline;
-        pipeline = list_entry(list_begin(&cline->pipes), struct esh_pipeline, elem);
+/*
+ * Let plugins see one command line, then parse it.  Returns NULL if a
+ * plugin handled the line, setting *handled if 'handled' is not NULL,
+ * or if it has an error.  Does not free 'cmdline'.
+ */
+static struct esh_command_line * parse_line(char *cmdline, bool *handled)
+{
+    /* Plugins may rewrite the line; they get a malloc'd copy to
+     * replace, since 'cmdline' is not necessarily malloc'd. */
+    char *line = cmdline;
+    ESH_TRACE_INSTANT(ESH_TRACE_LINE, 0, cmdline);
+
+    struct esh_plugin_dispatch *d;
+    d = esh_plugin_subscribers(ESH_PLUGIN_RAW_CMDLINE);
+    int i;
+    for (i = 0; i < d->count; i++) {
+        struct esh_plugin *plugin = d->plugins[i];
+        if (line == cmdline) {
+            line = strdup(cmdline);
+        }
+        bool taken;
+        ESH_PLUGIN_HOOK(plugin, "process_raw_cmdline",
+                        taken = plugin->process_raw_cmdline(&line));
+        if (taken) {
+            free (line);
+            if (handled != NULL) {
+                *handled = true;
+            }
+            return NULL;
+        }
+    }
 
-        struct esh_command *commands;
-        commands = list_entry(list_begin(&pipeline->commands), struct esh_command, elem);
-        //esh_command_print(command);
+    /* Lines are looked up in the parse cache after plugins rewrote
+     * them.  A parser supplied by a plugin is not cached. */
+    struct esh_command_line * cline;
+    uint64_t parse_start = esh_stats_now();
+    ESH_TRACE_BEGIN(ESH_TRACE_PARSE, 0, NULL);
+    if (shell.parse_command_line == esh_parse_command_line) {
+        cline = esh_parse_cached(line, esh_parse_command_line);
+    } else {
+        cline = shell.parse_command_line(line);
+    }
+    ESH_TRACE_END(ESH_TRACE_PARSE, cline != NULL, NULL);
+    esh_stats_add_since(ESH_STAT_PARSE, parse_start);
+    if (line != cmdline) {
+        free (line);
+    }
+    if (cline == NULL) {                /* Error in command line */
+        last_status = 2;
+    }
+    return cline;
+}
 
-	int command_type = process_type(commands->argv[0]);
+/* Execute a parsed command line, one pipeline after the other, and
+ * free it */
+static void run_pipelines(struct esh_command_line *cline)
+{
+    struct list_elem *e = list_begin(&cline->pipes);
+    while (e != list_end(&cline->pipes)) {
+        struct esh_pipeline *pipeline = list_entry(e, struct esh_pipeline, elem);
+        e = list_next(e);
+        run_pipeline(pipeline);
+    }
 
-	//PLUGIN CHECK
-	struct list_elem * e = list_begin(&esh_plugin_list);
-	for (; e != list_end(&esh_plugin_list); e = list_next(e)) {
-	    struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem);
+    esh_command_line_free(cline);
+}
 
-	    if (plugin->process_builtin(commands)) {
-		command_type = -1;
-		continue;
-	    }
-	}
+/*
+ * Parse and execute one command line, one pipeline after the other.
+ * Does not free 'cmdline'.
+ */
+static void run_command_line(char *cmdline)
+{
+    struct esh_command_line *cline = parse_line(cmdline, NULL);
+    if (cline != NULL) {
+        run_pipelines(cline);
+    }
+}
 
-        if (command_type == 1) {
-            exit(EXIT_SUCCESS);
+/* Return true if a pipeline of 'cline' is a builtin, which runs in the
+ * shell itself and cannot be put in the background */
+static bool runs_builtin(struct esh_command_line *cline)
+{
+    struct list_elem *e;
+    for (e = list_begin(&cline->pipes); e != list_end(&cline->pipes);
+         e = list_next(e)) {
+        struct esh_pipeline *pipeline = list_entry(e, struct esh_pipeline, elem);
+        struct esh_command *first = list_entry(list_begin(&pipeline->commands),
+                                               struct esh_command, elem);
+        char **argv = first->argv;
+        if (!strcmp(argv[0], "time") && argv[1] != NULL) {
+            argv++;
+        }
+        if (esh_builtin_lookup(argv[0]) != NULL) {
+            return true;
         }
+    }
+    return false;
+}
+
+/*
+ * Reap all children that changed state, as one batch.
+ * Called whenever the signalfd reports SIGCHLD.  If the user is
+ * editing a command line, it is taken down while job notifications
+ * are printed and then redrawn.
+ */
+static void reap_children(int sigfd)
+{
+    struct signalfd_siginfo info;
+    while (read(sigfd, &info, sizeof info) == sizeof info) {
+        continue;
+    }
 
-        // jobs
-        else if (command_type == 2) {
+    char *saved_line = NULL;
+    int saved_point = 0;
+    int status;
+    struct rusage rusage;
+    pid_t pid;
 
-            char *statusStrings[] = {"Foreground","Running","Stopped", "Needs Terminal"};
-            struct list_elem *e;
-            for (e = list_begin(&current_jobs); e != list_end(&current_jobs); e = list_next(e)) {
-                struct esh_pipeline *pipeline = list_entry(e, struct esh_pipeline, elem);
-                printf("[%d] %s ", pipeline->jid, statusStrings[pipeline->status]);
-                print_single_job(pipeline);
+    while ((pid = wait4(-1, &status, WUNTRACED|WNOHANG, &rusage)) > 0) {
+        if (prompt_active && saved_line == NULL) {
+            saved_point = rl_point;
+            saved_line = rl_copy_text(0, rl_end);
+            rl_save_prompt();
+            rl_replace_line("", 0);
+            rl_redisplay();
+        }
+
+        struct esh_pipeline *done = child_status_changed(pid, status, &rusage);
+        if (done != NULL) {
+            if (done->status == BACKGROUND && interactive) {
+                printf("[%d]+ Done         ", done->jid);
+                esh_job_print_commands(done);
             }
+            report_job_time(done);
+            esh_pipeline_free(done);
         }
+    }
 
-        // fg, bg, kill, stop
-        else if (command_type == 3 || command_type == 4 || command_type == 5 || command_type == 6) {
+    if (saved_line != NULL) {
+        rl_restore_prompt();
+        rl_replace_line(saved_line, 0);
+        rl_point = saved_point;
+        rl_redisplay();
+        free(saved_line);
+    }
+}
 
-            if (!list_empty(&current_jobs)) {
+/* Append 'len' bytes at 's' to the here-document text */
+static void heredoc_append(const char *s, size_t len)
+{
+    if (heredoc.len + len + 1 > heredoc.size) {
+        heredoc.size = 2 * (heredoc.len + len + 1);
+        heredoc.text = realloc(heredoc.text, heredoc.size);
+    }
+    memcpy(heredoc.text + heredoc.len, s, len);
+    heredoc.len += len;
+    heredoc.text[heredoc.len] = '\0';
+}
 
-                int jobid_arg = -1;
+/*
+ * Take a line of input.  Returns 'line' itself if it is a command line
+ * without here-documents, NULL if more lines are needed to complete
+ * the here-documents of a command line, and once they are complete,
+ * the command line with the lines that hold them, to be freed by the
+ * caller.  A NULL 'line', for the end of input, returns what was read
+ * so far, for the parser to complain about.
+ */
+static char *take_line(char *line)
+{
+    size_t i;
 
-                if (commands->argv[1] == NULL) {
-                    struct list_elem *e = list_back(&current_jobs);
-                    struct esh_pipeline *pipeline = list_entry(e, struct esh_pipeline, elem);
-                    jobid_arg = pipeline->jid;
-                }
+    if (heredoc.words == NULL) {
+        if (line == NULL) {
+            return NULL;
+        }
+        heredoc.nwords = esh_lex_heredoc_words(line, &heredoc.words);
+        if (heredoc.nwords == 0) {
+            return line;
+        }
+        heredoc.len = heredoc.next = 0;
+    } else if (line != NULL && !strcmp(line, heredoc.words[heredoc.next])) {
+        heredoc.next++;
+    }
 
-                else {
+    if (line != NULL) {
+        heredoc_append(line, strlen(line));
+        heredoc_append("\n", 1);
+        if (heredoc.next < heredoc.nwords) {
+            return NULL;
+        }
+    }
 
-                    if (strncmp(commands->argv[1], "%", 1) == 0) {
-                        char *temp = (char*) malloc(5);
-                        strcpy(temp, commands->argv[1]+1);
-                        jobid_arg = atoi(temp);
-                        free(temp);
-                    }
+    for (i = 0; i < heredoc.nwords; i++) {
+        free(heredoc.words[i]);
+    }
+    free(heredoc.words);
+    heredoc.words = NULL;
 
-                    else {
-                        jobid_arg = atoi(commands->argv[1]);
-                    }
-                }
+    char *text = heredoc.text;
+    heredoc.text = NULL;
+    heredoc.size = 0;
+    return text;
+}
 
-                struct esh_pipeline *pipeline;
-                pipeline = get_job_from_jid(jobid_arg);
+/* Return the prompt for the next line: the shell's, or '> ' while
+ * here-documents are read, or NULL if stdin is not a terminal */
+static char *next_prompt(void)
+{
+    if (!isatty(0)) {
+        return NULL;
+    }
+    return heredoc.words != NULL ? strdup("> ") : shell.build_prompt();
+}
 
-                // fg
-                if (command_type == 3) {
+/*
+ * Called by readline when the user has entered a complete line.
+ */
+static void handle_line(char *cmdline)
+{
+    rl_callback_handler_remove();
+    prompt_active = false;
+
+    if (cmdline == NULL) { /* User typed EOF */
+        char *text = take_line(NULL);
+        if (text != NULL) {
+            run_command_line(text);
+            free (text);
+        }
+        input_done = true;
+        return;
+    }
 
-                    esh_signal_block(SIGCHLD);
-                    pipeline->status = FOREGROUND;
-                    print_single_job(pipeline);
-                    give_terminal_to(pipeline->pgrp, shell_tty);
+    /* The lines of here-documents are not history */
+    if (heredoc.words == NULL) {
+        esh_history_add(cmdline);
+    }
+    char *text = take_line(cmdline);
+    if (text != NULL) {
+        run_command_line(text);
+    }
+    if (text != cmdline) {
+        free (text);
+    }
+    free (cmdline);
+}
 
-                    if (kill (-pipeline->pgrp, SIGCONT) < 0) {
-                        esh_sys_fatal_error("fg error: kill SIGCONT ");
-                    }
+/*
+ * Run a command line for a control socket client.  If the user is
+ * editing a line, the prompt is taken down first, as if they had hit
+ * enter, so that jobs get the terminal in its normal state; what they
+ * typed is put back when the prompt is shown again.
+ *
+ * A line to be run in the background is refused, before any of it
+ * runs, if it runs a builtin: 'exit' would end the shell and 'fg'
+ * would block it.  A line a plugin takes counts as run with status 0.
+ */
+static int run_control_line(char *cmdline, bool background)
+{
+    if (prompt_active) {
+        free(pending_input);
+        pending_input = rl_copy_text(0, rl_end);
+        pending_point = rl_point;
+        rl_save_prompt();
+        rl_replace_line("", 0);
+        rl_redisplay();
+        rl_restore_prompt();
+        rl_callback_handler_remove();
+        prompt_active = false;
+    }
 
-                    wait_for_job(cline, pipeline, shell_tty);
-                    esh_signal_unblock(SIGCHLD);
-                }
+    bool handled = false;
+    struct esh_command_line *cline = parse_line(cmdline, &handled);
+    if (cline == NULL) {
+        return handled ? 0 : ESH_CONTROL_SYNTAX_ERROR;
+    }
+    if (background && runs_builtin(cline)) {
+        esh_command_line_free(cline);
+        return ESH_CONTROL_REFUSED;
+    }
 
-                // bg
-                if (command_type == 4) {
+    force_background = background;
+    run_pipelines(cline);
+    force_background = false;
+    fflush(stdout);
+    return last_status;
+}
 
-                    pipeline->status = BACKGROUND;
+/*
+ * Read/eval loop for plugins that replace shell.readline, and for
+ * input that cannot be polled.  Children are reaped before each prompt.
+ */
+static void run_blocking_loop(int sigfd)
+{
+    for (;;) {
+        reap_children(sigfd);
 
-                    if (kill(-pipeline->pgrp, SIGCONT) < 0) {
-                        esh_sys_fatal_error("SIGCONT Error ");
-                    }
+        /* Do not output a prompt unless shell's stdin is a terminal */
+        char * prompt = next_prompt();
+        ESH_TRACE_INSTANT(ESH_TRACE_PROMPT, 0, NULL);
+        char * cmdline = shell.readline(prompt);
+        free (prompt);
 
-                    print_job_commands(current_jobs);
-                    printf("\n");
-                }
+        char *text = take_line(cmdline);
+        if (text != NULL) {
+            run_command_line(text);
+        }
+        if (text != cmdline) {
+            free (text);
+        }
 
-                // kill
-                else if (command_type == 5) {
-                    if (kill(-pipeline->pgrp, SIGKILL) < 0) {
-                        esh_sys_fatal_error("SIGKILL Error ");
-                    }
-                }
+        if (cmdline == NULL) { /* User typed EOF */
+            break;
+        }
+        free (cmdline);
+    }
+}
 
-                // stop
-                else if (command_type == 6) {
-                    if (kill(-pipeline->pgrp, SIGSTOP) < 0) {
-                        esh_sys_fatal_error("SIGSTOP Error ");
-                    }
-                }
-            }
+/*
+ * Read/eval loop for scripts and other non-interactive input.
+ * Lines are taken straight from a buffered reader; neither readline
+ * nor the prompt are involved.
+ */
+static void run_batch_loop(int fd, int sigfd)
+{
+    struct esh_reader *reader = esh_reader_open(fd);
+    char *cmdline;
+
+    do {
+        cmdline = esh_reader_getline(reader);
+        reap_children(sigfd);
+
+        char *text = take_line(cmdline);
+        if (text != NULL) {
+            run_command_line(text);
+        }
+        if (text != cmdline) {
+            free (text);
         }
+    } while (cmdline != NULL);
 
-        else if (command_type == 0) {
+    esh_reader_close(reader);
+}
 
-            /*
-             * Don't think this is pipeline friendly.
-             */
+/*
+ * Show the prompt again with the fragments the prompt worker has
+ * refreshed since it was shown.
+ */
+static void redraw_prompt(void)
+{
+    if (!prompt_active || !isatty(0)
+        || shell.build_prompt != build_prompt_from_plugins) {
+        return;
+    }
 
-            esh_signal_sethandler(SIGCHLD, child_handler);
+    char *prompt = esh_prompt_current();
+    if (prompt != NULL) {
+        rl_set_prompt(prompt);
+        rl_forced_update_display();
+        free (prompt);
+    }
+}
 
-            jid++;
-            if (list_empty(&current_jobs)) {
-                jid = 1;
-            }
+/*
+ * Keep the history of interactive shells in $ESH_HISTFILE, or else in
+ * ~/.esh_history.  An empty $ESH_HISTFILE turns it off.
+ */
+static void open_history(void)
+{
+    char path[PATH_MAX];
+    const char *env = getenv("ESH_HISTFILE"), *home = getenv("HOME");
 
-            pipeline->jid = jid;
-            pipeline->pgrp = -1;
-            pid_t pid;
+    if (env != NULL) {
+        if (*env == '\0') {
+            return;
+        }
+        snprintf(path, sizeof path, "%s", env);
+    } else if (home != NULL) {
+        snprintf(path, sizeof path, "%s/.esh_history", home);
+    } else {
+        return;
+    }
 
-            // pipes
-            int oldPipe[2], newPipe[2];
-            bool isPiped = false;
+    if (!esh_history_open(path)) {
+        esh_sys_error("esh: history: %s: ", path);
+    }
+}
 
-            if (list_size(&pipeline->commands) > 1) {
-                isPiped = true;
-            }
+/*
+ * Read/eval loop.  Waits in epoll for either input, which is fed
+ * to readline's callback interface, or SIGCHLD, which is received
+ * through a signalfd so that children are reaped in normal context
+ * as soon as they change state, even while the user is typing.
+ * The prompt worker's eventfd asks for the prompt to be redrawn, the
+ * stats timerfd for the latency histograms to be exported, the
+ * control socket's epoll descriptor for its clients to be served, and
+ * the completion index's inotify descriptor for $PATH changes.
+ */
+static void run_event_loop(int sigfd)
+{
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        esh_sys_fatal_error("epoll_create1: ");
+    }
 
-            struct list_elem *e;
-            for (e = list_begin(&pipeline->commands); e != list_end(&pipeline->commands); e = list_next(e)) {
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.fd = sigfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &ev);
 
-                struct esh_command *command = list_entry(e, struct esh_command, elem);
+    int promptfd = esh_prompt_eventfd();
+    ev.data.fd = promptfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, promptfd, &ev);
 
-                //esh_command_print(command);
+    int statsfd = esh_stats_timerfd();
+    ev.data.fd = statsfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, statsfd, &ev);
 
-                if(isPiped && list_next(e) != list_tail(&pipeline->commands)) {
-                    pipe(newPipe);
-                }
+    int controlfd = esh_control_fd();
+    ev.data.fd = controlfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, controlfd, &ev);
 
-                esh_signal_block(SIGCHLD);
-                pid = fork();
-
-                // child
-                if (pid == 0) {
-
-                    pid = getpid();
-                    command->pid = pid;
-
-                    if (pipeline->pgrp == -1) {
-                        pipeline->pgrp = pid;
-                    }
-
-                    if (setpgid(pid, pipeline->pgrp) < 0) {
-                        esh_sys_fatal_error("Error Setting Process Group ");
-                    }
-
-                    if (!pipeline->bg_job) {
-                        give_terminal_to(pipeline->pgrp, shell_tty);
-                        pipeline->status = FOREGROUND;
-                    }
-
-                    else {
-                        pipeline->status = BACKGROUND;
-                    }
-
-                    if (isPiped && e != list_begin(&pipeline->commands)) {
-                        // closing and duplicating old pipe
-                        close(oldPipe[1]);
-                        dup2(oldPipe[0], 0);
-                        close(oldPipe[0]);
-                    }
-
-                    if (isPiped && list_next(e) != list_tail(&pipeline->commands)) {
-                        // closing and duplicating new pipe
-                        close(newPipe[0]);
-                        dup2(newPipe[1], 1);
-                        close(newPipe[1]);
-                    }
-
-                    if (command->iored_input != NULL) {
-                        int in_fd = open(command->iored_input, O_RDONLY);
-                        if (dup2(in_fd, 0) < 0) {
-                            esh_sys_fatal_error("dup2 error ");
-                        }
-                        close(in_fd);
-                    }
-
-                    if (command->iored_output != NULL) {
-                        int out_fd;
-                        if (command->append_to_output) {
-                            out_fd = open(command->iored_output, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IRGRP | S_IWGRP | S_IWUSR);
-                        }
-
-                        else {
-                            out_fd = open(command->iored_output, O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IRGRP | S_IWGRP | S_IWUSR);
-                        }
-
-                        if (dup2(out_fd, 1) < 0) {
-                            esh_sys_fatal_error("dup2 error ");
-                        }
-
-                        close(out_fd);
-                    }
-
-                    if (execvp(command->argv[0], command->argv) < 0) {
-                        esh_sys_fatal_error("Exec Error ");
-                    }
-                }
+    int completefd = esh_complete_fd();
+    ev.data.fd = completefd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, completefd, &ev);
 
-                else if (pid < 0) {
-                    esh_sys_fatal_error("Fork Error ");
-                }
+    ev.data.fd = 0;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, 0, &ev) == -1) {
+        close(epfd);
+        run_blocking_loop(sigfd);
+        return;
+    }
 
-                // parent
-                else {
-
-                    if (pipeline->pgrp == -1) {
-                        pipeline->pgrp = pid;
-                    }
-
-                    if (setpgid(pid, pipeline->pgrp) < 0) {
-                        esh_sys_fatal_error("Error Setting Process Group ");
-                    }
-
-                    if (isPiped && e != list_begin(&pipeline->commands)) {
-                        // closing old pipes
-                        close(oldPipe[0]);
-                        close(oldPipe[1]);
-                    }
-
-                    if (isPiped && list_next(e) != list_tail(&pipeline->commands)) {
-                        // setting oldPipe to newPipe
-                        oldPipe[0] = newPipe[0];
-                        oldPipe[1] = newPipe[1];
-                    }
-
-                    if (isPiped && list_next(e) == list_tail(&pipeline->commands)) {
-                        close(oldPipe[0]);
-                        close(oldPipe[1]);
-                        close(newPipe[0]);
-                        close(newPipe[1]);
-                    }
-                }
+    while (!input_done) {
+
+        if (!prompt_active) {
+            /* Do not output a prompt unless shell's stdin is a terminal */
+            esh_prompt_latency_start();
+            char * prompt = next_prompt();
+            rl_callback_handler_install(prompt, handle_line);
+            free (prompt);
+            prompt_active = true;
+            if (pending_input != NULL) {
+                rl_insert_text(pending_input);
+                rl_point = pending_point;
+                rl_redisplay();
+                free(pending_input);
+                pending_input = NULL;
             }
+            esh_prompt_latency_stop();
+            ESH_TRACE_INSTANT(ESH_TRACE_PROMPT, 0, NULL);
+        }
+
+        struct epoll_event events[6];
+        int i, n = epoll_wait(epfd, events, 6, -1);
+        if (n == -1 && errno != EINTR) {
+            esh_sys_fatal_error("epoll_wait: ");
+        }
 
-            if (pipeline->bg_job) {
-                pipeline->status = BACKGROUND;
-                printf("[%d] %d\n", pipeline->jid, pipeline->pgrp);
+        for (i = 0; i < n; i++) {
+            if (events[i].data.fd == sigfd) {
+                reap_children(sigfd);
+            } else if (events[i].data.fd == promptfd) {
+                if (esh_prompt_refreshed()) {
+                    redraw_prompt();
+                }
+            } else if (events[i].data.fd == statsfd) {
+                esh_stats_timer_expired();
+            } else if (events[i].data.fd == controlfd) {
+                esh_control_ready();
+            } else if (events[i].data.fd == completefd) {
+                esh_complete_ready();
+            } else if (prompt_active) {
+                /* else a request took the prompt down; the input
+                 * is read once it is back */
+                rl_callback_read_char();
             }
+        }
+    }
+
+    if (prompt_active) {
+        rl_callback_handler_remove();
+    }
+    close(epfd);
+}
+
+int
+main(int ac, char *av[])
+{
+    int opt;
+    char *command = NULL;
+    char *control_path = NULL;
+
+    /* $ESH_TRACE names a file to write a trace of the whole session to */
+    char *trace_file = getenv("ESH_TRACE");
+    if (trace_file != NULL && *trace_file != '\0') {
+        esh_trace_dump_at_exit(trace_file);
+    }
+
+    /* $ESH_STATS_FILE names a file to export the latency histograms to */
+    char *stats_file = getenv("ESH_STATS_FILE");
+    if (stats_file != NULL && *stats_file != '\0'
+        && !esh_stats_export(stats_file, 0)) {
+        esh_sys_error("esh: %s: ", stats_file);
+        esh_stats_export(NULL, 0);
+    }
+
+    list_init(&esh_plugin_list);
+    esh_jobs_init();
 
-            e = list_pop_front(&cline->pipes);
-            list_push_back(&current_jobs, e);
+    /* Process command-line arguments. See getopt(3) */
+    bool async_prompt = false;
+    while ((opt = getopt(ac, av, "ahc:l:p:s:C:")) > 0) {
+        switch (opt) {
+        case 'a':
+            async_prompt = true;
+            break;
+
+        case 'h':
+            usage(av[0]);
+            break;
 
-            if (!pipeline->bg_job) {
-                wait_for_job(cline, pipeline, shell_tty);
+        case 'c':
+            command = optarg;
+            break;
+
+        case 'p':
+            esh_plugin_load_from_directory(optarg);
+            break;
+
+        case 's':
+            if (!esh_spawn_set_engine(optarg)) {
+                usage(av[0]);
+            }
+            break;
+
+        case 'l':
+            if (!esh_lex_set_mode(optarg)) {
+                usage(av[0]);
             }
+            break;
 
-            esh_signal_unblock(SIGCHLD);
+        case 'C':
+            control_path = optarg;
+            break;
         }
+    }
 
-        esh_command_line_free(cline);
+    char *script = command == NULL ? av[optind] : NULL;
+    int input_fd = 0;
+    if (script != NULL) {
+        input_fd = open(script, O_RDONLY | O_CLOEXEC);
+        if (input_fd == -1) {
+            esh_sys_fatal_error("esh: %s: ", script);
+        }
     }
+    interactive = command == NULL && script == NULL && isatty(0);
 
-    return 0;
+    unsigned i;
+    for (i = 0; i < sizeof core_builtins / sizeof core_builtins[0]; i++) {
+        esh_builtin_register(core_builtins[i].name, core_builtins[i].handler);
+    }
 
-}
+    esh_plugin_load_from_directory("plugins/");
+    esh_plugin_initialize(&shell);
 
-/*
- * Checks if the command passed can be handled by the esh shell.
- * If it is not a builtin command, returns 0.
- */
-int process_type(char *command)
-{
-    if (!strcmp(command, "exit")) {
-        return 1;
+    if (async_prompt && !esh_prompt_set_async(true)) {
+        fprintf(stderr, "esh: cannot start prompt worker\n");
+        exit(EXIT_FAILURE);
     }
 
-    else if (!strcmp(command, "jobs")) {
-        return 2;
+    /* Without a terminal to manage, the shell stays in the process
+     * group it was started in, so that it can be killed with it. */
+    if (interactive) {
+        setpgid(0, 0);
+        shell_tty = esh_sys_tty_init();
+        give_terminal_to(getpgrp(), shell_tty);
     }
 
-    else if (!strcmp(command, "fg")) {
-        return 3;
+    /* SIGCHLD stays blocked; it is only ever received via signalfd. */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    int sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sigfd == -1) {
+        esh_sys_fatal_error("signalfd: ");
     }
 
-    else if (!strcmp(command, "bg")) {
-        return 4;
+    /* $ESH_SNAPSHOT=1 publishes the job table of every shell started
+     * with it, including those run by jobs */
+    char *snapshot = getenv("ESH_SNAPSHOT");
+    if (snapshot != NULL && *snapshot != '\0' && strcmp(snapshot, "0")
+        && !esh_snapshot_start()) {
+        esh_sys_error("esh: snapshot: ");
     }
 
-    else if (!strcmp(command, "kill")) {
-        return 5;
+    /* Requests are only served by the event loop */
+    if (control_path != NULL
+        && !esh_control_open(control_path, run_control_line)) {
+        esh_sys_fatal_error("esh: %s: ", control_path);
     }
 
-    else if (!strcmp(command, "stop")) {
-        return 6;
+    if (command != NULL) {
+        run_command_line(command);
+    } else if (!interactive && shell.readline == readline) {
+        run_batch_loop(input_fd, sigfd);
+    } else if (shell.readline == readline) {
+        open_history();
+        esh_complete_init();
+        run_event_loop(sigfd);
+    } else {
+        run_blocking_loop(sigfd);
     }
 
-    return 0;
+    return interactive ? 0 : last_status;
+
 }
@@ -3,18 +3,29 @@
  *
  * $Id: esh.h,v 1.4 2011/03/29 15:46:28 Exp $
  */
+#ifndef __ESH_H
+#define __ESH_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <obstack.h>
 #include <stdlib.h>
 #include <termios.h>
+#include <time.h>
+#include <sys/resource.h>
 #include "list.h"
+#include "hash.h"
 
 /* Forward declarations. */
 struct esh_command;
 struct esh_pipeline;
 struct esh_command_line;
 
+/* A builtin command.  It is passed the command, whose argv[0] is the
+ * builtin's name, and returns its exit status. */
+typedef int (* esh_builtin_t)(struct esh_command *);
+
 /*
  * A esh_shell object allows plugins to access services and information.
  * The shell object should support the following operations.
@@ -41,8 +52,38 @@ struct esh_shell {
 
     /* Parse command line */
     struct esh_command_line * (* parse_command_line) (char *);
+
+    /* Register a builtin command 'name', executed by calling 'handler'.
+     * Returns false if 'name' is already a builtin.  Plugins should
+     * register their builtins from 'init' instead of implementing
+     * 'process_builtin', which is called for every command. */
+    bool (* register_builtin) (const char *name, esh_builtin_t handler);
 };
 
+/*
+ * Version of the plugin interface.  A plugin declares the version it
+ * was built for with ESH_PLUGIN_ABI at file scope.  Plugins without
+ * the declaration are version 1: their esh_plugin has no 'events'
+ * field, and they are notified of every event they have a hook for.
+ * Version 3 added 'fini'.
+ */
+#define ESH_PLUGIN_ABI_VERSION 3
+#define ESH_PLUGIN_ABI const int esh_module_abi = ESH_PLUGIN_ABI_VERSION
+
+/* Events plugins can subscribe to, one for each hook */
+enum esh_plugin_event {
+    ESH_PLUGIN_RAW_CMDLINE,     /* process_raw_cmdline */
+    ESH_PLUGIN_PIPELINE,        /* process_pipeline */
+    ESH_PLUGIN_BUILTIN,         /* process_builtin */
+    ESH_PLUGIN_PROMPT,          /* make_prompt */
+    ESH_PLUGIN_FORKED,          /* pipeline_forked */
+    ESH_PLUGIN_STATUS_CHANGE,   /* command_status_change */
+    ESH_PLUGIN_NEVENTS
+};
+
+/* Bit for 'event' in esh_plugin.events */
+#define ESH_PLUGIN_SUBSCRIBE(event)    (1u << (event))
+
 /*
  * Modules must define a esh_plugin instance named 'esh_module.'
  * Each of the following members is optional.
@@ -74,11 +115,13 @@ struct esh_plugin {
     bool (* process_pipeline)(struct esh_pipeline *);
 
     /* If the command is a built-in provided by a plugin, execute the
-     * command and return true. */
+     * command and return true.
+     * Deprecated: use shell->register_builtin() instead. */
     bool (* process_builtin)(struct esh_command *);
 
     /* Manufacture part of a prompt.  Memory must be allocated via malloc().
-     * If no plugin implements this, the shell will provide a default prompt. */
+     * If no plugin implements this, the shell will provide a default prompt.
+     * With 'prompt async', this is called on a separate thread. */
     char * (* make_prompt)(void);
 
     /* The process or processes that are part of a new pipeline
@@ -90,20 +133,34 @@ struct esh_plugin {
     void (* pipeline_forked)(struct esh_pipeline *);
 
     /* Notify the plugin about a child's status change.
-     * 'waitstatus' is the value returned by waitpid(2)
+     * 'waitstatus' is the status returned by wait4(2)
      *
-     * May be called from SIGCHLD handler.
+     * Called from the main loop once SIGCHLD was read from the
+     * signalfd, or while waiting for a foreground job, never from a
+     * signal handler.
      * The status of the associated pipeline has not yet been
      * updated.
      * */
     bool (* command_status_change)(struct esh_command *, int waitstatus);
 
+    /* Since ABI version 2: the events the plugin is notified of, made
+     * of ESH_PLUGIN_SUBSCRIBE() bits.  May be set by 'init'; events
+     * whose hook is NULL are ignored. */
+    unsigned events;
+
+    /* Since ABI version 3: called before the plugin is unloaded by the
+     * 'plugin unload' or 'plugin reload' builtins. */
+    void (* fini)(void);
+
     /* Add additional fields here if needed. */
 };
 
-/* A command line may contain multiple pipelines. */
+/* A command line may contain multiple pipelines.
+ * Its words, commands and pipelines are all allocated from its arena
+ * and released together with the command line. */
 struct esh_command_line {
     struct list/* <esh_pipeline> */ pipes;        /* List of pipelines */
+    struct obstack arena;    /* Memory for everything parsed from the line */
 
     /* Add additional fields here if needed. */
 };
@@ -135,6 +192,12 @@ struct esh_pipeline {
     enum job_status status;  /* Job status. */
     struct termios saved_tty_state;  /* The state of the terminal when this job was
                                         stopped after having been in foreground */
+    struct hash_elem jid_elem;   /* Link element for job table index by jid */
+    struct hash_elem pgrp_elem;  /* Link element for job table index by pgrp */
+    bool timed;              /* True if the user typed 'time' before it */
+    struct timespec started; /* When the job was started (CLOCK_MONOTONIC) */
+    struct timespec finished;    /* When its last process terminated */
+    struct rusage rusage;    /* Resources used by its terminated processes */
 
     /* Add additional fields here if needed. */
 };
@@ -148,25 +211,34 @@ struct esh_command {
     char *iored_output;      /* If non-NULL, command should write to
                                 file 'iored_output' */
     bool append_to_output;   /* True if user typed >> to append */
+    char *heredoc;           /* If non-NULL, command should read this text,
+                                given with << or <<< */
     struct list_elem elem;   /* Link element to link commands in pipeline. */
 
     pid_t   pid;             /* Process id. */
     struct esh_pipeline * pipeline;
                               /* The pipeline of which this job is a part. */
+    bool    completed;       /* True once the process has terminated. */
+    bool    stopped;         /* True while the process is stopped. */
+    int     status;          /* Last status reported by wait4(2). */
+    struct hash_elem pid_elem;  /* Link element for job table index by pid */
+    struct rusage rusage;    /* Resources used, once terminated */
 
     /* Add additional fields here if needed. */
 };
 
 /** ----------------------------------------------------------- */
 
-/* Create new command structure and initialize it */
-struct esh_command * esh_command_create(char ** argv,
+/* Create new command structure in 'arena' and initialize it */
+struct esh_command * esh_command_create(struct obstack *arena,
+                   char ** argv,
                    char *iored_input,
                    char *iored_output,
                    bool append_to_output);
 
-/* Create a new pipeline containing only one command */
-struct esh_pipeline * esh_pipeline_create(struct esh_command *cmd);
+/* Create a new pipeline in 'arena' containing only one command */
+struct esh_pipeline * esh_pipeline_create(struct obstack *arena,
+                                          struct esh_command *cmd);
 
 /* Complete a pipe's setup by copying I/O redirection information
  * from first and last command */
@@ -175,13 +247,22 @@ void esh_pipeline_finish(struct esh_pipeline *pipe);
 /* Create an empty command line */
 struct esh_command_line * esh_command_line_create_empty(void);
 
-/* Create a command line with a single pipeline */
-struct esh_command_line * esh_command_line_create(struct esh_pipeline *pipe);
+/* Copy a pipeline into a single malloc'd block, e.g. for a job that
+ * must outlive its command line */
+struct esh_pipeline * esh_pipeline_copy(struct esh_pipeline *pipe);
+
+/* Size of the block esh_pipeline_copy() allocates for pipe */
+size_t esh_pipeline_copy_size(struct esh_pipeline *pipe);
+
+/* Duplicate a pipeline made by esh_pipeline_copy(), of 'size' bytes,
+ * into 'arena' */
+struct esh_pipeline * esh_pipeline_dup(struct obstack *arena,
+                                       struct esh_pipeline *pipe, size_t size);
 
-/* Deallocation functions */
+/* Deallocation functions.  esh_pipeline_free() only applies to
+ * pipelines made by esh_pipeline_copy(). */
 void esh_command_line_free(struct esh_command_line *);
 void esh_pipeline_free(struct esh_pipeline *);
-void esh_command_free(struct esh_command *);
 
 /* Print functions */
 void esh_command_print(struct esh_command *cmd);
@@ -191,20 +272,444 @@ void esh_command_line_print(struct esh_command_line *line);
 /* Parse a command line.  Implemented in esh-grammar.y */
 struct esh_command_line * esh_parse_command_line(char * line);
 
+/* A parser with its own state.  Different threads may parse at the
+ * same time as long as each uses its own parser. */
+struct esh_parser;
+
+/* Create a parser, or return NULL on failure */
+struct esh_parser * esh_parser_create(void);
+
+/* Destroy a parser */
+void esh_parser_destroy(struct esh_parser *parser);
+
+/* Parse a command line with 'parser'.  Returns NULL on a syntax error. */
+struct esh_command_line * esh_parse_command_line_r(struct esh_parser *parser,
+                                                   char * line);
+
+/* Lexers the parser can use.  Implemented in esh-lex.c */
+enum esh_lex_mode {
+    ESH_LEX_FAST,       /* whole-line scanner, words left in place (default) */
+    ESH_LEX_FLEX,       /* flex scanner fed one character at a time */
+};
+
+/* Lexer used by esh_parse_command_line() */
+extern enum esh_lex_mode esh_lex_mode;
+
+/* Select lexer by name ("flex", "scalar", "sse2", "avx2" or "auto").
+ * Returns false if unknown or unsupported by this CPU. */
+bool esh_lex_set_mode(const char *name);
+
+/* State of the whole-line scanner */
+struct esh_lexer {
+    char *pos;          /* next character to scan */
+    int pending;        /* metacharacter that ended the last word, or 0 */
+};
+
+/* Tokens returned by esh_lex_next() besides single metacharacters */
+#define ESH_LEX_WORD    256
+#define ESH_LEX_APPEND  257     /* '>>' */
+#define ESH_LEX_HEREDOC 258     /* '<<' */
+#define ESH_LEX_HERESTRING 259  /* '<<<' */
+
+/* Prepare to scan 'line', whose copy is allocated in 'arena' */
+void esh_lex_init(struct esh_lexer *lx, struct obstack *arena,
+                  const char *line);
+
+/* Return next token, or 0 at end of line.  Words are stored in *word. */
+int esh_lex_next(struct esh_lexer *lx, char **word);
+
+/* Return the number of here-documents command line 'line' opens, and
+ * the words that end them in *words; free each and the array */
+size_t esh_lex_heredoc_words(const char *line, char ***words);
+
 /* Load plugins from directory dir */
 void esh_plugin_load_from_directory(char *dirname);
 
-/* Initialize loaded plugins */
+/* Initialize loaded plugins and build their dispatch arrays */
 void esh_plugin_initialize(struct esh_shell *shell);
 
-/* List of loaded plugins */
+/* List of loaded plugins, in increasing rank once initialized */
 extern struct list esh_plugin_list;
 
-/* List of current jobs */
-struct list /* <esh_pipeline> */  current_jobs;
+/* The plugins subscribed to an event, in increasing rank */
+struct esh_plugin_dispatch {
+    int count;
+    struct esh_plugin **plugins;
+    int pending;            /* how many of them are not loaded yet */
+};
+
+/* Dispatch arrays, indexed by enum esh_plugin_event */
+extern struct esh_plugin_dispatch esh_plugin_events[ESH_PLUGIN_NEVENTS];
+
+/* Load the plugins subscribed to ev whose loading was deferred */
+void esh_plugin_resolve(enum esh_plugin_event ev);
+
+/* Return the plugins to notify of event ev, loading them if needed */
+static inline struct esh_plugin_dispatch *
+esh_plugin_subscribers(enum esh_plugin_event ev)
+{
+    if (esh_plugin_events[ev].pending > 0)
+        esh_plugin_resolve(ev);
+    return &esh_plugin_events[ev];
+}
+
+/* Register a plugin linked into esh; see esh-static-plugin.h */
+void esh_plugin_register_static(struct esh_plugin *plugin, const int *abi);
+
+/* Load, unload or reload a plugin given by the path of its shared
+ * object, or by its file name without '.so' in a plugin directory.
+ * Print an error and return false on failure. */
+bool esh_plugin_load(const char *name);
+bool esh_plugin_unload(const char *name);
+bool esh_plugin_reload(const char *name);
+
+/* Print the plugins and their state */
+void esh_plugin_print(void);
+
+/* Return the file name of a loaded plugin, or NULL */
+const char * esh_plugin_name(struct esh_plugin *plugin);
+
+/* List of current jobs, in the order they were started */
+extern struct list /* <esh_pipeline> */  current_jobs;
+
+/* The job table.  Implemented in esh-jobs.c */
+void esh_jobs_init(void);
+struct list * esh_get_jobs(void);
+struct esh_pipeline * esh_get_job_from_jid(int jid);
+struct esh_pipeline * esh_get_job_from_pgrp(pid_t pgrp);
+struct esh_command * esh_get_cmd_from_pid(pid_t pid);
+
+/* Add a started pipeline to the job table, assigning its jid */
+void esh_job_add(struct esh_pipeline *job);
+
+/* Remove a job from the job table without deallocating it */
+void esh_job_remove(struct esh_pipeline *job);
+
+/* Record a status change reported by wait4(2) for process pid, with
+ * the resources it used if it terminated ('rusage' may be NULL).
+ * Returns the job if all its processes have terminated, NULL otherwise.
+ * A returned job has been removed and must be deallocated by the caller. */
+struct esh_pipeline * esh_job_change_status(pid_t pid, int status,
+                                            const struct rusage *rusage);
+
+/* The most recently completed jobs, oldest first */
+struct list * esh_get_completed_jobs(void);
+
+/* Return how long a job has run, or ran if it completed, in seconds */
+double esh_job_wall_time(struct esh_pipeline *job);
+
+/* Print the resources used by a job and by each of its processes */
+void esh_job_print_usage(struct esh_pipeline *job);
+
+/* Print real, user and sys time to stderr, as 'time' does */
+void esh_print_time(double real, const struct rusage *rusage);
+
+/* Return true if all processes of a job that have not terminated
+ * are stopped */
+bool esh_job_is_stopped(struct esh_pipeline *job);
+
+/* Send SIGCONT to a job and mark it running in the foreground or
+ * background.  Returns false if the signal could not be sent. */
+bool esh_job_resume(struct esh_pipeline *job, enum job_status status);
+
+/* Print a job's commands as '(argv | argv ...)' */
+void esh_job_print_commands(struct esh_pipeline *pipeline);
+
+/* The registry of builtins.  Implemented in esh-builtins.c */
+/* Register builtin 'name'.  Returns false if it already exists. */
+bool esh_builtin_register(const char *name, esh_builtin_t handler);
+
+/* Return the handler for builtin 'name', or NULL */
+esh_builtin_t esh_builtin_lookup(const char *name);
+
+/* Remove builtin 'name'.  Returns false if there is none. */
+bool esh_builtin_unregister(const char *name);
+
+/* Return how often builtins were registered or removed so far */
+unsigned long esh_builtin_changes(void);
+
+/* Call 'fn' with the name of every builtin */
+void esh_builtin_foreach(void (*fn)(const char *name, void *aux), void *aux);
+
+/* Ways of launching pipelines.  Implemented in esh-spawn.c */
+enum esh_spawn_engine {
+    ESH_SPAWN_POSIX,    /* posix_spawn(3), no page table copy (default) */
+    ESH_SPAWN_FORK,     /* fork(2) followed by execvp(3) */
+};
+
+/* Engine used to launch pipelines */
+extern enum esh_spawn_engine esh_spawn_engine;
+
+/* Select engine by name ("spawn" or "fork").  Returns false if unknown. */
+bool esh_spawn_set_engine(const char *name);
+
+/* Start all commands of a pipeline in a new process group, which becomes
+ * the foreground group of terminal tty_fd unless tty_fd is -1.
+ * Sets pgrp and pids.  Returns the number of processes started. */
+int esh_spawn_pipeline(struct esh_pipeline *pipe, int tty_fd);
+
+/* Cached lookup of commands in $PATH.  Implemented in esh-path.c */
+/* Return where to execute command 'name', or NULL if not found */
+const char * esh_path_lookup(const char *name);
+
+/* Forget all remembered command locations */
+void esh_path_clear(void);
+
+/* Print remembered command locations and their hit counts */
+void esh_path_print(void);
+
+/* Cache of parsed command lines.  Implemented in esh-parse-cache.c */
+/* Return a copy of the parsed form of 'line', using 'parse' on a miss.
+ * Returns NULL on a syntax error. */
+struct esh_command_line * esh_parse_cached(char *line,
+                          struct esh_command_line *(*parse)(char *));
+
+/* Set the maximum number of cached lines; 0 disables the cache */
+void esh_parse_cache_set_limit(size_t limit);
+
+/* Forget all cached lines */
+void esh_parse_cache_clear(void);
+
+/* Print cache size, hits, misses and evictions */
+void esh_parse_cache_print(void);
+
+/* The prompt.  Implemented in esh-prompt.c */
+/* Assemble the prompt from the fragments of plugins implementing
+ * make_prompt.  Returns a malloc'd string, or NULL if there are none. */
+char * esh_prompt_build(void);
+
+/* Assemble the prompt without calling or waiting for plugins */
+char * esh_prompt_current(void);
+
+/* Make fragments on a worker thread and cache them (async), or call the
+ * plugins before each prompt (sync).  Returns false on failure. */
+bool esh_prompt_set_async(bool async);
+
+/* Set how long to wait for fresh fragments, and how long they last */
+void esh_prompt_set_deadline(int ms);
+void esh_prompt_set_ttl(int ms);
+
+/* Mark cached fragments stale, e.g. because a job changed state */
+void esh_prompt_invalidate(void);
+
+/* Wait until the prompt worker is not calling into plugin, and forget
+ * its fragment.  Called when plugin is unloaded. */
+void esh_prompt_forget(struct esh_plugin *plugin);
+
+/* An eventfd that is signalled when fragments changed after the prompt
+ * was shown, and a function to consume it */
+int esh_prompt_eventfd(void);
+bool esh_prompt_refreshed(void);
+
+/* Measure prompt-to-input latency: call when ready to build the
+ * prompt, and when it is shown */
+void esh_prompt_latency_start(void);
+void esh_prompt_latency_stop(void);
+
+/* Print prompt mode and latency */
+void esh_prompt_print(void);
+
+/* The execution trace.  Implemented in esh-trace.c */
+/* Events recorded in the trace; see esh_trace_names for their names */
+enum esh_trace_event {
+    ESH_TRACE_LINE,         /* a command line was read; detail is its
+                               beginning */
+    ESH_TRACE_PARSE,        /* parsing a command line; arg is 1 at the
+                               end if it parsed */
+    ESH_TRACE_PLUGIN,       /* a plugin hook; arg is the plugin, detail
+                               the hook */
+    ESH_TRACE_BUILTIN,      /* running a builtin; detail is its name, arg
+                               its exit status at the end */
+    ESH_TRACE_SPAWN,        /* starting one process of a pipeline; detail
+                               is the command, arg its pid at the end */
+    ESH_TRACE_TERMINAL,     /* handing the terminal to process group arg */
+    ESH_TRACE_WAIT,         /* waiting for foreground job arg */
+    ESH_TRACE_CHILD,        /* process arg changed state, to detail */
+    ESH_TRACE_PROMPT,       /* the prompt was shown */
+    ESH_TRACE_NEVENTS
+};
+
+extern const char *esh_trace_names[ESH_TRACE_NEVENTS];
+
+/* True while events are recorded */
+extern bool esh_trace_enabled;
+
+/* Record an event.  'phase' is 'B' (begin), 'E' (end) or 'i' (instant),
+ * as in the Chrome trace event format.  Use the macros below instead. */
+void esh_trace_record(char phase, enum esh_trace_event ev, long arg,
+                      const char *detail);
+
+/* USDT probes esh:begin, esh:end and esh:instant, whose arguments are
+ * the event's name, arg and detail.  Enabled by -DESH_USDT. */
+#ifdef ESH_USDT
+#include <sys/sdt.h>
+#define ESH_TRACE_PROBE(probe, ev, arg, detail) \
+    DTRACE_PROBE3(esh, probe, esh_trace_names[ev], (long) (arg), (detail))
+#else
+#define ESH_TRACE_PROBE(probe, ev, arg, detail) do { } while (0)
+#endif
+
+#define ESH_TRACE_EVENT(probe, phase, ev, arg, detail) do { \
+    ESH_TRACE_PROBE(probe, ev, arg, detail); \
+    if (__builtin_expect(esh_trace_enabled, 0)) \
+        esh_trace_record(phase, ev, (long) (arg), detail); \
+} while (0)
+
+#define ESH_TRACE_BEGIN(ev, arg, detail) \
+    ESH_TRACE_EVENT(begin, 'B', ev, arg, detail)
+#define ESH_TRACE_END(ev, arg, detail) \
+    ESH_TRACE_EVENT(end, 'E', ev, arg, detail)
+#define ESH_TRACE_INSTANT(ev, arg, detail) \
+    ESH_TRACE_EVENT(instant, 'i', ev, arg, detail)
+
+/* Evaluate 'call', a call of plugin's hook 'name', tracing it and
+ * counting its time in ESH_STAT_PLUGIN */
+#define ESH_PLUGIN_HOOK(plugin, name, call) do { \
+    uint64_t esh_hook_start_ = esh_stats_now(); \
+    ESH_TRACE_BEGIN(ESH_TRACE_PLUGIN, plugin, name); \
+    call; \
+    ESH_TRACE_END(ESH_TRACE_PLUGIN, plugin, name); \
+    esh_stats_add_since(ESH_STAT_PLUGIN, esh_hook_start_); \
+} while (0)
+
+/* Start recording into a ring of 'size' events (0 for the default),
+ * keeping what was recorded if the size does not change.  Returns
+ * false if the ring cannot be allocated. */
+bool esh_trace_start(unsigned size);
+
+/* Stop recording */
+void esh_trace_stop(void);
+
+/* Forget the recorded events */
+void esh_trace_clear(void);
+
+/* Write the recorded events as Chrome trace event JSON.  Returns false
+ * on a write error. */
+bool esh_trace_dump(FILE *out);
+
+/* Record from now on, and write the trace to 'path' when esh exits */
+void esh_trace_dump_at_exit(const char *path);
+
+/* Print whether tracing is on, and how many events were recorded */
+void esh_trace_print(void);
+
+/* Latency histograms.  Implemented in esh-stats.c */
+enum esh_stat {
+    ESH_STAT_SPAWN,         /* launching one process of a pipeline */
+    ESH_STAT_EXEC,          /* from fork to a successful exec */
+    ESH_STAT_PARSE,         /* parsing a command line */
+    ESH_STAT_PLUGIN,        /* one plugin hook */
+    ESH_STAT_TERMINAL,      /* give_terminal_to */
+    ESH_STAT_PROMPT,        /* from ready for input until the prompt shows */
+    ESH_STAT_N
+};
+
+/* Return a CLOCK_MONOTONIC timestamp in ns */
+uint64_t esh_stats_now(void);
+
+/* Record a duration of 'ns' nanoseconds */
+void esh_stats_add(enum esh_stat stat, uint64_t ns);
+
+/* Record the time since 'start', as returned by esh_stats_now() */
+void esh_stats_add_since(enum esh_stat stat, uint64_t start);
+
+/* Print a summary of each histogram, in microseconds */
+void esh_stats_print(void);
+
+/* Print where the histograms are exported to, if anywhere */
+void esh_stats_print_export(void);
+
+/* Forget all recorded values */
+void esh_stats_reset(void);
+
+/* Write the histograms in the Prometheus text format to 'path' now,
+ * every 'interval' seconds (0 for the default) and on exit, or stop if
+ * 'path' is NULL.  Returns false if the file cannot be written. */
+bool esh_stats_export(const char *path, int interval);
+
+/* A timerfd that expires when the histograms are due to be exported,
+ * and the function to call when it does */
+int esh_stats_timerfd(void);
+void esh_stats_timer_expired(void);
+
+/* The control socket.  Implemented in esh-control.c */
+/* Run a command line on behalf of a client, with all of its pipelines
+ * in the background if 'background'.  Returns the exit status, or one
+ * of the negative codes below if the line did not run. */
+typedef int (*esh_control_run_t)(char *cmdline, bool background);
+#define ESH_CONTROL_REFUSED -1      /* runs a builtin, with 'background' */
+#define ESH_CONTROL_SYNTAX_ERROR -2 /* does not parse */
+
+/* Listen on a control socket at 'path' (NULL for a default path), and
+ * carry out command lines with 'run'.  Returns false on failure. */
+bool esh_control_open(const char *path, esh_control_run_t run);
+
+/* Close the control socket and its connections.  Returns false if
+ * called while a request is being carried out. */
+bool esh_control_close(void);
+
+/* An epoll descriptor that is readable when the control socket needs
+ * attention, and the function to call when it is */
+int esh_control_fd(void);
+void esh_control_ready(void);
+
+/* Print the socket path and the number of clients and requests */
+void esh_control_print(void);
+
+/* The job table snapshot in shared memory.  Implemented in
+ * esh-snapshot.c; its layout is in esh-snapshot.h */
+/* Start publishing the job table.  Returns false on failure. */
+bool esh_snapshot_start(void);
+
+/* Stop publishing it, and remove the snapshot */
+void esh_snapshot_stop(void);
+
+/* Copy the job table to the snapshot, if it is published */
+void esh_snapshot_update(void);
+
+/* Print whether the job table is published, and where */
+void esh_snapshot_print(void);
+
+/* Persistent history.  Implemented in esh-history.c */
+/* Keep history in file 'path', load its most recent lines into
+ * readline and bind Ctrl-R and Alt-P to search all of it.  Returns
+ * false if the file cannot be opened. */
+bool esh_history_open(const char *path);
+
+/* Add a command line to the history, unless it is empty, starts with
+ * a space or repeats the previous one */
+void esh_history_add(const char *line);
+
+/* Print the last 'n' lines with their numbers, or a default number
+ * of them if 'n' is negative */
+void esh_history_print(long n);
+
+/* Print the lines that contain 'query' (or start with it if 'prefix'),
+ * newest first, each only once.  Returns the number printed. */
+long esh_history_search(const char *query, bool prefix);
+
+/* Rewrite the file with only the most recent copy of each line.
+ * Returns false on failure. */
+bool esh_history_compact(void);
+
+/* Print the history file, its size and that of its index */
+void esh_history_print_info(void);
+
+/* Command name completion.  Implemented in esh-complete.c */
+/* Complete command names from an index of $PATH and the builtins */
+void esh_complete_init(void);
+
+/* An inotify descriptor that is readable when a directory in $PATH
+ * changed, and the function to call when it is */
+int esh_complete_fd(void);
+void esh_complete_ready(void);
+
+/* Print the commands that start with 'prefix', or if it is NULL, the
+ * size of the index */
+void esh_complete_print(const char *prefix);
 
-/* Job Execution Declarations */
-int process_type(char *);
 
 /* Global variable to keep track of job ids */
-int jid;
+extern int jid;
+
+#endif /* esh.h */
@@ -0,0 +1,147 @@
+/*
+ * esh-ps - list the jobs of running shells from their snapshots.
+ *
+ * Reads the job table snapshot that shells publish in shared memory
+ * when started with ESH_SNAPSHOT=1 or after 'snapshot on' (see
+ * esh-snapshot.h), for the given shell pids, or for every shell that
+ * publishes one.  With -w, prints them again every 'interval' seconds;
+ * once mapped, a snapshot is read without any system calls.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esh-snapshot.h"
+
+#define MAX_SHELLS 1024
+
+static const char *status_names[] = {
+    [ESH_SNAPSHOT_FOREGROUND] = "Foreground",
+    [ESH_SNAPSHOT_BACKGROUND] = "Running",
+    [ESH_SNAPSHOT_STOPPED] = "Stopped",
+    [ESH_SNAPSHOT_NEEDSTERMINAL] = "Needs Terminal",
+};
+
+static const struct esh_snapshot *shells[MAX_SHELLS];
+static pid_t pids[MAX_SHELLS];
+static int nshells;
+
+static void
+usage(char *progname)
+{
+    printf("Usage: %s [-w interval] [pid...]\n", progname);
+    exit(EXIT_SUCCESS);
+}
+
+static void
+add_shell(pid_t pid, bool quiet)
+{
+    const struct esh_snapshot *s = esh_snapshot_map(pid);
+
+    if (s == NULL) {
+        if (!quiet)
+            fprintf(stderr, "esh-ps: %d: %s\n", (int) pid, strerror(errno));
+        return;
+    }
+    if (nshells < MAX_SHELLS) {
+        pids[nshells] = pid;
+        shells[nshells++] = s;
+    }
+}
+
+/* Map the snapshot of every shell that publishes one */
+static void
+add_all_shells(void)
+{
+    DIR *dir = opendir("/dev/shm");
+    struct dirent *d;
+    int pid;
+
+    if (dir == NULL) {
+        perror("/dev/shm");
+        exit(EXIT_FAILURE);
+    }
+    while ((d = readdir(dir)) != NULL)
+        if (sscanf(d->d_name, "esh-snapshot.%d", &pid) == 1)
+            add_shell(pid, true);
+    closedir(dir);
+}
+
+/* Print the jobs of one shell.  Returns false if it has exited. */
+static bool
+print_shell(const struct esh_snapshot *shared, pid_t pid, uint64_t now)
+{
+    static struct esh_snapshot s;
+    int i;
+
+    if (!esh_snapshot_read(shared, &s)) {
+        printf("esh %d: %s\n", (int) pid,
+               errno == EAGAIN ? "not responding" : "exited");
+        return false;
+    }
+
+    printf("esh %d: %d jobs, %lu updates\n", (int) pid, s.njobs,
+           (unsigned long) s.updates);
+    for (i = 0; i < s.nlisted; i++) {
+        struct esh_snapshot_job *j = &s.jobs[i];
+        printf("  [%d] %-7d %-10s %d/%d %8.1fs user %.3fs sys %.3fs "
+               "rss %ld KB %016llx %s\n", j->jid, j->pgrp,
+               j->status >= 0 && j->status <= ESH_SNAPSHOT_NEEDSTERMINAL
+               ? status_names[j->status] : "?", j->nrunning, j->nprocs,
+               (now - j->started_ns) / 1e9, j->utime_us / 1e6,
+               j->stime_us / 1e6, (long) j->maxrss_kb,
+               (unsigned long long) j->argv_digest, j->command);
+    }
+    if (s.njobs > s.nlisted)
+        printf("  ... %d more\n", s.njobs - s.nlisted);
+    return true;
+}
+
+int
+main(int ac, char *av[])
+{
+    int opt, i;
+    double interval = 0;
+
+    while ((opt = getopt(ac, av, "hw:")) > 0) {
+        switch (opt) {
+        case 'w':
+            interval = atof(optarg);
+            break;
+        default:
+            usage(av[0]);
+        }
+    }
+
+    if (optind == ac)
+        add_all_shells();
+    for (i = optind; i < ac; i++)
+        add_shell(atoi(av[i]), false);
+
+    do {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        uint64_t now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+        for (i = 0; i < nshells; i++) {
+            if (shells[i] != NULL && !print_shell(shells[i], pids[i], now)) {
+                esh_snapshot_unmap(shells[i]);
+                shells[i] = NULL;
+            }
+        }
+        fflush(stdout);
+
+        if (interval > 0) {
+            ts.tv_sec = interval;
+            ts.tv_nsec = (interval - ts.tv_sec) * 1e9;
+            nanosleep(&ts, NULL);
+        }
+    } while (interval > 0);
+
+    return nshells > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}